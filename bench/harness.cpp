@@ -0,0 +1,167 @@
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "harness.h"
+
+// adds a benchmark, its setup only runs if the benchmark is selected
+void Harness::add(const std::string& name, BenchSetup setup){
+    this->benchmarks.push_back({name, std::move(setup)});
+}
+
+// prints the name of every benchmark
+void Harness::list(std::ostream& out){
+    for (auto& benchmark : this->benchmarks)
+        out << benchmark.first << "\n";
+}
+
+// times each run of a benchmark after a warm up run, and summarizes the time per operation
+BenchResult Harness::measure(const std::string& name, const BenchBody& body, size_t runs){
+    typedef std::chrono::steady_clock clock;
+    BenchResult result;
+    result.name = name;
+    result.runs = runs;
+    body();
+    std::vector<double> samples;
+    for (size_t i = 0; i < runs; i++){
+        clock::time_point start = clock::now();
+        uint64_t ops = body();
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        if (!ops)
+            throw std::runtime_error(name + " performed no operations");
+        result.ops = ops;
+        samples.push_back(ns / ops);
+    }
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+    result.mean = sum / runs;
+    double variance = 0;
+    for (double sample : samples)
+        variance += (sample - result.mean) * (sample - result.mean);
+    // the sample standard deviation, a single run has none
+    result.stddev = (runs > 1) ? std::sqrt(variance / (runs - 1)) : 0;
+    result.min = *std::min_element(samples.begin(), samples.end());
+    result.max = *std::max_element(samples.begin(), samples.end());
+    return result;
+}
+
+/* runs every benchmark whose name contains the filter, printing each result as it finishes, and
+   compares them to the baseline if there is one. Returns false if any of them regressed */
+bool Harness::run(const BenchOptions& options){
+    if (!options.runs)
+        throw std::runtime_error("benchmarks need at least one run");
+    std::unordered_map<std::string, BenchResult> baseline;
+    if (!options.baseline_path.empty())
+        baseline = read_results(options.baseline_path);
+    std::vector<BenchResult> results;
+    size_t regressions = 0;
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right << std::setw(12) << "ns/op" << std::setw(12) << "stddev";
+    std::cout << std::setw(8) << "cv%" << std::setw(12) << "min";
+    if (!baseline.empty())
+        std::cout << std::setw(12) << "baseline" << std::setw(10) << "change";
+    std::cout << "\n";
+    for (auto& benchmark : this->benchmarks){
+        if (benchmark.first.find(options.filter) == std::string::npos)
+            continue;
+        BenchBody body = benchmark.second();
+        BenchResult result = this->measure(benchmark.first, body, options.runs);
+        results.push_back(result);
+        double cv = result.mean ? 100 * result.stddev / result.mean : 0;
+        std::cout << std::left << std::setw(32) << result.name << std::right << std::fixed << std::setprecision(2);
+        std::cout << std::setw(12) << result.mean << std::setw(12) << result.stddev << std::setw(8) << std::setprecision(1) << cv;
+        std::cout << std::setw(12) << std::setprecision(2) << result.min;
+        auto itt = baseline.find(result.name);
+        if (itt != baseline.end()){
+            const BenchResult& base = itt->second;
+            double change = base.mean ? 100 * (result.mean - base.mean) / base.mean : 0;
+            // a difference within the noise of both measurements isn't counted, however large it is
+            double noise = 2 * std::sqrt(result.stddev * result.stddev + base.stddev * base.stddev);
+            bool significant = std::fabs(result.mean - base.mean) > noise;
+            std::cout << std::setw(12) << base.mean << std::setw(9) << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos;
+            if (significant && change > options.threshold){
+                std::cout << "  REGRESSION";
+                regressions++;
+            }
+            else if (significant && change < -options.threshold)
+                std::cout << "  improved";
+        }
+        std::cout << std::endl;
+    }
+    if (!options.json_path.empty()){
+        std::ofstream out(options.json_path);
+        if (!out.good())
+            throw std::runtime_error("failed to write the results to " + options.json_path);
+        write_results(out, results);
+    }
+    if (regressions)
+        std::cout << regressions << " benchmark(s) regressed by more than " << options.threshold << "% against " << options.baseline_path << std::endl;
+    return regressions == 0;
+}
+
+// writes the results as JSON, which can be read back as a baseline
+void write_results(std::ostream& out, const std::vector<BenchResult>& results){
+    out << "{\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [";
+    out << std::setprecision(17);
+    for (size_t i = 0; i < results.size(); i++){
+        const BenchResult& result = results[i];
+        out << (i ? ",\n" : "\n");
+        out << "    {\"name\": \"" << result.name << "\", \"mean\": " << result.mean << ", \"stddev\": " << result.stddev;
+        out << ", \"min\": " << result.min << ", \"max\": " << result.max << ", \"runs\": " << result.runs << ", \"ops\": " << result.ops << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// returns the number following a key in a result's JSON object, or zero if the key isn't there
+static double read_field(const std::string& object, const std::string& key){
+    size_t pos = object.find("\"" + key + "\"");
+    if (pos == std::string::npos)
+        return 0;
+    pos = object.find(':', pos);
+    if (pos == std::string::npos)
+        return 0;
+    return std::strtod(object.c_str() + pos + 1, nullptr);
+}
+
+/* reads the results written by write_results. This only reads that format, each result being an
+   object with a name and numeric fields, rather than JSON in general */
+std::unordered_map<std::string, BenchResult> read_results(const std::string& path){
+    std::ifstream in(path);
+    if (!in.good())
+        throw std::runtime_error("failed to read the baseline " + path);
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string text = buf.str();
+    size_t pos = text.find("\"benchmarks\"");
+    if (pos == std::string::npos)
+        throw std::runtime_error("malformed baseline (no benchmarks)");
+    std::unordered_map<std::string, BenchResult> results;
+    while ((pos = text.find('{', pos)) != std::string::npos){
+        size_t end = text.find('}', pos);
+        if (end == std::string::npos)
+            throw std::runtime_error("malformed baseline (unterminated result)");
+        std::string object = text.substr(pos, end - pos);
+        size_t name_pos = object.find("\"name\"");
+        size_t start = (name_pos == std::string::npos) ? std::string::npos : object.find('"', object.find(':', name_pos));
+        size_t stop = (start == std::string::npos) ? std::string::npos : object.find('"', start + 1);
+        if (stop == std::string::npos)
+            throw std::runtime_error("malformed baseline (result without a name)");
+        BenchResult result;
+        result.name = object.substr(start + 1, stop - start - 1);
+        result.mean = read_field(object, "mean");
+        result.stddev = read_field(object, "stddev");
+        result.min = read_field(object, "min");
+        result.max = read_field(object, "max");
+        result.runs = read_field(object, "runs");
+        result.ops = read_field(object, "ops");
+        results[result.name] = result;
+        pos = end;
+    }
+    return results;
+}
@@ -0,0 +1,70 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// how many times each benchmark is repeated after its warm up run
+#define DEFAULT_BENCH_RUNS 10
+// how much slower than the baseline a benchmark must be, in percent, to be reported as a regression
+#define DEFAULT_REGRESSION_THRESHOLD 5.0
+
+// runs a single repetition of a benchmark, returning the number of operations it performed
+typedef std::function<uint64_t()> BenchBody;
+// sets up everything a benchmark needs outside of the timed runs, returning the body to time
+typedef std::function<BenchBody()> BenchSetup;
+
+// a benchmark's time per operation over its runs, in nanoseconds
+struct BenchResult{
+    std::string name;
+    double mean {0};
+    double stddev {0};
+    double min {0};
+    double max {0};
+    size_t runs {0};
+    uint64_t ops {0};
+};
+
+// how the harness selects, runs and reports the benchmarks
+struct BenchOptions{
+    size_t runs {DEFAULT_BENCH_RUNS};
+    std::string filter;
+    std::string json_path;
+    std::string baseline_path;
+    double threshold {DEFAULT_REGRESSION_THRESHOLD};
+};
+
+/* a registry of named benchmarks. Each one is set up once, run once to warm up, then timed over a
+   number of runs, and its mean time per operation is compared to a baseline saved by an earlier
+   run, which is flagged as a regression if it's slower by more than the threshold and by more
+   than the noise in both measurements */
+class Harness{
+    public:
+        void add(const std::string& name, BenchSetup setup);
+        void list(std::ostream& out);
+        bool run(const BenchOptions& options);
+    private:
+        BenchResult measure(const std::string& name, const BenchBody& body, size_t runs);
+        std::vector<std::pair<std::string, BenchSetup> > benchmarks;
+};
+
+void write_results(std::ostream& out, const std::vector<BenchResult>& results);
+std::unordered_map<std::string, BenchResult> read_results(const std::string& path);
+
+// keeps the compiler from optimizing away a value a benchmark computes
+template <typename T>
+inline void keep(const T& val){
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(val) : "memory");
+#else
+    const volatile T* sink = &val;
+    (void)sink;
+#endif
+}
+
+#endif
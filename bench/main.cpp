@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "../inc/assembler.h"
+#include "../inc/decoder.h"
+#include "../inc/heap.h"
+#include "../inc/guest_memory.h"
+#include "../inc/instruction.h"
+#include "../inc/machine.h"
+#include "../inc/program.h"
+#include "../inc/stack.hpp"
+#include "../inc/util.hpp"
+
+// the number of times each family benchmark runs its loop body, of eight instructions
+#define DISPATCH_ITERATIONS 100000
+// the number of operations in each run of the benchmarks of a single function
+#define MICRO_OPS 1000000
+// the number of lines in the synthetic programs that are loaded and assembled
+#define SYNTHETIC_LINES 100000
+
+void print_error(const std::string& err_msg);
+void print_help();
+
+// a stream buffer that discards everything written to it, so I/O benchmarks don't measure the terminal
+class NullBuffer : public std::streambuf{
+    protected:
+        int overflow(int c) override {return c;}
+        std::streamsize xsputn(const char*, std::streamsize count) override {return count;}
+};
+
+/* a directory for the programs the benchmarks assemble and load, which is removed along with
+   everything in it when the benchmarks finish */
+class TempDir{
+    public:
+        TempDir(){
+            const char* base = getenv("TMPDIR");
+            std::string path = std::string(base ? base : "/tmp") + "/tvm-bench-XXXXXX";
+            if (!mkdtemp(&path[0]))
+                throw std::runtime_error("failed to create a temporary directory");
+            this->path = path;
+        }
+        ~TempDir(){
+            std::error_code err;
+            std::filesystem::remove_all(this->path, err);
+        }
+        // writes a file to the directory and returns its path
+        std::string write(const std::string& name, const std::string& contents){
+            std::string file_path = this->file(name);
+            std::ofstream out(file_path);
+            out << contents;
+            if (!out.good())
+                throw std::runtime_error("failed to write " + file_path);
+            return file_path;
+        }
+        // returns the path of a file in the directory, which is removed with it
+        std::string file(const std::string& name){
+            return this->path + "/" + name;
+        }
+    private:
+        std::string path;
+};
+
+static NullBuffer null_buffer;
+static std::ostream null_stream(&null_buffer);
+
+// the execution functions of the default operation families, as a machine registers them
+static ExtensionTable default_families(){
+    return {
+        {0x00, exec_mem},
+        {0x10, exec_logic},
+        {0x20, exec_jump},
+        {0x30, exec_stack},
+        {0x40, exec_io},
+        {0x50, exec_heap},
+        {0x70, exec_thread},
+    };
+}
+
+// assembles source code into a tcode file in the temporary directory, returning its path
+static std::string assemble(TempDir& dir, const std::string& name, const std::string& source, int format = TCODE_VERSION){
+    std::string in = dir.write(name + ".tasm", source);
+    std::string out = dir.file(name + ".tcode");
+    Assembler assembler;
+    assembler.set_format(format);
+    assembler.assemble_file(in, out);
+    return out;
+}
+
+/* a loop running the body of eight instructions from a single family, with a word, a string and a
+   function that's just a ret for the body to use */
+static std::string family_program(const std::string& body, size_t iterations){
+    std::stringstream source;
+    source << "cell: .word\n";
+    source << "msg: .stringz \"ab\"\n";
+    source << "loada r9 cell\n";
+    source << "loada r14 msg\n";
+    source << "loadi r7 3\n";
+    source << "loadi r8 1\n";
+    source << "loadi r12 0\n";
+    source << "loadi r13 " << iterations << "\n";
+    source << "top:\n";
+    source << body;
+    source << "addi r12 r12 1\n";
+    source << "jlt r12 r13 top\n";
+    source << "fn:\n";
+    source << "ret\n";
+    return source.str();
+}
+
+// the loop body exercising each operation family
+static const std::vector<std::pair<std::string, std::string> > family_bodies{
+    {"memory",
+        "copy r10 r7\nloadi r11 5\nstow r9 r8\nloadw r10 r9\nstob r9 r7\nloadb r11 r9\nloada r10 cell\ncopy r11 r10\n"},
+    {"logic",
+        "add r10 r7 r8\nsub r11 r10 r8\nmul r10 r7 r8\nxor r11 r10 r7\nand r10 r11 r8\nor r11 r10 r7\naddi r10 r10 3\ncompi r11 r10 4\n"},
+    {"jump",
+        "j a1\na1:\njeq r7 r8 a2\na2:\njne r7 r8 a3\na3:\njgt r8 r7 a4\na4:\njlt r8 r7 a5\na5:\ncall fn\nj a6\na6:\n"},
+    {"stack",
+        "push r7\npushi 3\npushb r8\npushbi 1\npopb r10\npop r10\npopb r11\npop r11\n"},
+    {"io",
+        "puti r7\nputs r14\nputi r8\nputs r14\nputi r7\nputs r14\nputi r8\nputs r14\n"},
+    {"heap",
+        "halloc r10 24\nhfree r10\nhalloc r11 100\nhfree r11\nhalloc r10 3000\nhfree r10\nhalloc r11 16\nhfree r11\n"},
+    {"thread",
+        "aload r10 r9\nastore r9 r8\nfadd r10 r9 r8\nfaddi r10 r9 1\ncas r10 r9 r8 r7\naload r11 r9\nastorei r9 5\nfaddi r11 r9 2\n"},
+    {"vector",
+        "vbcast v1 r7\nvload v2 r9\nvadd v3 v1 v2\nvmul v3 v3 v1\nvxori v3 v3 5\nvgt v4 v3 v1\nvstore r9 v4\nvsum r10 v3\n"},
+};
+
+/* a program of the given number of lines mixing every kind of line the assembler reads: data
+   labels, program labels, jumps forward and back, and instructions from each family */
+static std::string synthetic_program(size_t lines){
+    static const char* instructions[] = {
+        "add r7 r8 r9", "subi r10 r7 12", "mul r11 r10 r7", "xori r7 r7 255", "copy r8 r7",
+        "loadi r9 1234", "stow r12 r9", "loadw r10 r12", "push r7", "pop r8", "pushi 42", "pop r9",
+        "compi r10 r7 3", "sr r7 r8 2", "puti r7", "halloc r11 64",
+    };
+    std::stringstream source;
+    size_t label = 0;
+    for (size_t line = 0; line < lines; line++){
+        if (line % 1000 == 0){
+            source << "d" << line << ": .word\n";
+            source << "loada r12 d" << line << "\n";
+            line++;
+        }
+        else if (line % 16 == 0)
+            source << "l" << label++ << ":\n";
+        else if (line % 16 == 15)
+            // alternately back to the label before this one, and on to the next
+            source << "jlt r7 r8 l" << ((line % 32 == 15 && label) ? label - 1 : label) << "\n";
+        else
+            source << instructions[line % 16] << "\n";
+    }
+    // the last jump refers to the label after it
+    source << "l" << label << ":\n";
+    return source.str();
+}
+
+// registers every benchmark, each one assembling or allocating what it needs when it's selected
+static void register_benchmarks(Harness& harness, TempDir& dir){
+    // instruction dispatch in the interpreters, by family
+    // a verified program runs on the threaded interpreter without its bounds checks
+    const char* engines[] = {"switch", "threaded", "unchecked"};
+    for (size_t engine = 0; engine < 3; engine++){
+        for (auto& family : family_bodies){
+            std::string name = std::string("dispatch/") + engines[engine] + "/" + family.first;
+            int engine_type = engine ? THREADED_ENGINE : SWITCH_ENGINE;
+            int verify = engine == 2 ? VERIFY_ON : VERIFY_OFF;
+            harness.add(name, [&dir, &family, engine_type, verify](){
+                std::string path = assemble(dir, "family_" + family.first, family_program(family.second, DISPATCH_ITERATIONS));
+                // without fusion each instruction is dispatched on its own
+                std::shared_ptr<const Program> program = Program::load(path, default_families(), false, false, verify);
+                Machine counter(program);
+                counter.set_streams(&std::cin, &null_stream);
+                counter.set_count_instructions(true);
+                counter.exec();
+                uint64_t executed = counter.get_executed();
+                return BenchBody([program, engine_type, executed](){
+                    Machine machine(program);
+                    machine.set_streams(&std::cin, &null_stream);
+                    machine.set_engine(engine_type);
+                    machine.exec();
+                    return executed;
+                });
+            });
+        }
+    }
+
+    // a single instruction run through Machine::exec_inst, as run-debug steps through a program
+    static const std::vector<std::pair<std::string, std::vector<std::string> > > single_insts{
+        {"memory", {"copy r10 r7"}},
+        {"logic", {"add r10 r7 r8"}},
+        {"stack", {"push r7", "pop r10"}},
+    };
+    for (auto& inst : single_insts){
+        harness.add("exec_inst/" + inst.first, [&inst](){
+            Assembler assembler;
+            std::vector<Instruction> insts;
+            for (const std::string& line : inst.second)
+                insts.push_back(assembler.assemble_inst(line));
+            std::shared_ptr<Machine> machine(new Machine());
+            machine->set_register(7, 3);
+            machine->set_register(8, 1);
+            return BenchBody([machine, insts](){
+                for (size_t i = 0; i < MICRO_OPS; i += insts.size()){
+                    for (const Instruction& inst : insts)
+                        machine->exec_inst(inst);
+                }
+                keep(machine->get_register(10));
+                return MICRO_OPS;
+            });
+        });
+    }
+
+    // the VM stack
+    harness.add("stack/push_pop", [](){
+        std::shared_ptr<Stack> stack(new Stack());
+        return BenchBody([stack](){
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < MICRO_OPS / 2; i++){
+                stack->push(i);
+                keep(stack.get());
+                sum += stack->pop();
+            }
+            keep(sum);
+            return MICRO_OPS;
+        });
+    });
+    harness.add("stack/fill_drain", [](){
+        std::shared_ptr<Stack> stack(new Stack());
+        return BenchBody([stack](){
+            // fills most of the default stack, then empties it
+            size_t depth = stack->capacity() / 2;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < depth; i++)
+                stack->push(i);
+            while (!stack->is_empty())
+                sum += stack->pop();
+            keep(sum);
+            return depth * 2;
+        });
+    });
+
+    // the heap behind halloc and hfree, a pair of alloc and free is two operations
+    static const std::vector<std::pair<std::string, size_t> > heap_sizes{{"small", 24}, {"medium", 1500}, {"large", 8192}};
+    for (auto& size : heap_sizes){
+        harness.add("heap/alloc_free_" + size.first, [&size](){
+            std::shared_ptr<GuestMemory> memory(new GuestMemory());
+            std::shared_ptr<Heap> heap(new Heap());
+            size_t bytes = size.second;
+            return BenchBody([memory, heap, bytes](){
+                for (size_t i = 0; i < MICRO_OPS / 2; i++){
+                    uint64_t addr = heap->alloc(*memory, bytes);
+                    keep(addr);
+                    heap->free(*memory, addr);
+                }
+                return MICRO_OPS;
+            });
+        });
+    }
+    harness.add("heap/alloc_free_batch", [](){
+        std::shared_ptr<GuestMemory> memory(new GuestMemory());
+        std::shared_ptr<Heap> heap(new Heap());
+        return BenchBody([memory, heap](){
+            // holds a thousand blocks of mixed sizes at a time, freeing them in the order they were taken
+            std::vector<uint64_t> addrs(1000);
+            for (size_t i = 0; i < MICRO_OPS / 2; i += addrs.size()){
+                for (size_t j = 0; j < addrs.size(); j++)
+                    addrs[j] = heap->alloc(*memory, 16 << (j % 6));
+                for (uint64_t addr : addrs)
+                    heap->free(*memory, addr);
+            }
+            return MICRO_OPS;
+        });
+    });
+
+    // converting words to and from big-endian bytes, as version 1 tcode stores them
+    harness.add("bytes/split_bytes", [](){
+        return BenchBody([](){
+            uint8_t out[8];
+            for (uint64_t i = 0; i < MICRO_OPS; i++){
+                split_bytes<uint64_t>(i * 0x9e3779b97f4a7c15ull, out);
+                keep(static_cast<const uint8_t*>(out));
+            }
+            return MICRO_OPS;
+        });
+    });
+    harness.add("bytes/merge_bytes", [](){
+        return BenchBody([](){
+            uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < MICRO_OPS; i++){
+                data[i & 7] = i;
+                keep(static_cast<const uint8_t*>(data));
+                sum += merge_bytes<uint64_t>(data);
+            }
+            keep(sum);
+            return MICRO_OPS;
+        });
+    });
+
+    // encoding and decoding single instructions
+    harness.add("instruction/to_bytes", [](){
+        return BenchBody([](){
+            Instruction inst;
+            inst.op_code = 0x21;
+            inst.registers = 0x78;
+            for (uint64_t i = 0; i < MICRO_OPS; i++){
+                inst.extend = i;
+                std::array<uint8_t, 10> bytes = inst.to_bytes();
+                keep(bytes.data());
+            }
+            return MICRO_OPS;
+        });
+    });
+    harness.add("instruction/from_bytes", [](){
+        return BenchBody([](){
+            std::array<uint8_t, 10> bytes = {0x21, 0x78, 0, 0, 0, 0, 0, 0, 0, 0};
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < MICRO_OPS; i++){
+                bytes[9] = i;
+                keep(bytes.data());
+                sum += Instruction::from_bytes(bytes).extend;
+            }
+            keep(sum);
+            return MICRO_OPS;
+        });
+    });
+    harness.add("decoder/append", [](){
+        Assembler assembler;
+        std::shared_ptr<std::vector<Instruction> > insts(new std::vector<Instruction>);
+        for (const char* line : {"add r7 r8 r9", "addi r7 r7 1", "push r7", "loadi r8 5", "puti r7", "copy r7 r8", "sub r7 r8 r9", "halloc r9 24"})
+            insts->push_back(assembler.assemble_inst(line));
+        return BenchBody([insts](){
+            DecodedCode code;
+            code.reserve(MICRO_OPS);
+            for (size_t i = 0; i < MICRO_OPS; i++)
+                code.append((*insts)[i % insts->size()]);
+            keep(code.ops.data());
+            return MICRO_OPS;
+        });
+    });
+
+    // loading and decoding a large program, per instruction
+    const int formats[] = {1, 2};
+    for (int format : formats){
+        harness.add("tcode/load_v" + std::to_string(format), [&dir, format](){
+            std::string path = assemble(dir, "load_v" + std::to_string(format), synthetic_program(SYNTHETIC_LINES), format);
+            ExtensionTable families = default_families();
+            uint64_t insts = Program::load(path, families, true)->size();
+            return BenchBody([path, families, insts](){
+                std::shared_ptr<const Program> program = Program::load(path, families, true);
+                keep(program.get());
+                return insts;
+            });
+        });
+    }
+    harness.add("tcode/load_cached", [&dir](){
+        std::string path = assemble(dir, "load_cached", synthetic_program(SYNTHETIC_LINES));
+        // keep the images in the benchmark's own directory, the first load writes the image every later one reads
+        setenv("TVM_CACHE_DIR", dir.file("cache").c_str(), 1);
+        ExtensionTable families = default_families();
+        uint64_t insts = Program::load(path, families, true, true)->size();
+        return BenchBody([path, families, insts](){
+            std::shared_ptr<const Program> program = Program::load(path, families, true, true);
+            keep(program.get());
+            return insts;
+        });
+    });
+
+    // assembling lines, alone and as a whole file
+    harness.add("assembler/assemble_inst", [](){
+        std::shared_ptr<std::vector<std::string> > lines(new std::vector<std::string>);
+        std::stringstream source(synthetic_program(1000));
+        std::string line;
+        while (std::getline(source, line)){
+            // labels can only be resolved when assembling a file
+            if (line.find(':') == std::string::npos && line.compare(0, 3, "jlt") && line.compare(0, 5, "loada"))
+                lines->push_back(line);
+        }
+        return BenchBody([lines](){
+            Assembler assembler;
+            for (size_t i = 0; i < MICRO_OPS / 10; i++){
+                Instruction inst = assembler.assemble_inst((*lines)[i % lines->size()]);
+                keep(inst.extend);
+            }
+            return MICRO_OPS / 10;
+        });
+    });
+    harness.add("assembler/assemble_file", [&dir](){
+        std::string in = dir.write("assemble.tasm", synthetic_program(SYNTHETIC_LINES));
+        std::string out = dir.file("assemble.tcode");
+        return BenchBody([in, out](){
+            Assembler assembler;
+            assembler.assemble_file(in, out);
+            return SYNTHETIC_LINES;
+        });
+    });
+    harness.add("assembler/assemble_file_parallel", [&dir](){
+        std::string in = dir.write("assemble.tasm", synthetic_program(SYNTHETIC_LINES));
+        std::string out = dir.file("assemble.tcode");
+        return BenchBody([in, out](){
+            Assembler assembler;
+            assembler.set_threads(std::max(std::thread::hardware_concurrency(), 1u));
+            assembler.assemble_file(in, out);
+            return SYNTHETIC_LINES;
+        });
+    });
+}
+
+int main(int argc, char** argv){
+    BenchOptions options;
+    bool list = false;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        size_t eq_pos = arg.find('=');
+        std::string name = arg.substr(0, eq_pos);
+        std::string val = (eq_pos == std::string::npos) ? "" : arg.substr(eq_pos + 1);
+        try{
+            if (name == "--runs")
+                options.runs = std::stoul(val);
+            else if (name == "--filter")
+                options.filter = val;
+            else if (name == "--json")
+                options.json_path = val;
+            else if (name == "--baseline")
+                options.baseline_path = val;
+            else if (name == "--threshold")
+                options.threshold = std::stod(val);
+            else if (name == "--list")
+                list = true;
+            else if (name == "help" || name == "--help"){
+                print_help();
+                return 0;
+            }
+            else{
+                print_error("unrecognized option: " + arg + ". Use 'tvm-bench help' for more information");
+                return 1;
+            }
+        }
+        catch (std::logic_error&){
+            print_error("invalid value for " + name + ": " + val);
+            return 1;
+        }
+    }
+    try{
+        TempDir dir;
+        Harness harness;
+        register_benchmarks(harness, dir);
+        if (list){
+            harness.list(std::cout);
+            return 0;
+        }
+        // a regression exits with a distinct status, so scripts can tell it apart from an error
+        return harness.run(options) ? 0 : 2;
+    }
+    catch (std::runtime_error& err){
+        print_error(err.what());
+        return 1;
+    }
+}
+
+void print_error(const std::string& err_msg) {
+    std::cout << "\033[31mError:\033[0m " << err_msg << std::endl;
+}
+
+void print_help(){
+    std::cout << "Usage: tvm-bench [options]\n";
+    std::cout << "Benchmark options\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--runs=<count>" << "the number of timed runs of each benchmark (defaults to " << DEFAULT_BENCH_RUNS << ")" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--filter=<text>" << "only runs the benchmarks whose names contain the text" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--list" << "lists the benchmarks without running them" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--json=<file>" << "writes the results as JSON, to be used as a baseline" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--baseline=<file>" << "compares the results to those saved by an earlier run" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--threshold=<percent>" << "how much slower than the baseline is a regression (defaults to " << DEFAULT_REGRESSION_THRESHOLD << ")" << "\n";
+    std::cout << "Visit https://github.com/DrewRoss5/TinkerVM for more information" << std::endl;
+}
@@ -3,15 +3,52 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "instruction.h"
+#include "lexer.h"
+#include "tcode.h"
+#include "optimizer.h"
 
 #define NULL_INST 255
+// chunks of source each assembling thread is given, so threads that finish early can take on more
+#define ASM_CHUNKS_PER_THREAD 4
+// the least source worth giving a thread of its own, in bytes
+#define ASM_MIN_CHUNK (1 << 16)
+// the directive that lets other objects refer to a label
+#define GLOBAL_DIRECTIVE ".global"
+
+// a data label's declaration, parsed before it's given its place in the data layout
+struct DataDecl{
+    std::string name;
+    uint32_t type;
+    uint64_t size;
+    std::string str;
+    size_t pos;
+};
+
+/* a run of whole lines of the source, assembled on its own. Its labels are collected first, then
+   once every chunk's labels are known its instructions are assembled into its own buffer. Lines
+   and positions are counted from the start of the chunk, the first error stops the chunk */
+struct AsmChunk{
+    std::string_view source;
+    size_t first_line {0};
+    size_t first_inst {0};
+    size_t lines {0};
+    size_t inst_count {0};
+    std::vector<std::pair<std::string_view, size_t> > prog_labels;
+    std::vector<std::string_view> globals;
+    std::vector<DataDecl> data_decls;
+    std::vector<Instruction> data_insts;
+    std::vector<Instruction> instructions;
+    size_t error_line {0};
+    std::string error;
+};
 
 
-std::vector<std::string> split_str(const std::string& str);
-std::string parse_str_lit(std::string& str_lit, bool null_terminate);
+std::string parse_str_lit(std::string_view str_lit, bool null_terminate);
  
 class Assembler{
     public:
@@ -19,89 +56,55 @@ class Assembler{
         void assemble_file(const std::string& in_path, const std::string& outpath);
         void add_extension(const std::string& operation, Instruction(*parser)(const std::vector<std::string>&));
         Instruction assemble_inst(const std::string& inst);
-        static uint8_t parse_reg(const std::string& reg);
+        static uint8_t parse_reg(std::string_view reg);
+        static uint8_t parse_vector_reg(std::string_view reg);
         static uint8_t merge_registers(uint8_t r1, uint8_t r2);
+        void set_format(int version) {this->format = version;}
+        void set_debug_info(bool enabled) {this->debug_info = enabled;}
+        void set_threads(size_t threads) {this->threads = threads ? threads : 1;}
+        void set_object(bool enabled) {this->object = enabled;}
+        void set_opt_level(int level) {this->opt_level = level;}
+        const OptStats& get_opt_stats() const {return this->opt_stats;}
     private:
-        uint8_t parse_op(const std::string& op);
-        Instruction parse_extend(const std::vector<std::string>& operands);
-        uint64_t parse_immediate(const std::string& imm);
-        uint64_t parse_jmp_label(const std::string& label);
-        uint64_t parse_data_label(const std::string& label);
-        Instruction parse_label(const std::string& label);
-        Instruction parse_mem(uint8_t op_code, const std::vector<std::string>& operands);
-        Instruction parse_logic(uint8_t op_code, const std::vector<std::string>& operands);
-        Instruction parse_stack(uint8_t op_code, const std::vector<std::string>& operands);
-        Instruction parse_jump(uint8_t op_code, const std::vector<std::string>& operands);
-        Instruction parse_io(uint8_t op_code, const std::vector<std::string>& operands);
-        Instruction parse_heap(uint8_t op_code, const std::vector<std::string>& operands);
-        void scan_prog_labels(std::vector<std::string>& lines);
+        void scan_chunk(AsmChunk& chunk);
+        void assemble_chunk(AsmChunk& chunk);
+        void run_chunks(std::vector<AsmChunk>& chunks, void (Assembler::*phase)(AsmChunk&));
+        Instruction assemble_tokens(const Tokens& operands, size_t pos);
+        Instruction declare_data_label(const DataDecl& decl, size_t pos);
+        void check_globals();
+        void build_object(std::string_view source, TcodeImage& image);
+        void optimize(TcodeImage& image);
+        static std::string_view parse_global(const Tokens& operands);
+        uint8_t parse_op(std::string_view op);
+        Instruction parse_extend(const Tokens& operands);
+        static uint64_t parse_immediate(std::string_view imm);
+        static DataDecl parse_data_decl(const Tokens& operands);
+        uint64_t parse_jmp_label(std::string_view label);
+        uint64_t parse_data_label(std::string_view label, size_t pos);
+        Instruction parse_label(const Tokens& operands);
+        Instruction parse_mem(uint8_t op_code, const Tokens& operands, size_t pos);
+        Instruction parse_logic(uint8_t op_code, const Tokens& operands);
+        Instruction parse_stack(uint8_t op_code, const Tokens& operands);
+        Instruction parse_jump(uint8_t op_code, const Tokens& operands);
+        Instruction parse_io(uint8_t op_code, const Tokens& operands);
+        Instruction parse_heap(uint8_t op_code, const Tokens& operands);
+        Instruction parse_thread(uint8_t op_code, const Tokens& operands);
+        Instruction parse_vector(uint8_t op_code, const Tokens& operands);
         size_t next_label {0};
         size_t line_no {0};
-        size_t instruction_count{0};
-        std::unordered_map<std::string, size_t> data_labels;
+        size_t threads {1};
+        bool object {false};
+        int opt_level {0};
+        OptStats opt_stats;
+        std::unordered_set<std::string> globals;
+        // each declaration of a data label, as the position of its declaration and its index, a use refers to the latest declaration before it
+        std::unordered_map<std::string, std::vector<std::pair<size_t, size_t> > > data_labels;
         std::unordered_map<std::string, size_t> program_labels;
         std::unordered_map<std::string, Instruction(*)(const std::vector<std::string>&)> extensions;
         std::vector<std::string> program_strs;
-        std::vector<Instruction> instructions;
-        /* this associates each pneumonic with a bytecode instruction, the first element of
-           the tuple represents the op-code and the second part represents the immediate flag 
-           1 for immediate operations, 0 for not*/
-        std::unordered_map<std::string, std::pair<uint8_t, bool> > op_map{
-            {"copy",    {0x00, 0}},
-            {"stow",    {0x01, 0}},
-            {"stowi",   {0x01, 1}},
-            {"stob",    {0x02, 0}},
-            {"stobi",   {0x02, 1}},
-            {"loadw",   {0x03, 0}},
-            {"loadi",   {0x03, 1}},
-            {"loadb",   {0x04, 0}},
-            {"loada",   {0x07, 0}},
-            {"add",     {0x10, 0}},
-            {"addi",    {0x10, 1}},
-            {"sub",     {0x11, 0}},
-            {"subi",    {0x11, 1}},
-            {"mul",     {0x12, 0}},
-            {"muli",    {0x12, 1}},
-            {"div",     {0x13, 0}},
-            {"divi",    {0x13, 1}},
-            {"rem",     {0x14, 0}},
-            {"remi",    {0x14, 1}},
-            {"comp",    {0x15, 0}},
-            {"compi",   {0x15, 1}},
-            {"and",     {0x16, 0}},
-            {"andi",    {0x16, 1}},
-            {"or",      {0x17, 0}},
-            {"ori",     {0x17, 1}},
-            {"xor",     {0x18, 0}},
-            {"xori",    {0x18, 1}},
-            {"sr",      {0x19, 1}},
-            {"sl",      {0x1a, 1}},
-            {"j",       {0x20, 0}},
-            {"jeq",     {0x21, 0}},
-            {"jne",     {0x22, 0}},
-            {"jgt",     {0x23, 0}},
-            {"jlt",     {0x24, 0}},
-            {"call",    {0x25, 0}},
-            {"ret",     {0x26, 0}},
-            {"push",    {0x30, 0}},
-            {"pushi",   {0x30, 1}},
-            {"pushb",   {0x31, 0}},
-            {"pushbi",  {0x31, 1}},
-            {"pop",     {0x32, 0}},
-            {"popb",    {0x33, 0}},
-            {"puts",    {0x40, 0}},
-            {"puti",    {0x41, 0}},
-            {"gets",    {0x42, 0}},
-            {"geti",    {0x43, 0}},
-            {"halloc",  {0x50, 0}},
-            {"hfree",   {0x51, 0}}
-        };
-        std::unordered_map<std::string, int> type_map{
-            {".word", WORD},
-            {".string", STRING},
-            {".stringz", STRINGZ},
-            {".data", DATA}
-        };
+        std::vector<DataLabel> data_layout;
+        int format {TCODE_VERSION};
+        bool debug_info {true};
 };
 
 #endif
\ No newline at end of file
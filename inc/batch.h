@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+// a program to run, with the files its input is read from and output written to, "-" for none
+struct BatchJob{
+    std::string program;
+    std::string input {"-"};
+    std::string output {"-"};
+};
+
+// how a job went. Instructions are only counted by the interpreters
+struct JobResult{
+    bool ok {false};
+    std::string error;
+    double seconds {0};
+    bool counted {false};
+    uint64_t instructions {0};
+};
+
+std::vector<BatchJob> read_manifest(const std::string& path);
+std::vector<JobResult> run_batch(const std::vector<BatchJob>& jobs, size_t threads, const std::function<void(Machine&)>& configure, bool async_io);
+void write_summary(const std::string& path, const std::vector<BatchJob>& jobs, const std::vector<JobResult>& results);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+#include "instruction.h"
+
+class Machine;
+typedef void(*exec_func)(Machine*, uint8_t, bool, uint8_t, uint64_t);
+
+// every handler an instruction can be resolved to at load time
+#define HANDLER_LIST(X) \
+    X(H_GENERIC)    \
+    X(H_INVALID)    \
+    X(H_COPY)       \
+    X(H_LOADI)      \
+    X(H_LOADA)      \
+    X(H_ADD)        \
+    X(H_ADDI)       \
+    X(H_SUB)        \
+    X(H_SUBI)       \
+    X(H_MUL)        \
+    X(H_MULI)       \
+    X(H_DIV)        \
+    X(H_DIVI)       \
+    X(H_REM)        \
+    X(H_REMI)       \
+    X(H_COMP)       \
+    X(H_COMPI)      \
+    X(H_AND)        \
+    X(H_ANDI)       \
+    X(H_OR)         \
+    X(H_ORI)        \
+    X(H_XOR)        \
+    X(H_XORI)       \
+    X(H_SR)         \
+    X(H_SRI)        \
+    X(H_SL)         \
+    X(H_SLI)        \
+    X(H_JUMP)       \
+    X(H_JEQ)        \
+    X(H_JNE)        \
+    X(H_JGT)        \
+    X(H_JLT)        \
+    X(H_CAL)        \
+    X(H_RET)        \
+    X(H_VLOAD)      \
+    X(H_VSTORE)     \
+    X(H_VLANES)     \
+    X(H_VLANESI)    \
+    X(H_VREDUCE)    \
+    FUSED_BRANCHES(X, ADD)  \
+    FUSED_BRANCHES(X, ADDI) \
+    FUSED_BRANCHES(X, SUBI) \
+    FUSED_BRANCHES(X, COMPI) \
+    X(H_COPY_COPY)  \
+    X(H_GENERIC_PAIR) \
+    X(H_EXIT)       \
+    X(H_BREAK)
+
+// superinstructions running an arithmetic operation followed by a conditional branch
+#define FUSED_BRANCHES(X, first) \
+    X(H_##first##_JEQ) \
+    X(H_##first##_JNE) \
+    X(H_##first##_JGT) \
+    X(H_##first##_JLT)
+
+#define HANDLER_ENUM(name) name,
+enum handlers{
+    HANDLER_LIST(HANDLER_ENUM)
+    HANDLER_COUNT
+};
+
+// the number of operation families that fit in the three family bits
+#define FAMILY_COUNT 8
+
+// the fields of an instruction, unpacked so nothing is re-parsed while executing
+struct DecodedOp{
+    uint8_t handler;
+    uint8_t family;
+    uint8_t op_code;
+    uint8_t immediate;
+    uint8_t r1;
+    uint8_t r2;
+};
+
+/* a program's instructions, decoded once at load time. The fields and operands are stored as
+   parallel arrays, operands hold the immediate value, the rhs register, or for jumps the index
+   of the instruction to continue from. A verified program has one more op than operands, the
+   exit the unchecked interpreter runs into at the end of the program */
+struct DecodedCode{
+    std::vector<DecodedOp> ops;
+    std::vector<uint64_t> operands;
+    std::array<exec_func, FAMILY_COUNT> families {};
+    size_t size() const {return this->operands.size();}
+    void reserve(size_t count);
+    void append(const Instruction& inst);
+    Instruction encode(size_t index) const;
+};
+
+#endif
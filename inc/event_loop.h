@@ -0,0 +1,65 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Machine;
+
+/* a program's input, read from a file descriptor without blocking. What's read is buffered until
+   a whole line or integer has arrived, so a machine can be suspended at gets or geti while the
+   rest of it is on its way. Regular files never block, so only pipes, sockets and terminals
+   ever leave a machine waiting */
+class AsyncInput{
+    public:
+        AsyncInput() {}
+        AsyncInput(const std::string& path);
+        ~AsyncInput();
+        AsyncInput(const AsyncInput&) = delete;
+        AsyncInput& operator=(const AsyncInput&) = delete;
+        int get_fd() {return this->fd;}
+        bool read_line(std::string& line);
+        bool read_int(uint64_t& val);
+        bool fill();
+        void wait();
+    private:
+        void consume(size_t end);
+        int fd {-1};
+        bool eof {true};
+        std::string buffer;
+        size_t pos {0};
+};
+
+/* runs machines that read from an AsyncInput on a single thread. Each machine runs until it exits
+   or is suspended waiting for input, and is resumed once its input is readable. Readiness comes
+   from epoll where the host has it, and poll otherwise */
+class EventLoop{
+    public:
+        EventLoop();
+        ~EventLoop();
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+        void add(Machine* machine, AsyncInput* input, std::function<void(const std::string& error)> done);
+        void run();
+        uint64_t get_suspensions() {return this->suspensions;}
+    private:
+        struct Task{
+            Machine* machine;
+            AsyncInput* input;
+            std::function<void(const std::string& error)> done;
+        };
+        bool resume(Task& task);
+        void watch(Task& task);
+        void unwatch(Task& task);
+        std::vector<Task*> wait();
+        std::vector<std::unique_ptr<Task> > tasks;
+        std::vector<Task*> watched;
+        int epoll_fd {-1};
+        uint64_t suspensions {0};
+};
+
+#endif
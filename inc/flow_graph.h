@@ -0,0 +1,72 @@
+#ifndef FLOW_GRAPH_H
+#define FLOW_GRAPH_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#include "instruction.h"
+#include "optimizer.h"
+
+// the most instructions a function can have, not counting its ret, to be inlined at its calls
+#define MAX_INLINE_SIZE 8
+// a block that doesn't exist, such as the next block of one ending in a jump or a return
+#define NO_BLOCK SIZE_MAX
+
+/* a run of instructions that's only entered at its first instruction, and only left after its
+   last. Each instruction that jumps, calls or spawns a thread keeps the block it goes to, and next
+   is the block that runs once it falls through, or once the call it ends with returns */
+struct BasicBlock{
+    std::vector<Instruction> code;
+    std::vector<size_t> targets;
+    // the position of its first instruction in the program, the blocks are laid out in this order
+    size_t start {0};
+    bool preheader {false};
+    size_t next {NO_BLOCK};
+    std::vector<size_t> preds;
+    uint16_t live_in {0};
+    uint16_t live_out {0};
+    size_t depth {0};
+    bool root {false};
+    bool reachable {false};
+};
+
+// a loop, as the block every iteration starts at and the blocks it runs
+struct Loop{
+    size_t header;
+    std::vector<size_t> body;
+};
+
+/* the control flow graph of a program. It's entered at the first block and at the blocks threads
+   are spawned at, and a call is followed by both the function it calls and the block it returns
+   to, while a return leaves the graph with every register live, as does the end of the program.
+   Calls, returns and extensions may read or write any register */
+class FlowGraph{
+    public:
+        FlowGraph(const std::vector<Instruction>& code, const std::vector<bool>& entries);
+        void optimize(OptStats& stats);
+        std::vector<size_t> emit(std::vector<Instruction>& code, OptStats& stats);
+    private:
+        std::vector<size_t> successors(size_t block) const;
+        void find_reachable();
+        void find_preds();
+        void compute_liveness();
+        void compute_dominators();
+        bool dominates(size_t a, size_t b) const;
+        std::vector<Loop> find_loops();
+        void inline_calls(OptStats& stats);
+        void remove_push_pops(OptStats& stats);
+        void remove_dead_stores(OptStats& stats);
+        bool hoist_invariants(const Loop& loop, const std::vector<bool>& in_loop, OptStats& stats);
+        size_t preferred_next(size_t block, const std::vector<bool>& placed, const std::vector<size_t>& fall_preds) const;
+        std::vector<size_t> layout(OptStats& stats);
+        std::vector<BasicBlock> blocks;
+        size_t size {0};
+        size_t entry {0};
+        size_t exit {0};
+        std::vector<size_t> idom;
+        std::vector<size_t> dom_pre;
+        std::vector<size_t> dom_post;
+};
+
+#endif
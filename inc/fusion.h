@@ -0,0 +1,27 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+/* describes a pair of consecutive instructions that can be fused into a single superinstruction.
+   The first and second instructions match by handler range, and each combination of the two
+   maps to its own fused handler, counting from fused_base in the order of the second range */
+struct FusionPattern{
+    std::string name;
+    uint8_t first_min;
+    uint8_t first_max;
+    uint8_t second_min;
+    uint8_t second_max;
+    uint8_t fused_base;
+};
+
+extern const std::vector<FusionPattern> fusion_patterns;
+
+std::vector<size_t> fuse_instructions(DecodedCode& code);
+uint8_t unfused_handler(uint8_t handler);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef GUEST_MEMORY_H
+#define GUEST_MEMORY_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <stdexcept>
+
+// the address space reserved for each machine's memory, pages are only committed once they're used
+#define GUEST_MEMORY_SIZE (1ull << 32)
+// the first bytes of guest memory are never allocated, so a null address is always invalid
+#define GUEST_NULL_BYTES 16
+
+// a frozen copy of a machine's memory, held in a memfd where the host supports it so forks can map it copy-on-write
+struct GuestImage{
+    GuestImage() {}
+    ~GuestImage();
+    GuestImage(const GuestImage&) = delete;
+    GuestImage& operator=(const GuestImage&) = delete;
+    int fd {-1};
+    size_t length {0};
+    std::vector<uint8_t> bytes;
+};
+
+/* the memory guest programs address: data labels, strings read at runtime, and the heap. It's
+   one contiguous region, and guest addresses are offsets into it, so the region can be frozen
+   into an image and mapped by another machine at a different host address. Guest threads share
+   their program's memory, so the end of the used memory is bumped atomically */
+class GuestMemory{
+    public:
+        GuestMemory();
+        GuestMemory(const GuestImage& image);
+        ~GuestMemory();
+        GuestMemory(const GuestMemory&) = delete;
+        GuestMemory& operator=(const GuestMemory&) = delete;
+        uint64_t reserve(size_t size);
+        uint8_t* at(uint64_t addr, size_t size);
+        uint8_t* base() {return this->region;}
+        size_t used() {return this->top.load(std::memory_order_acquire);}
+        std::shared_ptr<const GuestImage> freeze();
+    private:
+        void map();
+        uint8_t* region {nullptr};
+        std::atomic<size_t> top {GUEST_NULL_BYTES};
+};
+
+// translates a guest address to a host pointer, throwing an error if the access falls outside the allocated memory
+inline uint8_t* GuestMemory::at(uint64_t addr, size_t size){
+    size_t top = this->top.load(std::memory_order_acquire);
+    if (addr < GUEST_NULL_BYTES || addr > top || size > top - addr)
+        throw std::runtime_error("invalid memory access");
+    return this->region + addr;
+}
+
+#endif
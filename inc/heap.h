@@ -0,0 +1,75 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <array>
+#include <map>
+#include <mutex>
+
+#include "guest_memory.h"
+
+// small blocks are rounded up to a power of two size class between these sizes, larger ones come from the arena
+#define HEAP_MIN_CLASS 16
+#define HEAP_MAX_CLASS 2048
+#define HEAP_CLASS_COUNT 8
+// the size of each chunk small blocks and the arena are carved from
+#define HEAP_CHUNK_SIZE (1 << 20)
+
+// the heap's usage over the run of a program, in the bytes requested by the program
+struct HeapStats{
+    size_t live_bytes {0};
+    size_t peak_bytes {0};
+    size_t reserved_bytes {0};
+    uint64_t allocs {0};
+    uint64_t frees {0};
+    uint64_t large_allocs {0};
+    size_t limit {0};
+};
+
+// a mutex that isn't carried over when the heap holding it is copied
+struct HeapLock{
+    HeapLock() {}
+    HeapLock(const HeapLock&) {}
+    HeapLock& operator=(const HeapLock&) {return *this;}
+    std::mutex mutex;
+};
+
+// a span the heap carved from guest memory, holding blocks of one capacity back to back
+struct HeapSpan{
+    uint64_t start;
+    uint64_t end;
+    size_t capacity;
+};
+
+/* the memory behind halloc and hfree. Small blocks are taken from a free list per size class,
+   which is refilled by carving up a chunk, large blocks are bumped off the arena and reused by
+   size once freed. A heap is only locked once it's shared by a program's guest threads, until
+   then the thread running the machine is the only one using it. The chunks come from the
+   machine's guest memory, and every link is a guest address, so a heap can be copied along with
+   a snapshot of the memory. The guest can write over its links and headers, so they're only
+   reached through bounds checks, and a block's capacity is found from the spans the heap carved */
+class Heap{
+    public:
+        uint64_t alloc(GuestMemory& memory, size_t size);
+        void free(GuestMemory& memory, uint64_t addr);
+        void set_limit(size_t limit) {this->stats.limit = limit;}
+        void set_shared(bool shared) {this->shared = shared;}
+        const HeapStats& get_stats() {return this->stats;}
+    private:
+        uint64_t carve(GuestMemory& memory, size_t size);
+        void refill(GuestMemory& memory, size_t size_class);
+        size_t capacity_of(uint64_t addr);
+        std::array<uint64_t, HEAP_CLASS_COUNT> free_lists {};
+        std::map<uint64_t, HeapSpan> spans;
+        // the span each size class last used, which most blocks are found in without searching the spans
+        std::array<HeapSpan, HEAP_CLASS_COUNT> recent_spans {};
+        std::multimap<size_t, uint64_t> large_free;
+        uint64_t bump {0};
+        uint64_t bump_end {0};
+        HeapStats stats;
+        HeapLock lock;
+        bool shared {false};
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <array>
+#include <string>
+
+#include "decoder.h"
+
+// the start of every cached image
+#define IMAGE_MAGIC "TVMI"
+// bumped whenever the layout of a cached image changes
+#define IMAGE_VERSION 1
+// the extension of a cached image's file
+#define IMAGE_EXTENSION ".tvmi"
+
+// the version of the VM, set by the build
+#ifndef TVM_VERSION
+#define TVM_VERSION "unknown"
+#endif
+
+/* what a cached image was decoded from and against: the build of the VM, the contents of the
+   tcode file, and the settings and extensions it was decoded with. An image is only used if its
+   key matches exactly */
+struct ImageKey{
+    uint64_t vm;
+    uint64_t source;
+    uint64_t config;
+};
+
+// the header at the start of a cached image, followed by the payload it describes
+struct ImageHeader{
+    char magic[4];
+    uint32_t version;
+    ImageKey key;
+    uint64_t payload_size;
+    uint64_t checksum;
+};
+
+// what the cache directory holds
+struct CacheStats{
+    std::string dir;
+    size_t entries {0};
+    size_t bytes {0};
+    size_t stale {0};
+    size_t corrupt {0};
+};
+
+uint64_t hash_bytes(const uint8_t* data, size_t size, uint64_t seed);
+uint64_t vm_key();
+ImageKey image_key(const uint8_t* tcode, size_t size, const std::array<exec_func, FAMILY_COUNT>& families, bool fusion);
+std::string image_cache_dir();
+std::string image_cache_path(const std::string& dir, const ImageKey& key);
+CacheStats image_cache_stats(const std::string& dir);
+size_t clear_image_cache(const std::string& dir, size_t& bytes);
+
+#endif
@@ -4,6 +4,11 @@
 #include <stdint.h>
 #include <array>
 
+// the size of an encoded instruction in a tcode file
+#define INSTRUCTION_BYTES 10
+// the number of 64-bit lanes in a vector register
+#define VECTOR_LANES 4
+
 enum op_types {
     MEM_OP = 0x00, 
     LOGIC_OP = 0x10,
@@ -11,6 +16,7 @@ enum op_types {
     STACK_OP = 0x30,
     IO_OP = 0x40,
     HEAP_OP = 0x50,
+    THREAD_OP = 0x70,
 };
 enum data_types {
     WORD,
@@ -54,7 +60,39 @@ enum op_codes{
     GET_S,
     GET_I,
     HEAP_ALLOC = 0x50,
-    HEAP_FREE
+    HEAP_FREE,
+    SPAWN = 0x70,
+    JOIN,
+    ATOMIC_LOAD,
+    ATOMIC_STORE,
+    FETCH_ADD,
+    COMP_SWAP,
+    VEC_LOAD,
+    VEC_STORE,
+    VEC_BROADCAST,
+    VEC_LANES,
+    VEC_REDUCE,
+    VEC_GET,
+    VEC_SET,
+};
+// the lane-wise operations of a vector instruction, kept in the low byte of its extend
+enum vector_ops{
+    V_ADD,
+    V_SUB,
+    V_MUL,
+    V_AND,
+    V_OR,
+    V_XOR,
+    V_SL,
+    V_SR,
+    V_EQ,
+    V_GT,
+};
+// the ways a vector can be reduced to a single word
+enum vector_reductions{
+    V_SUM,
+    V_MIN,
+    V_MAX,
 };
 
 
@@ -0,0 +1,60 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <vector>
+
+class Machine;
+
+// a range of the program compiled to native code
+struct JitRegion{
+    size_t start;
+    size_t end;
+    uint8_t* code {nullptr};
+    size_t code_size {0};
+    // the native address of each instruction in the region, used to enter it and for dynamic jumps
+    std::vector<uint8_t*> entries;
+};
+
+// a loop promoted from the interpreter to compiled code
+struct TierEvent{
+    size_t header;
+    size_t end;
+    uint64_t backedges;
+    size_t code_bytes;
+};
+
+// what the tiered engine promoted, and the time it spent in each tier
+struct TierStats{
+    uint32_t threshold {0};
+    std::vector<TierEvent> events;
+    double interpreter_seconds {0};
+    double compile_seconds {0};
+    double native_seconds {0};
+};
+
+/* compiles decoded tcode to x86-64 machine code. The register file stays in memory behind a
+   pinned base pointer, and anything that can't be compiled calls back into its family function */
+class Jit{
+    public:
+        Jit(Machine* machine);
+        ~Jit();
+        Jit(const Jit&) = delete;
+        Jit& operator=(const Jit&) = delete;
+        static bool supported();
+        const JitRegion& compile(size_t start, size_t end);
+        uint64_t run(const JitRegion& region, uint64_t pc);
+        size_t get_compiled_bytes() {return this->compiled_bytes;}
+    private:
+        static uint64_t exec_fallback(Jit* jit, uint64_t pc);
+        void write_perf_map(const JitRegion& region, const std::vector<size_t>& offsets, const std::vector<size_t>& leaders);
+        Machine* machine;
+        std::vector<JitRegion*> regions;
+        std::exception_ptr pending;
+        size_t compiled_bytes {0};
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// the character that starts a comment, which runs to the end of the line
+#define COMMENT_CHAR ';'
+
+// the tokens of a line, each a view into the source the line came from
+typedef std::vector<std::string_view> Tokens;
+
+/* splits assembly source into lines and each line into tokens without copying any of it, so the
+   source must outlive the tokens. Tokens are separated by spaces, tabs and commas, a quoted
+   string literal is a single token however many spaces it holds, and blank lines and lines
+   holding only a comment are skipped */
+class Lexer{
+    public:
+        Lexer(std::string_view source) : source(source) {}
+        bool next(Tokens& tokens);
+        size_t line() const {return this->line_no;}
+    private:
+        std::string_view source;
+        size_t pos {0};
+        size_t line_no {0};
+};
+
+void tokenize(std::string_view line, Tokens& tokens);
+std::vector<std::string_view> split_lines(std::string_view source, size_t count);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+#include "tcode.h"
+
+// what linking kept in the program, and what it left out
+struct LinkStats{
+    size_t objects {0};
+    size_t instructions {0};
+    size_t removed_instructions {0};
+    size_t data_labels {0};
+    size_t removed_data_labels {0};
+    size_t strings {0};
+    size_t merged_strings {0};
+};
+
+/* an object file being linked. Its code is split into regions at its program labels, as code can
+   only be entered at a label, and the regions and data labels reachable from the entry point are
+   marked live */
+struct LinkObject{
+    std::string name;
+    std::vector<Instruction> code;
+    std::vector<std::string> strings;
+    std::vector<DataLabel> data_labels;
+    std::vector<ObjectSymbol> symbols;
+    std::vector<Relocation> relocations;
+    std::vector<std::pair<size_t, size_t> > resolved;
+    std::vector<size_t> regions;
+    std::vector<bool> live_regions;
+    std::vector<bool> live_data;
+    std::vector<int64_t> reloc_at;
+    std::vector<size_t> region_starts;
+    std::vector<size_t> data_indices;
+};
+
+/* links object files into a single program. The first object is the entry point, the program
+   starts at its first instruction, and each object's data labels are allocated before any code
+   runs. Code unreachable from the entry point through jumps, calls, spawns and falling through
+   is left out, along with data labels only it used, and identical strings share one entry */
+class Linker{
+    public:
+        Linker() {}
+        void add_object(const std::string& path);
+        LinkStats link(const std::string& out_path);
+        void set_format(int version) {this->format = version;}
+        void set_debug_info(bool enabled) {this->debug_info = enabled;}
+        void set_gc(bool enabled) {this->gc = enabled;}
+    private:
+        void resolve_symbols();
+        void mark_live();
+        void mark_region(std::vector<std::pair<size_t, size_t> >& pending, size_t obj, size_t pos);
+        size_t region_of(const LinkObject& object, size_t pos) const;
+        bool falls_through(const LinkObject& object, size_t region) const;
+        std::vector<LinkObject> objects;
+        int format {TCODE_VERSION};
+        bool debug_info {true};
+        bool gc {true};
+};
+
+#endif
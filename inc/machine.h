@@ -2,12 +2,27 @@
 #define MACHINE_H
 
 #include <array>
+#include <iostream>
 #include <string>
 #include <vector>
 #include <tuple>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
 
 #include "../inc/instruction.h"
+#include "../inc/decoder.h"
+#include "../inc/jit.h"
 #include "../inc/stack.hpp"
+#include "../inc/heap.h"
+#include "../inc/guest_memory.h"
+#include "../inc/tcode.h"
+#include "../inc/program.h"
+#include "../inc/event_loop.h"
+#include "../inc/output_buffer.h"
+#include "../inc/profiler.h"
+#include "../inc/vector.h"
 
 // stores reserved register names
 enum registers{
@@ -20,32 +35,153 @@ enum registers{
     RET_ADDR,
 };
 
+// the number of times a loop must jump back to its header before the tiered engine compiles it
+#define DEFAULT_TIER_THRESHOLD 1000
+
+// the execution engines the machine can run a program with
+enum engine_types{
+    SWITCH_ENGINE,
+    THREADED_ENGINE,
+    JIT_ENGINE,
+    TIERED_ENGINE,
+};
+
+// the execution functions for the default operation families
+void exec_mem(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_logic(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_jump(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_stack(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_io(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_heap(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+void exec_thread(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+
+// a guest thread, and what it left behind once it returned
+struct GuestThread{
+    std::thread thread;
+    uint64_t result {0};
+    uint64_t executed {0};
+    bool failed {false};
+    std::string error;
+};
+
+/* the guest threads spawned by a program. The group is shared by every machine running one of
+   the program's threads, along with its memory and heap, and it serializes their I/O */
+struct ThreadGroup{
+    std::mutex lock;
+    std::mutex io_lock;
+    std::unordered_map<uint64_t, std::shared_ptr<GuestThread> > threads;
+    uint64_t next_id {1};
+};
+
+/* the state of a machine at a point in its run. The program is shared, the memory is frozen
+   into an image that forked machines map copy-on-write, and the rest is copied into each fork */
+struct Snapshot{
+    std::shared_ptr<const Program> program;
+    std::array<uint64_t, 16> registers;
+    std::array<VectorReg, 16> vectors;
+    std::vector<uint64_t> labels;
+    std::vector<uint64_t> stack;
+    size_t stack_size;
+    Heap heap;
+    std::shared_ptr<const GuestImage> memory;
+    int engine;
+    uint32_t tier_threshold;
+};
+
 class Machine{
+    friend class Jit;
     public:
         Machine(bool init_default = true);
+        Machine(std::shared_ptr<const Program> program);
+        Machine(const Snapshot& snapshot);
         ~Machine();
         static void split_registers(uint8_t registers, uint8_t& r1, uint8_t& r2);
         uint64_t get_register(size_t reg_no);
+        VectorReg& get_vector(size_t reg_no) {return this->vectors[reg_no];}
         void exec_next();
         void exec_file(const std::string& file_path);
+        void load_file(const std::string& file_path);
+        void exec();
+        bool resume();
+        void suspend() {this->suspended = true;}
+        bool exec_until(size_t stop);
+        std::shared_ptr<const Snapshot> snapshot();
+        size_t find_label(const std::string& name) {return this->get_program().find_label(name);}
+        const Program& get_program();
+        std::shared_ptr<const Program> share_program() {return this->program;}
         void exec_inst(const Instruction& inst);
         void set_register(size_t reg_no, uint64_t val);
         void add_extension(uint8_t op_family, void(*op)(Machine*, uint8_t, bool, uint8_t, uint64_t));
-        void add_label(uint8_t* ptr);
-        void add_str(const std::string& str) {this->prog_strings.push_back(str);}
-        uint8_t* get_label(size_t index);
-        std::string get_str(size_t index);
+        void add_label(uint64_t addr);
+        uint64_t get_label(size_t index);
+        const std::string& get_str(size_t index) {return this->get_program().get_str(index);}
         Stack& get_stack() {return this->stack;}
-        size_t get_inst_count() {return this->instruction_count;}
+        void set_stack_size(size_t size) {this->stack.resize(size);}
+        Heap& get_heap() {return *this->heap;}
+        GuestMemory& get_memory() {return *this->memory;}
+        ThreadGroup* get_threads() {return this->threads.get();}
+        uint64_t spawn(size_t start);
+        uint64_t join(uint64_t id);
+        void set_streams(std::istream* input, std::ostream* output);
+        std::istream& get_input() {return *this->input;}
+        OutputBuffer& get_output() {return *this->output;}
+        void set_flush_policy(int policy) {this->output->set_policy(policy);}
+        void set_async_input(AsyncInput* input) {this->async_input = input;}
+        AsyncInput* get_async_input() {return this->async_input;}
+        void set_count_instructions(bool enabled) {this->count_instructions = enabled;}
+        uint64_t get_executed() {return this->executed;}
+        void set_heap_limit(size_t limit) {this->heap->set_limit(limit);}
+        size_t get_inst_count() {return this->program ? this->program->size() : 0;}
+        void set_engine(int engine) {this->engine = engine;}
+        int get_engine() {return this->engine;}
+        void set_fusion(bool enabled) {this->fusion_enabled = enabled;}
+        void set_image_cache(bool enabled) {this->cache_enabled = enabled;}
+        void set_verify(int mode) {this->verify_mode = mode;}
+        const std::vector<size_t>& get_fusion_counts() {return this->get_program().get_fusion_counts();}
+        void set_tier_threshold(uint32_t threshold) {this->tier_stats.threshold = threshold;}
+        const TierStats& get_tier_stats() {return this->tier_stats;}
+        const LoadStats& get_load_stats() {return this->get_program().get_load_stats();}
+        void set_profiler(Profiler* profiler) {this->profiler = profiler;}
     private:
-        void read_file(const std::string& file_path);     
+        Machine(Machine& parent, size_t start);
+        void join_threads();
+        void reset(std::shared_ptr<const Program> program);
+        void exec_guarded(void (Machine::*engine)());
+        void exec_engine();
+        void exec_switch();
+        void exec_threaded();
+        void exec_unchecked();
+        void exec_counted();
+        void exec_profiling();
+        void exec_jit();
+        void exec_tiered();
+        uint64_t exec_profiled(uint32_t* backedges, uint32_t threshold);
         std::array<uint64_t, 16> registers;
-        std::vector<uint8_t*> labels;
-        std::vector<Instruction> instructions;
-        std::vector<std::string> prog_strings;
-        std::unordered_map<uint8_t, void(*)(Machine*, uint8_t, bool, uint8_t, uint64_t)> instruction_map;
+        std::array<VectorReg, 16> vectors {};
+        std::vector<uint64_t> labels;
+        std::shared_ptr<const Program> program;
+        ExtensionTable instruction_map;
         Stack stack;
-        size_t instruction_count {0};
+        std::shared_ptr<Heap> heap;
+        std::shared_ptr<GuestMemory> memory;
+        std::shared_ptr<ThreadGroup> threads;
+        bool guest_thread {false};
+        std::istream* input {&std::cin};
+        std::shared_ptr<OutputBuffer> output;
+        AsyncInput* async_input {nullptr};
+        bool suspended {false};
+        int engine {THREADED_ENGINE};
+        bool fusion_enabled {true};
+        bool cache_enabled {false};
+        int verify_mode {VERIFY_ON};
+        bool count_instructions {false};
+        uint64_t executed {0};
+        TierStats tier_stats;
+        // the state of the jit engines lives here, so a stack overflow can jump out of their frames
+        std::unique_ptr<Jit> jit;
+        std::vector<uint32_t> backedges;
+        std::unordered_map<uint64_t, const JitRegion*> loops;
+        Profiler* profiler {nullptr};
 };
 
 #endif
\ No newline at end of file
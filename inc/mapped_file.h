@@ -0,0 +1,25 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// a read-only view of a file's contents, memory mapped where the host supports it
+class MappedFile{
+    public:
+        MappedFile(const std::string& path);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        const uint8_t* data() const {return this->ptr;}
+        size_t size() const {return this->length;}
+    private:
+        const uint8_t* ptr {nullptr};
+        size_t length {0};
+        bool mapped {false};
+        std::vector<uint8_t> buffer;
+};
+
+#endif
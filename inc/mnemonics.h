@@ -0,0 +1,194 @@
+#ifndef MNEMONICS_H
+#define MNEMONICS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string_view>
+
+#include "instruction.h"
+
+// the number of slots in the mnemonic table, a power of two comfortably larger than the number of mnemonics
+#define MNEMONIC_SLOTS 512
+
+/* an operation's mnemonic, its op code and whether its rightmost operand is an immediate. Vector
+   operations that share an op code are told apart by their variant, the lane operation or reduction */
+struct Mnemonic{
+    std::string_view name;
+    uint8_t op_code;
+    bool immediate;
+    uint8_t variant {0};
+};
+
+// every built-in mnemonic
+inline constexpr Mnemonic mnemonics[] = {
+    {"copy",    0x00, 0},
+    {"stow",    0x01, 0},
+    {"stowi",   0x01, 1},
+    {"stob",    0x02, 0},
+    {"stobi",   0x02, 1},
+    {"loadw",   0x03, 0},
+    {"loadi",   0x03, 1},
+    {"loadb",   0x04, 0},
+    {"loada",   0x07, 0},
+    {"add",     0x10, 0},
+    {"addi",    0x10, 1},
+    {"sub",     0x11, 0},
+    {"subi",    0x11, 1},
+    {"mul",     0x12, 0},
+    {"muli",    0x12, 1},
+    {"div",     0x13, 0},
+    {"divi",    0x13, 1},
+    {"rem",     0x14, 0},
+    {"remi",    0x14, 1},
+    {"comp",    0x15, 0},
+    {"compi",   0x15, 1},
+    {"and",     0x16, 0},
+    {"andi",    0x16, 1},
+    {"or",      0x17, 0},
+    {"ori",     0x17, 1},
+    {"xor",     0x18, 0},
+    {"xori",    0x18, 1},
+    {"sr",      0x19, 1},
+    {"sl",      0x1a, 1},
+    {"j",       0x20, 0},
+    {"jeq",     0x21, 0},
+    {"jne",     0x22, 0},
+    {"jgt",     0x23, 0},
+    {"jlt",     0x24, 0},
+    {"call",    0x25, 0},
+    {"ret",     0x26, 0},
+    {"push",    0x30, 0},
+    {"pushi",   0x30, 1},
+    {"pushb",   0x31, 0},
+    {"pushbi",  0x31, 1},
+    {"pop",     0x32, 0},
+    {"popb",    0x33, 0},
+    {"puts",    0x40, 0},
+    {"puti",    0x41, 0},
+    {"gets",    0x42, 0},
+    {"geti",    0x43, 0},
+    {"halloc",  0x50, 0},
+    {"hfree",   0x51, 0},
+    {"spawn",   0x70, 0},
+    {"join",    0x71, 0},
+    {"aload",   0x72, 0},
+    {"astore",  0x73, 0},
+    {"astorei", 0x73, 1},
+    {"fadd",    0x74, 0},
+    {"faddi",   0x74, 1},
+    {"cas",     0x75, 0},
+    {"vload",   0x76, 0},
+    {"vstore",  0x77, 0},
+    {"vbcast",  0x78, 0},
+    {"vbcasti", 0x78, 1},
+    {"vadd",    0x79, 0, V_ADD},
+    {"vaddi",   0x79, 1, V_ADD},
+    {"vsub",    0x79, 0, V_SUB},
+    {"vsubi",   0x79, 1, V_SUB},
+    {"vmul",    0x79, 0, V_MUL},
+    {"vmuli",   0x79, 1, V_MUL},
+    {"vand",    0x79, 0, V_AND},
+    {"vandi",   0x79, 1, V_AND},
+    {"vor",     0x79, 0, V_OR},
+    {"vori",    0x79, 1, V_OR},
+    {"vxor",    0x79, 0, V_XOR},
+    {"vxori",   0x79, 1, V_XOR},
+    {"vsl",     0x79, 0, V_SL},
+    {"vsli",    0x79, 1, V_SL},
+    {"vsr",     0x79, 0, V_SR},
+    {"vsri",    0x79, 1, V_SR},
+    {"veq",     0x79, 0, V_EQ},
+    {"veqi",    0x79, 1, V_EQ},
+    {"vgt",     0x79, 0, V_GT},
+    {"vgti",    0x79, 1, V_GT},
+    {"vsum",    0x7a, 0, V_SUM},
+    {"vmin",    0x7a, 0, V_MIN},
+    {"vmax",    0x7a, 0, V_MAX},
+    {"vget",    0x7b, 0},
+    {"vset",    0x7c, 0},
+};
+
+#define MNEMONIC_COUNT (sizeof(mnemonics) / sizeof(Mnemonic))
+
+// hashes a name with FNV-1a, starting from a seed so a seed can be picked that separates every mnemonic
+constexpr uint32_t hash_mnemonic(std::string_view name, uint32_t seed){
+    uint32_t hash = 2166136261u ^ seed;
+    for (char chr : name)
+        hash = (hash ^ static_cast<uint8_t>(chr)) * 16777619u;
+    return (hash ^ (hash >> 16)) & (MNEMONIC_SLOTS - 1);
+}
+
+// returns whether no two mnemonics hash to the same slot with the given seed
+constexpr bool is_perfect_seed(uint32_t seed){
+    bool used[MNEMONIC_SLOTS] = {};
+    for (const Mnemonic& mnemonic : mnemonics){
+        uint32_t slot = hash_mnemonic(mnemonic.name, seed);
+        if (used[slot])
+            return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+// returns the first seed that makes the hash perfect over the mnemonics
+constexpr uint32_t find_perfect_seed(){
+    uint32_t seed = 0;
+    while (!is_perfect_seed(seed))
+        seed++;
+    return seed;
+}
+
+// each slot holds one more than the index of the mnemonic hashing to it, or zero if it's empty
+struct MnemonicTable{
+    uint8_t slots[MNEMONIC_SLOTS];
+};
+
+constexpr MnemonicTable build_mnemonic_table(uint32_t seed){
+    MnemonicTable table {};
+    for (size_t i = 0; i < MNEMONIC_COUNT; i++)
+        table.slots[hash_mnemonic(mnemonics[i].name, seed)] = i + 1;
+    return table;
+}
+
+/* the seed and the table are both found while compiling, so looking up a mnemonic is a single
+   hash and one comparison against the only mnemonic that can match */
+inline constexpr uint32_t mnemonic_seed = find_perfect_seed();
+inline constexpr MnemonicTable mnemonic_table = build_mnemonic_table(mnemonic_seed);
+static_assert(MNEMONIC_COUNT < MNEMONIC_SLOTS, "the mnemonic table is too small");
+
+// returns the built-in mnemonic with the given name, or null if there isn't one
+constexpr const Mnemonic* find_mnemonic(std::string_view name){
+    uint8_t entry = mnemonic_table.slots[hash_mnemonic(name, mnemonic_seed)];
+    if (!entry || mnemonics[entry - 1].name != name)
+        return nullptr;
+    return &mnemonics[entry - 1];
+}
+
+// reads the number of a register named by a prefix and then 0 to 15, returning -1 if the name isn't one
+constexpr int find_numbered_register(std::string_view name, char prefix){
+    if (name.size() < 2 || name.size() > 3 || name[0] != prefix)
+        return -1;
+    int reg_no = 0;
+    for (size_t i = 1; i < name.size(); i++){
+        if (name[i] < '0' || name[i] > '9')
+            return -1;
+        reg_no = reg_no * 10 + (name[i] - '0');
+    }
+    return (reg_no <= 15) ? reg_no : -1;
+}
+
+// registers are named r0 to r15, so a register's number is read straight from its name, returning -1 if it isn't one
+constexpr int find_register(std::string_view name){
+    return find_numbered_register(name, 'r');
+}
+
+// vector registers are named v0 to v15
+constexpr int find_vector_register(std::string_view name){
+    return find_numbered_register(name, 'v');
+}
+
+static_assert(find_mnemonic("astorei") && find_mnemonic("astorei")->op_code == 0x73, "the mnemonic table is malformed");
+static_assert(!find_mnemonic("nop") && find_register("r15") == 15 && find_register("r16") == -1, "the mnemonic table is malformed");
+static_assert(find_mnemonic("vgti") && find_mnemonic("vgti")->variant == V_GT && find_vector_register("v15") == 15, "the mnemonic table is malformed");
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+#include "tcode.h"
+
+// the bit of a register in a mask of registers, and the mask of every register
+#define REG_BIT(reg) ((uint16_t) (1u << ((reg) & 0x0f)))
+#define ALL_REGS 0xffff
+// the most jumps a jump is threaded through, so a cycle of jumps ends
+#define MAX_JUMP_CHAIN 64
+// the position of an instruction that was removed along with the code around it
+#define NO_POSITION SIZE_MAX
+
+/* the registers an instruction reads and writes, one bit for each. A pure instruction does
+   nothing else, so it can be removed if nothing reads what it writes. A barrier may read or write
+   any register, or leave the code around it, so nothing is known across it */
+struct InstEffects{
+    uint16_t uses {0};
+    uint16_t defs {0};
+    bool pure {false};
+    bool barrier {false};
+};
+
+// what optimizing a program changed
+struct OptStats{
+    // the program's instructions before and after it was optimized
+    size_t original {0};
+    size_t instructions {0};
+    size_t removed {0};
+    size_t folded {0};
+    size_t reduced {0};
+    size_t threaded {0};
+    size_t dead_stores {0};
+    size_t hoisted {0};
+    size_t inlined {0};
+    size_t unreachable {0};
+    size_t moved_blocks {0};
+};
+
+InstEffects inst_effects(const Instruction& inst);
+bool has_target(const Instruction& inst);
+bool ends_block(const Instruction& inst);
+OptStats optimize_file(const std::string& in_path, const std::string& out_path, int level, int format, bool debug_info);
+
+/* optimizes a program's instructions in place, moving its jumps, symbols and relocations along
+   with the instructions they refer to. Code can be entered at any jump target, symbol or added
+   entry, and after any jump or call. If the program computes code addresses itself, by reading or
+   writing r0 outside of a jump or setting the return address, instructions are never removed or
+   moved, and only rewritten one at a time. Level 1 runs the peephole passes, level 2 also runs
+   the passes over the program's control flow graph, unless it's an object, which is only
+   complete once it's linked */
+class Optimizer{
+    public:
+        Optimizer(TcodeImage& image);
+        void add_entry(size_t pos);
+        OptStats optimize(int level);
+        size_t new_position(size_t pos) const;
+    private:
+        void reset();
+        void peephole(OptStats& stats);
+        void find_entries();
+        bool computes_addresses() const;
+        bool is_external(size_t pos) const;
+        uint64_t target(size_t pos) const;
+        void retarget(size_t pos, uint64_t target, size_t from);
+        void fold_constants(OptStats& stats);
+        void remove_dead_writes();
+        void thread_jumps(OptStats& stats);
+        void remove_jumps_to_next();
+        void compact(OptStats& stats);
+        void move_code(const std::vector<size_t>& moved);
+        TcodeImage& image;
+        bool fixed_layout {false};
+        std::vector<size_t> added;
+        std::vector<bool> entries;
+        std::vector<bool> removed;
+        // where each instruction of the original program is now
+        std::vector<size_t> positions;
+        // the relocation of each instruction in an object that has one
+        std::vector<int64_t> reloc_at;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+
+// the size of the buffer output is collected in before it's written
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// when buffered output is written out, it's always written before reading input and when the program exits
+enum flush_policies{
+    FLUSH_AUTO,     // by line for a terminal, otherwise when the buffer is full
+    FLUSH_LINE,     // after each newline
+    FLUSH_FULL,     // when the buffer is full
+    FLUSH_EXIT,     // only before input and at exit, growing the buffer as needed
+};
+
+// how much a program wrote, and how many writes it took
+struct OutputStats{
+    uint64_t bytes {0};
+    uint64_t writes {0};
+};
+
+/* the output of puts and puti, collected in a buffer so it can be written in large chunks. The
+   output goes to a file descriptor, written with writev so a string too large for the buffer
+   is written along with it rather than copied, or to a stream */
+class OutputBuffer{
+    public:
+        OutputBuffer(int fd, int policy = FLUSH_AUTO);
+        OutputBuffer(std::ostream* stream, int policy = FLUSH_AUTO);
+        ~OutputBuffer();
+        OutputBuffer(const OutputBuffer&) = delete;
+        OutputBuffer& operator=(const OutputBuffer&) = delete;
+        void write(const char* data, size_t size);
+        void write_uint(uint64_t val);
+        void flush();
+        void set_policy(int policy);
+        const OutputStats& get_stats() {return this->stats;}
+    private:
+        void reserve(size_t size);
+        void emit(const char* extra, size_t extra_size);
+        std::unique_ptr<char[]> buffer;
+        size_t capacity {0};
+        size_t used {0};
+        int fd {-1};
+        std::ostream* stream {nullptr};
+        int policy;
+        OutputStats stats;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Program;
+
+// calls nested deeper than this are attributed to the deepest function profiled
+#define MAX_PROFILE_DEPTH 1024
+
+// a function in the call tree, reached by a path of calls from the start of the program
+struct CallNode{
+    uint32_t parent;
+    uint64_t function;
+    uint64_t instructions {0};
+    uint64_t samples {0};
+};
+
+/* counts the instructions a machine executes, by index and by the path of calls that led to
+   them, and optionally samples where it is at a fixed interval of wall time. Calls and returns
+   are followed through call and ret, each function being named by the label it was called at */
+class Profiler{
+    public:
+        Profiler(size_t inst_count);
+        ~Profiler();
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+        void count(uint64_t pc);
+        void call(uint64_t target);
+        void ret();
+        void start_sampling(uint32_t interval_us);
+        void stop_sampling();
+        void report(std::ostream& out, const Program& program, double seconds, size_t top);
+        void write_collapsed(std::ostream& out, const Program& program);
+    private:
+        void sample(uint64_t pc);
+        std::vector<uint64_t> instruction_counts;
+        std::vector<uint64_t> instruction_samples;
+        std::vector<CallNode> nodes;
+        std::unordered_map<uint64_t, uint32_t> children;
+        std::vector<uint32_t> stack;
+        uint32_t node {0};
+        size_t overflow {0};
+        uint32_t interval_us {0};
+        std::atomic<bool> sample_due {false};
+        std::atomic<bool> sampling {false};
+        std::thread sampler;
+};
+
+// counts an instruction about to run at the given index
+inline void Profiler::count(uint64_t pc){
+    this->instruction_counts[pc]++;
+    this->nodes[this->node].instructions++;
+    if (this->sample_due.load(std::memory_order_relaxed))
+        this->sample(pc);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder.h"
+#include "image_cache.h"
+#include "tcode.h"
+#include "verifier.h"
+
+// the functions that execute each operation family, by the family's op code
+typedef std::unordered_map<uint8_t, exec_func> ExtensionTable;
+
+// how long loading a program took, and what it contained
+struct LoadStats{
+    double seconds {0};
+    size_t bytes {0};
+    size_t instructions {0};
+    size_t strings {0};
+    bool cached {false};
+    bool verified {false};
+    std::string verify_error;
+};
+
+/* a decoded program, along with its strings, data label layout, debug symbols and the extensions
+   it was decoded against. A program that was verified can be run on the unchecked interpreter.
+   A program never changes once it's loaded, so it's shared by reference between any number of
+   machines running it, on any number of threads. Once decoded, a program can be written to the
+   image cache, so later loads of the same file skip decoding it */
+class Program{
+    friend class Machine;
+    public:
+        static std::shared_ptr<const Program> load(const std::string& file_path, const ExtensionTable& extensions, bool fusion, bool cache = false, int verify = VERIFY_OFF);
+        const DecodedCode& get_code() const {return this->code;}
+        size_t size() const {return this->code.size();}
+        const std::string& get_str(size_t index) const;
+        const std::vector<DataLabel>& get_data_labels() const {return this->data_labels;}
+        const std::vector<Symbol>& get_symbols() const {return this->symbols;}
+        size_t find_label(const std::string& name) const;
+        exec_func get_extension(uint8_t op_family) const;
+        const std::vector<size_t>& get_fusion_counts() const {return this->fusion_counts;}
+        const LoadStats& get_load_stats() const {return this->load_stats;}
+        bool is_verified() const {return this->load_stats.verified;}
+    private:
+        void verify(bool strict);
+        bool read_image(const std::string& path, const ImageKey& key);
+        void write_image(const std::string& path, const ImageKey& key) const;
+        DecodedCode code;
+        std::vector<std::string> strings;
+        std::vector<DataLabel> data_labels;
+        std::vector<Symbol> symbols;
+        ExtensionTable extensions;
+        std::vector<size_t> fusion_counts;
+        LoadStats load_stats;
+};
+
+#endif
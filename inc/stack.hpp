@@ -1,42 +1,57 @@
-
 #ifndef TINKER_STACK_H
 #define TINKER_STACK_H
 
 #include <cstdlib>
+#include <cstddef>
 #include <inttypes.h>
+#include <setjmp.h>
+#include <stdexcept>
+
+// the default size of the stack in bytes
+#define DEFAULT_STACK_SIZE 1000000
 
-#include "../inc/util.hpp"
+// hosts with mmap catch overflows with a guard page, others check the capacity on every push
+#if defined(__unix__) || defined(__APPLE__)
+#define STACK_GUARD_PAGES
+#endif
 
+/* the VM stack, made of 8-byte slots with bytes pushed zero extended to a full slot. The slots
+   are mapped between two inaccessible guard pages, so pushing past the end faults rather than
+   being checked on every push, see Stack::arm_guard */
 class Stack{
     public:
-        Stack();
+        Stack(size_t size = DEFAULT_STACK_SIZE);
         ~Stack();
-        void push(uint8_t* data, uint8_t data_size);
-        template <typename T>
-        void push(T data);
-        uint8_t* pop();
-        template <typename T>
-        T pop_type();
-        bool is_empty() {return (this->stack_ptr == this->init_ptr);}
-        size_t size() {return 1000000 - this->capacity;}
+        Stack(const Stack&) = delete;
+        Stack& operator=(const Stack&) = delete;
+        void resize(size_t size);
+        void push(uint64_t val);
+        uint64_t pop() {return *--this->top;}
+        bool is_empty() {return (this->top == this->base);}
+        size_t size() {return this->top - this->base;}
+        size_t capacity() {return this->slots;}
+        const uint64_t* data() {return this->base;}
+        bool in_guard(const void* addr) const;
+        static void arm_guard(const Stack* stack, sigjmp_buf* env);
+        static void disarm_guard();
     private:
-        uint8_t* stack_ptr {nullptr};
-        uint8_t* init_ptr {nullptr};
-        size_t capacity {1000000};
+        void allocate(size_t size);
+        void release();
+        uint8_t* region {nullptr};
+        size_t region_size {0};
+        size_t page_size {0};
+        uint64_t* base {nullptr};
+        uint64_t* top {nullptr};
+        size_t slots {0};
 };
 
-template <typename T>
-void Stack::push(T data){
-    uint8_t* bytes = new uint8_t[sizeof(T)];
-    split_bytes(data, bytes);
-    this->push(bytes, sizeof(T));
-    delete bytes;
-}
-
-template <typename T>
-T Stack::pop_type(){
-    uint8_t* data = this->pop();
-    return merge_bytes<T>(data);
+// pushes a value on to the stack
+inline void Stack::push(uint64_t val){
+#ifndef STACK_GUARD_PAGES
+    if (this->size() == this->slots)
+        throw std::runtime_error("stack overflow");
+#endif
+    *this->top++ = val;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,127 @@
+#ifndef TCODE_H
+#define TCODE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+
+/* tcode files come in two formats. Version 1 is a series of quoted strings terminated by a null
+   byte, followed by 10-byte big-endian instructions. Version 2 starts with a header and a table
+   of sections, all fields are little-endian and every section starts on a 16-byte boundary:
+
+       header      magic "TCOD", u16 version, u16 section count, u32 flags, u32 reserved
+       sections    u32 type, u32 flags, u64 offset, u64 size (one per section)
+       code        16-byte instructions: u8 op code, u8 registers, 6 reserved bytes, u64 extend
+       strings     u32 count, then each string as a u32 length and its bytes, padded to 4 bytes
+       data        u32 count, then each data label as u32 type, u32 string index, u64 size
+       debug       u32 count, then each symbol as u32 kind, u32 name length, u64 value, and
+                   the name padded to 4 bytes
+
+   An object file is a version 2 file with the object flag set in its header, which can't be run
+   until it's linked. Its jumps, data label uses and strings are numbered within the object, and
+   it has two more sections for the linker:
+
+       symbols     u32 count, then each symbol as u32 kind, u32 flags, u32 name length, u32
+                   reserved, u64 value, and the name padded to 4 bytes
+       relocations u32 count, then each relocation as u64 instruction index, u32 kind, u32 target
+*/
+#define TCODE_MAGIC "TCOD"
+#define TCODE_VERSION 2
+#define TCODE_HEADER_BYTES 16
+#define TCODE_SECTION_BYTES 24
+#define TCODE_INST_BYTES 16
+#define TCODE_ALIGN 16
+// set in a version 2 header's flags for an object file
+#define TCODE_OBJECT_FLAG 0x1
+
+enum tcode_sections{
+    CODE_SECTION = 1,
+    STRING_SECTION,
+    DATA_SECTION,
+    DEBUG_SECTION,
+    SYMBOL_SECTION,
+    RELOC_SECTION,
+};
+
+enum symbol_kinds{
+    PROGRAM_SYMBOL,
+    DATA_SYMBOL,
+};
+
+// an object symbol that's defined in the object, rather than referenced from another one, and one that other objects can reference
+enum symbol_flags{
+    SYMBOL_DEFINED = 0x1,
+    SYMBOL_GLOBAL = 0x2,
+};
+
+/* what a relocation patches: a jump, call or spawn to a program label symbol, a loada of a data
+   label symbol, or the string an ALLOC_STR copies, by its index in the object's strings */
+enum reloc_kinds{
+    LABEL_RELOC,
+    DATA_RELOC,
+    STRING_RELOC,
+};
+
+// a data label's allocation, in the order the labels are declared
+struct DataLabel{
+    uint32_t type;
+    uint32_t str_index;
+    uint64_t size;
+};
+
+// a named location in the program, for program labels the value is the index of the labelled instruction
+struct Symbol{
+    uint32_t kind;
+    uint64_t value;
+    std::string name;
+};
+
+/* a label in an object file. A program label's value is the index of the instruction it labels,
+   and a data label's is its index in the object's data labels */
+struct ObjectSymbol{
+    uint32_t kind;
+    uint32_t flags;
+    uint64_t value;
+    std::string name;
+};
+
+// an instruction in an object file whose extend the linker sets once the program is laid out
+struct Relocation{
+    uint64_t inst;
+    uint32_t kind;
+    uint32_t target;
+};
+
+// the contents of a tcode file, with the instructions left in place in the file's memory
+struct TcodeView{
+    int version {1};
+    uint32_t flags {0};
+    const uint8_t* code {nullptr};
+    size_t inst_count {0};
+    std::vector<std::string> strings;
+    std::vector<DataLabel> data_labels;
+    std::vector<Symbol> symbols;
+    std::vector<ObjectSymbol> object_symbols;
+    std::vector<Relocation> relocations;
+    Instruction instruction(size_t index) const;
+};
+
+// everything written to a tcode file
+struct TcodeImage{
+    std::vector<Instruction> instructions;
+    std::vector<std::string> strings;
+    std::vector<DataLabel> data_labels;
+    std::vector<Symbol> symbols;
+    bool object {false};
+    std::vector<ObjectSymbol> object_symbols;
+    std::vector<Relocation> relocations;
+};
+
+TcodeView parse_tcode(const uint8_t* data, size_t size);
+void write_tcode(std::ostream& out, const TcodeImage& image, int version);
+
+#endif
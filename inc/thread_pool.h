@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* a fixed set of worker threads, each with its own queue of tasks. Workers take tasks from the
+   back of their own queue, and once it's empty steal from the front of the others, so a worker
+   that draws long tasks doesn't hold up the ones queued behind them */
+class ThreadPool{
+    public:
+        ThreadPool(size_t threads);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        void submit(std::function<void()> task);
+        void wait();
+        size_t size() {return this->workers.size();}
+    private:
+        struct WorkQueue{
+            std::mutex lock;
+            std::deque<std::function<void()> > tasks;
+        };
+        void work(size_t index);
+        bool take(size_t index, std::function<void()>& task);
+        std::vector<std::unique_ptr<WorkQueue> > queues;
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable task_added;
+        std::condition_variable all_done;
+        size_t pending {0};
+        std::atomic<size_t> queued {0};
+        size_t next_queue {0};
+        bool stopping {false};
+        std::exception_ptr error;
+};
+
+#endif
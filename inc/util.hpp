@@ -11,7 +11,7 @@ T merge_bytes(const uint8_t* data){
     size_t dat_size = sizeof(T);
     for (int i = 0; i < dat_size; i++){
         int shift_val = 8 * (dat_size - i - 1);
-        retval += data[i] << shift_val;
+        retval |= static_cast<T>(data[i]) << shift_val;
     }
     return retval;
 }
@@ -20,7 +20,7 @@ T merge_bytes(const uint8_t* data){
 template <typename T>
 void split_bytes(T data, uint8_t* out){
     size_t dat_size = sizeof(T);
-    T mask_val = 0xff << (8 * (dat_size - 1));
+    T mask_val = static_cast<T>(0xff) << (8 * (dat_size - 1));
     for (int i = 0; i < dat_size; i++){
         int shift_val = 8 * (dat_size - i - 1);
         out[i] = (data & mask_val) >> shift_val;
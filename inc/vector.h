@@ -0,0 +1,33 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "instruction.h"
+
+class Machine;
+class GuestMemory;
+
+// a 256-bit vector register, as four 64-bit lanes
+struct alignas(32) VectorReg{
+    uint64_t lanes[VECTOR_LANES];
+};
+
+// the instruction sets vector operations can be run with
+enum vector_isas{
+    VECTOR_SCALAR,
+    VECTOR_AVX2,
+};
+
+bool has_avx2();
+void set_vector_isa(int isa);
+int get_vector_isa();
+void load_lanes(GuestMemory& memory, uint64_t addr, VectorReg& dst);
+void store_lanes(GuestMemory& memory, uint64_t addr, const VectorReg& src);
+void apply_lanes(uint8_t op, const VectorReg& lhs, const VectorReg& rhs, VectorReg& dst);
+void apply_lanes_imm(uint8_t op, const VectorReg& lhs, uint64_t imm, VectorReg& dst);
+uint64_t reduce_lanes(uint8_t op, const VectorReg& src);
+void exec_vector(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
+
+#endif
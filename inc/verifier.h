@@ -0,0 +1,31 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+#include "decoder.h"
+
+// how a program is checked when it's loaded
+enum verify_modes{
+    VERIFY_OFF,
+    VERIFY_ON,
+    VERIFY_STRICT,
+};
+
+/* what verifying a program proved about it. A program that isn't safe would read or write past
+   the machine's state, while one that's safe but not verified has jumps that leave the program,
+   which the checked interpreters stop it at. The data labels allocated by the instructions the
+   program starts with exist before anything else runs, so using them needs no check */
+struct VerifyResult{
+    bool verified {false};
+    bool safe {false};
+    std::string error;
+    size_t ready_labels {0};
+};
+
+VerifyResult verify_code(const DecodedCode& code, size_t string_count, bool strict);
+void specialize_code(DecodedCode& code, const VerifyResult& result);
+
+#endif
@@ -4,30 +4,19 @@
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <charconv>
+#include <memory>
 
 #include "../inc/assembler.h"
+#include "../inc/mapped_file.h"
+#include "../inc/mnemonics.h"
+#include "../inc/thread_pool.h"
 
-#define INSTRUCTION_BYTES 10
 #define EXTEND 0xfe
 
-// splits a string by spaces and returns each "word"
-std::vector<std::string> split_str(const std::string& str){
-        std::string str_copy = str;
-        std::vector<std::string> retval;
-        size_t space_index = str.find(" ");
-        while (str_copy.size() && space_index != str_copy.npos){
-            retval.push_back(str_copy.substr(0, space_index));
-            str_copy = str_copy.substr(space_index+1);
-            space_index = str_copy.find(" ");
-        }
-        if (str_copy.size())
-            retval.push_back(str_copy);
-        return retval;
-}
-
-// parses a string literal, and optionally appends null termination
-std::string parse_str_lit(std::string& str_lit, bool null_terminate){
-    if (str_lit[0] != '"')
+// parses a string literal, resolving its escape sequences, and optionally appends null termination
+std::string parse_str_lit(std::string_view str_lit, bool null_terminate){
+    if (str_lit.empty() || str_lit[0] != '"')
         throw std::runtime_error("invalid string literal: no opening quotation");
     size_t pos = 1;
     size_t str_len = str_lit.size();
@@ -39,6 +28,35 @@ std::string parse_str_lit(std::string& str_lit, bool null_terminate){
             closed = true;
             break;
         }
+        if (chr == '\\' && pos + 1 < str_len){
+            pos++;
+            switch (str_lit[pos]){
+                case 'n':
+                    chr = '\n';
+                    break;
+                case 't':
+                    chr = '\t';
+                    break;
+                case 'b':
+                    chr = '\b';
+                    break;
+                case 'v':
+                    chr = '\v';
+                    break;
+                case 'f':
+                    chr = '\f';
+                    break;
+                case 'r':
+                    chr = '\r';
+                    break;
+                case '0':
+                    chr = '\0';
+                    break;
+                default:
+                    chr = str_lit[pos];
+                    break;
+            }
+        }
         out.push_back(chr);
         pos++;
     }
@@ -49,145 +67,259 @@ std::string parse_str_lit(std::string& str_lit, bool null_terminate){
     return out;
 }
 
-// scans the instructions provided for program labels
-void Assembler::scan_prog_labels(std::vector<std::string>& lines){
-    size_t line_count {lines.size()}, pos {0};
-    std::unordered_map<size_t, bool> to_remove;
-    std::string str;
-    for (int i = 0; i < lines.size(); i++){
-        str = lines[i];
-        // check if the instruction is a program label
-        if (str[str.size() - 1] == ':' && std::count(str.begin(), str.end(), ' ') == 0){
-            this->program_labels[str.substr(0, str.size() - 1)] = pos - 1;
-            to_remove[i] = true;
-        }
-        else
-            pos++;
-    }
-    std::vector<std::string> new_lines;
-    size_t offset = 0;
-    for (int i = 0; i < line_count; i++){
-        if (!to_remove.count(i))
-            new_lines.push_back(lines[i]);
-    }
-    lines = new_lines;
-}
-
 // parses an operation and returns its 8-bit opcdoe
-uint8_t Assembler::parse_op(const std::string& op){
-    auto op_itt = op_map.find(op);
-    if (op_itt == op_map.end()){
+uint8_t Assembler::parse_op(std::string_view op){
+    const Mnemonic* mnemonic = find_mnemonic(op);
+    if (!mnemonic){
         // determine this if this a label
-        if (op[op.size() - 1] == ':')
+        if (op.back() == ':')
             return NULL_INST;
         // indicate that the result is an extension, and not an in-built command
         return EXTEND;
     }
     // parse the opcode and add the immediate bit
-    auto operation = op_itt->second;
-    uint8_t retval = operation.first;
+    uint8_t retval = mnemonic->op_code;
     retval <<= 1;
-    retval |= (int) operation.second;
+    retval |= (int) mnemonic->immediate;
     return retval;
 }
 
 // converts a pneumonic register into its corresponding 4bit register code
 // raises an error if the code is invalid
-uint8_t Assembler::parse_reg(const std::string& reg){
-    if (reg[0] != 'r')
-        throw std::runtime_error("invalid register: "+reg);
-    uint8_t reg_no;
-    try{
-        reg_no = std::stoi(reg.substr(1));
-    }
-    catch (std::invalid_argument){
-        throw std::runtime_error("invalid register: "+reg);
-    }
-    if (reg_no < 0 || reg_no > 15)
-        throw std::runtime_error("invalid register: "+reg);
+uint8_t Assembler::parse_reg(std::string_view reg){
+    int reg_no = find_register(reg);
+    if (reg_no < 0)
+        throw std::runtime_error("invalid register: " + std::string(reg));
+    return reg_no;
+}
+
+// converts a vector register's name into its 4bit register code, raising an error if it's invalid
+uint8_t Assembler::parse_vector_reg(std::string_view reg){
+    int reg_no = find_vector_register(reg);
+    if (reg_no < 0)
+        throw std::runtime_error("invalid vector register: " + std::string(reg));
     return reg_no;
 }
 
 // parses an immediate value, and throws a std::runtime error if it's invalid
-uint64_t Assembler::parse_immediate(const std::string& imm){
-    try{
-        return std::stol(imm);
+uint64_t Assembler::parse_immediate(std::string_view imm){
+    bool negative = false;
+    size_t start = 0;
+    if (imm.size() && (imm[0] == '-' || imm[0] == '+')){
+        negative = (imm[0] == '-');
+        start = 1;
     }
-    catch (std::invalid_argument){
+    uint64_t val;
+    const char* end = imm.data() + imm.size();
+    std::from_chars_result result = std::from_chars(imm.data() + start, end, val);
+    if (start == imm.size() || result.ec != std::errc() || result.ptr != end)
         throw std::runtime_error("invalid immediate value");
-    }
+    return negative ? -val : val;
 }
-// parses a label declaration
-Instruction Assembler::parse_label(const std::string& label){
-    // remove the colon from the end of the label
-    std::vector<std::string> operands = split_str(label);
-    Instruction retval;
-    std::string label_name = operands[0];
-    label_name = label_name.substr(0, label_name.size() - 1);
-    // if there is no size specificiation, we assume that this is a program label, which has already been identified
-    if (operands.size() == 1){
-        this->parse_jmp_label(label_name);
-        retval.op_code = NULL_INST;
-        return retval;
-    }
-    // generate an instruction to allocate space for the data label
-    auto label_itt = type_map.find(operands[1]);
-    if (label_itt  == type_map.end())
+
+// converts the name of a data label's type to its data type, returns -1 if the name is invalid
+static int parse_data_type(std::string_view type){
+    if (type == ".word")
+        return WORD;
+    if (type == ".string")
+        return STRING;
+    if (type == ".stringz")
+        return STRINGZ;
+    if (type == ".data")
+        return DATA;
+    return -1;
+}
+
+/* parses a data label's declaration, throwing a std::runtime_error if it's invalid. This doesn't
+   change the assembler, so any number of chunks can parse their declarations at once */
+DataDecl Assembler::parse_data_decl(const Tokens& operands){
+    DataDecl decl;
+    decl.name = std::string(operands[0].substr(0, operands[0].size() - 1));
+    int label_type = parse_data_type(operands[1]);
+    if (label_type < 0)
         throw std::runtime_error("invalid data type in label declaration");
-    int label_type = label_itt->second;
+    decl.type = label_type;
     // determine the space to allocate based on the label type
-    std::string str_lit;
-    bool null_terminate;
-    uint64_t mem_size;
     switch (label_type){
         case WORD:
             if (operands.size() != 2)
                 throw std::runtime_error("invalid label declaration");
-            retval.op_code = ALLOC_MEM << 1;
-            retval.extend = 64;
-            this->next_label++;
+            decl.size = 64;
             break;
         case STRING:
         case STRINGZ:
-            if (operands.size() < 3)
+            // the lexer keeps a string literal in a single token, spaces and all
+            if (operands.size() != 3)
                 throw std::runtime_error("invalid label declaration");
-            // append all operands after the thrid to the third
-            for (int i = 3; i < operands.size(); i++)
-                operands[2] += " " + operands[i];
-            null_terminate = (label_type == STRINGZ);
-            str_lit = parse_str_lit(operands[2], null_terminate);
-            
-            // parse the string and create the instruction
-            this->program_strs.push_back(str_lit);
-            retval.op_code = ALLOC_STR << 1;
-            retval.extend = program_strs.size() - 1;
-            this->next_label++;
+            decl.str = parse_str_lit(operands[2], label_type == STRINGZ);
+            decl.size = decl.str.size();
             break;
         case DATA:
             if (operands.size() != 3)
                 throw std::runtime_error("invalid label declaration");
-            mem_size = parse_immediate(operands[2]);
-            retval.op_code = ALLOC_MEM << 1;
-            retval.extend = mem_size;
+            decl.size = parse_immediate(operands[2]);
             break;
     }
-    this->line_no++;
-    this->data_labels[label_name] = this->next_label;
+    return decl;
+}
+
+// gives a data label the next place in the data layout, returning the instruction that allocates it
+Instruction Assembler::declare_data_label(const DataDecl& decl, size_t pos){
+    Instruction retval;
+    if (decl.type == STRING || decl.type == STRINGZ){
+        this->program_strs.push_back(decl.str);
+        retval.op_code = ALLOC_STR << 1;
+        retval.extend = program_strs.size() - 1;
+        this->data_layout.push_back({decl.type, (uint32_t) retval.extend, decl.size});
+    }
+    else{
+        retval.op_code = ALLOC_MEM << 1;
+        retval.extend = decl.size;
+        this->data_layout.push_back({decl.type, 0, decl.size});
+    }
+    this->next_label++;
+    this->data_labels[decl.name].push_back({pos, this->next_label});
     return retval;
 }
 
-uint64_t Assembler::parse_jmp_label(const std::string& label){
-    auto itt = this->program_labels.find(label);
-    if (itt == this->program_labels.end())
+// parses a .global directive, returning the name of the label it makes global
+std::string_view Assembler::parse_global(const Tokens& operands){
+    if (operands.size() != 2)
+        throw std::runtime_error("invalid .global directive, expected a single label");
+    return operands[1];
+}
+
+// ensures every label made global is declared
+void Assembler::check_globals(){
+    for (const std::string& name : this->globals){
+        if (!this->program_labels.count(name) && !this->data_labels.count(name))
+            throw std::runtime_error("global label is never declared: " + name);
+    }
+}
+
+/* numbers an object's symbols and finds the instructions the linker must relocate. Instructions
+   only hold the index of the labels they use, so the source is read again for their names */
+void Assembler::build_object(std::string_view source, TcodeImage& image){
+    image.object = true;
+    // every declaration of a data label is a symbol, in the order they're declared, only the last declaration of a global label is global
+    std::vector<std::string> data_names(this->data_layout.size());
+    for (auto& label : this->data_labels){
+        for (auto& decl : label.second)
+            data_names[decl.second - 1] = label.first;
+    }
+    for (size_t i = 0; i < data_names.size(); i++){
+        bool global = this->globals.count(data_names[i]) && this->data_labels[data_names[i]].back().second == i + 1;
+        image.object_symbols.push_back({DATA_SYMBOL, SYMBOL_DEFINED | (global ? static_cast<uint32_t>(SYMBOL_GLOBAL) : 0u), i, data_names[i]});
+    }
+    // then the program labels, in the order of the instructions they label
+    std::vector<std::pair<size_t, std::string> > prog_labels;
+    for (auto& label : this->program_labels)
+        prog_labels.push_back({label.second + 1, label.first});
+    std::sort(prog_labels.begin(), prog_labels.end());
+    std::unordered_map<std::string, uint32_t> prog_ids, undefined_ids[2];
+    for (auto& label : prog_labels){
+        prog_ids[label.second] = image.object_symbols.size();
+        uint32_t flags = SYMBOL_DEFINED | (this->globals.count(label.second) ? static_cast<uint32_t>(SYMBOL_GLOBAL) : 0u);
+        image.object_symbols.push_back({PROGRAM_SYMBOL, flags, label.first, label.second});
+    }
+    // labels from other objects are undefined symbols, one for each name used
+    auto undefined = [&](uint32_t kind, std::string_view label){
+        std::string name(label);
+        auto itt = undefined_ids[kind].find(name);
+        if (itt != undefined_ids[kind].end())
+            return itt->second;
+        uint32_t id = image.object_symbols.size();
+        image.object_symbols.push_back({kind, 0, 0, name});
+        undefined_ids[kind][name] = id;
+        return id;
+    };
+    Lexer lexer(source);
+    Tokens tokens;
+    size_t pos = 0;
+    while (lexer.next(tokens)){
+        if (tokens[0] == GLOBAL_DIRECTIVE || (tokens.size() == 1 && tokens[0].back() == ':'))
+            continue;
+        const Instruction& inst = image.instructions[pos];
+        uint8_t op = inst.op_code >> 1;
+        if (tokens[0].back() == ':'){
+            if (op == ALLOC_STR)
+                image.relocations.push_back({pos, STRING_RELOC, (uint32_t) inst.extend});
+        }
+        else if (op == LOAD_ADDR){
+            // the label is the data label declared last before the use, if there is one
+            uint32_t target;
+            auto itt = this->data_labels.find(std::string(tokens.back()));
+            if (itt == this->data_labels.end())
+                target = undefined(DATA_SYMBOL, tokens.back());
+            else
+                target = inst.extend - 1;
+            image.relocations.push_back({pos, DATA_RELOC, target});
+        }
+        else if ((op >= JUMP && op <= CAL) || op == SPAWN){
+            auto itt = prog_ids.find(std::string(tokens.back()));
+            uint32_t target = (itt == prog_ids.end()) ? undefined(PROGRAM_SYMBOL, tokens.back()) : itt->second;
+            image.relocations.push_back({pos, LABEL_RELOC, target});
+        }
+        pos++;
+    }
+}
+
+// optimizes the assembled program, moving each program label along with the instruction it labels
+void Assembler::optimize(TcodeImage& image){
+    Optimizer optimizer(image);
+    for (auto& label : this->program_labels)
+        optimizer.add_entry(label.second + 1);
+    this->opt_stats = optimizer.optimize(this->opt_level);
+    // labels of code that was never reached are dropped along with it
+    for (auto label = this->program_labels.begin(); label != this->program_labels.end();){
+        size_t pos = optimizer.new_position(label->second + 1);
+        if (pos == NO_POSITION)
+            label = this->program_labels.erase(label);
+        else{
+            label->second = pos - 1;
+            label++;
+        }
+    }
+}
+
+// parses a label declaration
+Instruction Assembler::parse_label(const Tokens& operands){
+    Instruction retval;
+    // if there is no size specificiation, we assume that this is a program label, which has already been identified
+    if (operands.size() == 1){
+        this->parse_jmp_label(operands[0].substr(0, operands[0].size() - 1));
+        retval.op_code = NULL_INST;
+        return retval;
+    }
+    // generate an instruction to allocate space for the data label
+    return this->declare_data_label(parse_data_decl(operands), this->line_no);
+}
+
+uint64_t Assembler::parse_jmp_label(std::string_view label){
+    auto itt = this->program_labels.find(std::string(label));
+    if (itt == this->program_labels.end()){
+        // an object can jump to a label in another object, which the linker resolves
+        if (this->object)
+            return 0;
         throw std::runtime_error("invalid jump destination");
+    }
     return itt->second;
 }
 
-uint64_t Assembler::parse_data_label(const std::string& label){
-    auto itt = this->data_labels.find(label);
-    if (itt == this->data_labels.end())
-        throw std::runtime_error("use of uneclared label: " + label);
-    return itt->second;
+// returns the index of a data label as declared before the given position
+uint64_t Assembler::parse_data_label(std::string_view label, size_t pos){
+    auto itt = this->data_labels.find(std::string(label));
+    if (itt != this->data_labels.end()){
+        const std::vector<std::pair<size_t, size_t> >& decls = itt->second;
+        for (auto decl = decls.rbegin(); decl != decls.rend(); decl++){
+            if (decl->first < pos)
+                return decl->second;
+        }
+    }
+    // an object can use a data label from another object, as long as it doesn't declare one of the same name
+    else if (this->object)
+        return 0;
+    throw std::runtime_error("use of uneclared label: " + std::string(label));
 }
 
 // combines two four-bit registers into a single eight-bit  constant
@@ -204,101 +336,241 @@ void Assembler::add_extension(const std::string& instruction, Instruction(*parse
     this->extensions[instruction] = parser;
 }
 
-// converts an tinker assembly file to a byte code file to be exewcuted
+/* collects a chunk's program labels and parses its data label declarations, counting its lines
+   and the instructions it will assemble to. A bad declaration is recorded and the scan carries
+   on, so the labels after it are still found */
+void Assembler::scan_chunk(AsmChunk& chunk){
+    Lexer lexer(chunk.source);
+    Tokens tokens;
+    size_t pos = 0;
+    while (lexer.next(tokens)){
+        std::string_view label = tokens[0];
+        if (label == GLOBAL_DIRECTIVE){
+            try{
+                chunk.globals.push_back(parse_global(tokens));
+            }
+            catch (std::runtime_error& e){
+                if (!chunk.error_line){
+                    chunk.error_line = lexer.line();
+                    chunk.error = e.what();
+                }
+            }
+            continue;
+        }
+        if (label.back() == ':'){
+            // a program label is a line holding nothing but the label's name followed by a colon
+            if (tokens.size() == 1){
+                chunk.prog_labels.push_back({label.substr(0, label.size() - 1), pos});
+                continue;
+            }
+            try{
+                chunk.data_decls.push_back(parse_data_decl(tokens));
+                chunk.data_decls.back().pos = pos;
+            }
+            catch (std::runtime_error& e){
+                if (!chunk.error_line){
+                    chunk.error_line = lexer.line();
+                    chunk.error = e.what();
+                }
+            }
+        }
+        pos++;
+    }
+    chunk.lines = lexer.line();
+    chunk.inst_count = pos;
+}
+
+// assembles a chunk's instructions into its own buffer, stopping at the first error
+void Assembler::assemble_chunk(AsmChunk& chunk){
+    Lexer lexer(chunk.source);
+    Tokens tokens;
+    size_t pos = chunk.first_inst, data = 0;
+    chunk.instructions.reserve(chunk.inst_count);
+    while (lexer.next(tokens)){
+        // the scan already failed on this line
+        if (chunk.error_line && lexer.line() >= chunk.error_line)
+            break;
+        // directives were read by the scan
+        if (tokens[0] == GLOBAL_DIRECTIVE)
+            continue;
+        if (tokens[0].back() == ':'){
+            // program labels aren't instructions, data labels were declared once every chunk was scanned
+            if (tokens.size() > 1){
+                chunk.instructions.push_back(chunk.data_insts[data++]);
+                pos++;
+            }
+            continue;
+        }
+        try{
+            chunk.instructions.push_back(this->assemble_tokens(tokens, pos));
+        }
+        catch (std::runtime_error& e){
+            chunk.error_line = lexer.line();
+            chunk.error = e.what();
+            break;
+        }
+        pos++;
+    }
+}
+
+// runs a phase over every chunk, across the assembler's threads if it has more than one
+void Assembler::run_chunks(std::vector<AsmChunk>& chunks, void (Assembler::*phase)(AsmChunk&)){
+    if (this->threads == 1 || chunks.size() == 1){
+        for (AsmChunk& chunk : chunks)
+            (this->*phase)(chunk);
+        return;
+    }
+    ThreadPool pool(std::min(this->threads, chunks.size()));
+    for (AsmChunk& chunk : chunks)
+        pool.submit([this, phase, &chunk](){(this->*phase)(chunk);});
+    pool.wait();
+}
+
+/* converts an tinker assembly file to a byte code file to be exewcuted. The source is split into
+   chunks of lines, which are scanned for labels at once. The labels are then declared in the
+   order they appear, so the data layout and the strings are the same however the source was
+   split, and the chunks are assembled at once into buffers that are joined in order */
 void Assembler::assemble_file(const std::string& in_path, const std::string& out_path){
-    // read the input file
-    std::ifstream in(in_path);
-    if (!in.good())
+    // read the input file, every token is a view into it so no line is ever copied
+    std::unique_ptr<MappedFile> in;
+    try{
+        in.reset(new MappedFile(in_path));
+    }
+    catch (std::runtime_error&){
         throw std::runtime_error("Error: failed to read the input file");
-    std::string buf;
-    std::vector<std::string> lines;
-    while (std::getline(in, buf))
-        lines.push_back(buf);        
-    in.close();
+    }
+    std::string_view source(reinterpret_cast<const char*>(in->data()), in->size());
+    size_t chunk_count = 1;
+    if (this->threads > 1)
+        chunk_count = std::min(this->threads * ASM_CHUNKS_PER_THREAD, source.size() / ASM_MIN_CHUNK + 1);
+    std::vector<AsmChunk> chunks;
+    for (std::string_view lines : split_lines(source, chunk_count)){
+        chunks.emplace_back();
+        chunks.back().source = lines;
+    }
     // scan for any program labels
-    this->scan_prog_labels(lines);  
-    // assemble the rest of the instructions
-    for (auto i : lines){
-        Instruction inst = assemble_inst(i);
-        this->instructions.push_back(inst);
+    this->run_chunks(chunks, &Assembler::scan_chunk);
+    size_t line = 0, pos = 0;
+    for (AsmChunk& chunk : chunks){
+        chunk.first_line = line;
+        chunk.first_inst = pos;
+        // program labels are stored as the index before the labelled instruction
+        for (auto& label : chunk.prog_labels)
+            this->program_labels[std::string(label.first)] = pos + label.second - 1;
+        for (const DataDecl& decl : chunk.data_decls)
+            chunk.data_insts.push_back(this->declare_data_label(decl, pos + decl.pos));
+        for (std::string_view name : chunk.globals)
+            this->globals.insert(std::string(name));
+        line += chunk.lines;
+        pos += chunk.inst_count;
     }
-    // store all program strings to the file
-    std::ofstream out(out_path, std::ios::binary);
-    out << std::noskipws;
-    size_t string_count = this->program_strs.size();
-    for (int i = 0; i < string_count; i++)
-        out << std::noskipws << '"' << program_strs[i] << '"';
-    out << '\0';
-    // store the bytecode to the output file
-    this->instruction_count = instructions.size();
-    for (int i = 0; i < instruction_count; i++){
-        if (instructions[i].op_code != NULL_INST){
-            uint8_t* byte_buf = instructions[i].to_bytes().data();
-            out.write(reinterpret_cast<const char*>(byte_buf), INSTRUCTION_BYTES);
-        }
+    // assemble the rest of the instructions, leaving out the program labels
+    this->run_chunks(chunks, &Assembler::assemble_chunk);
+    TcodeImage image;
+    image.instructions.reserve(pos);
+    for (AsmChunk& chunk : chunks){
+        if (chunk.error_line)
+            throw std::runtime_error("Syntax error on line " + std::to_string(chunk.first_line + chunk.error_line) + ": " + chunk.error);
+        image.instructions.insert(image.instructions.end(), chunk.instructions.begin(), chunk.instructions.end());
+        std::vector<Instruction>().swap(chunk.instructions);
+    }
+    image.strings = this->program_strs;
+    image.data_labels = this->data_layout;
+    this->check_globals();
+    // an object's symbols name its labels for the linker, which writes the linked program's debug symbols
+    if (this->object)
+        this->build_object(source, image);
+    if (this->opt_level > 0)
+        this->optimize(image);
+    if (!this->object && this->debug_info){
+        // program labels are stored as the index before the labelled instruction
+        for (auto& label : this->program_labels)
+            image.symbols.push_back({PROGRAM_SYMBOL, label.second + 1, label.first});
+        for (auto& label : this->data_labels)
+            image.symbols.push_back({DATA_SYMBOL, label.second.back().second, label.first});
+        std::sort(image.symbols.begin(), image.symbols.end(), [](const Symbol& a, const Symbol& b){
+            return (a.kind != b.kind) ? a.kind < b.kind : a.value < b.value;
+        });
     }
+    std::ofstream out(out_path, std::ios::binary);
+    if (!out.good())
+        throw std::runtime_error("Error: failed to write the output file");
+    write_tcode(out, image, this->format);
     out.close();
 }
 
-// assembles a command from an extension
-Instruction Assembler::parse_extend(const std::vector<std::string>& operands){
-    auto itt = this->extensions.find(operands[0]);
+// assembles a command from an extension, which is passed its operands as strings
+Instruction Assembler::parse_extend(const Tokens& operands){
+    auto itt = this->extensions.find(std::string(operands[0]));
     if (itt == extensions.end())
         throw std::runtime_error("unrecognized command");
-    return itt->second(operands);
+    return itt->second(std::vector<std::string>(operands.begin(), operands.end()));
 }
 
 // converts a pneumonic text insturction to a byte code instruction
 Instruction Assembler::assemble_inst(const std::string& inst){
+    Tokens operands;
+    tokenize(inst, operands);
     try{
-        std::vector<std::string> operands = split_str(inst);
-        uint8_t op_code = this->parse_op(operands[0]);
-        if (op_code == NULL_INST)
-            return this->parse_label(inst);
-        if (op_code == EXTEND)
-            return this->parse_extend(operands);
-        // determine how to parse the instruction, based on it's type
-        uint8_t op_type = (op_code & 0xE0) >> 1; // left most three bits  
+        if (operands.empty())
+            throw std::runtime_error("empty instruction");
         Instruction retval;
-        switch (op_type){
-            case MEM_OP:
-                retval = parse_mem(op_code, operands);
-                break;
-            case LOGIC_OP:
-                retval = parse_logic(op_code, operands);
-                break;
-            case JUMP_OP:
-                retval = parse_jump(op_code, operands);
-                break;
-            case STACK_OP:
-                retval = parse_stack(op_code, operands);
-                break;
-            case IO_OP:
-                retval = parse_io(op_code, operands);
-                break;
-            case HEAP_OP:
-                retval = parse_heap(op_code, operands);
-                break;
+        if (operands[0] == GLOBAL_DIRECTIVE){
+            this->globals.insert(std::string(parse_global(operands)));
+            retval.op_code = NULL_INST;
         }
-        this->line_no++;
+        else if (operands[0].back() == ':')
+            retval = this->parse_label(operands);
+        else
+            retval = this->assemble_tokens(operands, this->line_no);
+        if (retval.op_code != NULL_INST)
+            this->line_no++;
         return retval;
     }
-    catch (std::runtime_error e){
-        // calculate the offset for the line number
-        int line_offset = 1;
-        for (auto itt : program_labels){
-            if (this->line_no < itt.second)
-                break;
-            line_offset++;
-        }
+    catch (std::runtime_error& e){
         std::stringstream error_msg;
-        error_msg << "Syntax error on line " << this->line_no + line_offset << ": " << e.what();
+        error_msg << "Syntax error on line " << this->line_no + 1 << ": " << e.what();
         throw std::runtime_error(error_msg.str());
     }
 }
 
+/* converts the tokens of an operation at the given position to a byte code instruction. This
+   doesn't change the assembler, so any number of chunks can be assembled at once */
+Instruction Assembler::assemble_tokens(const Tokens& operands, size_t pos){
+    uint8_t op_code = this->parse_op(operands[0]);
+    if (op_code == EXTEND)
+        return this->parse_extend(operands);
+    // determine how to parse the instruction, based on it's type
+    uint8_t op_type = (op_code & 0xE0) >> 1; // left most three bits  
+    Instruction retval;
+    switch (op_type){
+        case MEM_OP:
+            retval = parse_mem(op_code, operands, pos);
+            break;
+        case LOGIC_OP:
+            retval = parse_logic(op_code, operands);
+            break;
+        case JUMP_OP:
+            retval = parse_jump(op_code, operands);
+            break;
+        case STACK_OP:
+            retval = parse_stack(op_code, operands);
+            break;
+        case IO_OP:
+            retval = parse_io(op_code, operands);
+            break;
+        case HEAP_OP:
+            retval = parse_heap(op_code, operands);
+            break;
+        case THREAD_OP:
+            retval = parse_thread(op_code, operands);
+            break;
+    }
+    return retval;
+}
+
 // parses a memory operation
-Instruction Assembler::parse_mem(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_mem(uint8_t op_code, const Tokens& operands, size_t pos){
     Instruction retval;
     retval.op_code = op_code;
     if (operands.size() != 3)
@@ -306,7 +578,7 @@ Instruction Assembler::parse_mem(uint8_t op_code, const std::vector<std::string>
     // check if this is load address, which has different parsing logic than the other memory commands
     if ((op_code >> 1) == LOAD_ADDR){
         retval.registers = parse_reg(operands[1]);
-        retval.extend = parse_data_label(operands[2]);
+        retval.extend = parse_data_label(operands[2], pos);
         return retval;
     }
     // parse the typical 3 operand parse memory command
@@ -331,7 +603,7 @@ Instruction Assembler::parse_mem(uint8_t op_code, const std::vector<std::string>
 }
 
 // parses a logical/arithmetic expression 
-Instruction Assembler::parse_logic(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_logic(uint8_t op_code, const Tokens& operands){
     // ensure four opperands are included (opcode, dst, lhs, rhs)
     if (operands.size() != 4)
         throw std::runtime_error("invalid instruction. Operation expects three operands");
@@ -357,7 +629,7 @@ Instruction Assembler::parse_logic(uint8_t op_code, const std::vector<std::strin
 }
 
 // parses a stack instruction
-Instruction Assembler::parse_stack(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_stack(uint8_t op_code, const Tokens& operands){
     if (operands.size() != 2)
         throw std::runtime_error("invalid instruction. Operation expects one operand");
     Instruction retval;
@@ -387,7 +659,7 @@ Instruction Assembler::parse_stack(uint8_t op_code, const std::vector<std::strin
 }
 
 // parses a jump or function call instruction
-Instruction Assembler::parse_jump(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_jump(uint8_t op_code, const Tokens& operands){
     Instruction retval;
     retval.op_code = op_code; 
     uint8_t r1, r2;
@@ -418,7 +690,7 @@ Instruction Assembler::parse_jump(uint8_t op_code, const std::vector<std::string
 }
 
 // parses an IO operation
-Instruction Assembler::parse_io(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_io(uint8_t op_code, const Tokens& operands){
     // all IO operations take a single register, so this parsing logic is universal
     Instruction retval;
     retval.op_code = op_code;
@@ -431,7 +703,7 @@ Instruction Assembler::parse_io(uint8_t op_code, const std::vector<std::string>&
 }
 
 // parses a heap instruction
-Instruction Assembler::parse_heap(uint8_t op_code, const std::vector<std::string>& operands){
+Instruction Assembler::parse_heap(uint8_t op_code, const Tokens& operands){
     Instruction retval;
     retval.op_code = op_code;
     switch ((op_code & 0xfe) >> 1){
@@ -449,4 +721,108 @@ Instruction Assembler::parse_heap(uint8_t op_code, const std::vector<std::string
             break;
     }
     return retval;
-}
\ No newline at end of file
+}
+
+// parses a thread or atomic memory instruction
+Instruction Assembler::parse_thread(uint8_t op_code, const Tokens& operands){
+    Instruction retval;
+    retval.op_code = op_code;
+    uint8_t r1, r2;
+    switch ((op_code & 0xfe) >> 1){
+        case SPAWN:
+            if (operands.size() != 3)
+                throw std::runtime_error("spawn expects a register and a label");
+            retval.registers = parse_reg(operands[1]);
+            retval.extend = parse_jmp_label(operands[2]);
+            break;
+        case JOIN:
+        case ATOMIC_LOAD:
+        case ATOMIC_STORE:
+            if (operands.size() != 3)
+                throw std::runtime_error("invalid instruction. Operation expects two operands");
+            r1 = parse_reg(operands[1]);
+            // astorei stores an immediate value rather than a register
+            if (op_code & 0x01){
+                retval.registers = r1;
+                retval.extend = parse_immediate(operands[2]);
+            }
+            else
+                retval.registers = merge_registers(r1, parse_reg(operands[2]));
+            break;
+        case FETCH_ADD:
+            if (operands.size() != 4)
+                throw std::runtime_error("fadd expects three operands");
+            r1 = parse_reg(operands[1]);
+            r2 = parse_reg(operands[2]);
+            retval.registers = merge_registers(r1, r2);
+            retval.extend = (op_code & 0x01) ? parse_immediate(operands[3]) : parse_reg(operands[3]);
+            break;
+        case COMP_SWAP:
+            if (operands.size() != 5)
+                throw std::runtime_error("cas expects four operands");
+            r1 = parse_reg(operands[1]);
+            r2 = parse_reg(operands[2]);
+            retval.registers = merge_registers(r1, r2);
+            // the expected and new values are packed into the extend like a register pair
+            retval.extend = merge_registers(parse_reg(operands[3]), parse_reg(operands[4]));
+            break;
+        default:
+            // vector operations take up the rest of the family
+            return parse_vector(op_code, operands);
+    }
+    return retval;
+}
+
+/* parses a vector instruction. Lane-wise operations keep which operation they are in the low byte
+   of the extend, and their rhs vector register or immediate in the rest of it */
+Instruction Assembler::parse_vector(uint8_t op_code, const Tokens& operands){
+    Instruction retval;
+    retval.op_code = op_code;
+    const Mnemonic* mnemonic = find_mnemonic(operands[0]);
+    uint8_t op = op_code >> 1;
+    if (operands.size() != ((op == VEC_LANES || op == VEC_GET || op == VEC_SET) ? 4 : 3))
+        throw std::runtime_error("invalid instruction. Wrong number of operands for " + std::string(operands[0]));
+    uint64_t imm;
+    switch (op){
+        case VEC_LOAD:
+            retval.registers = merge_registers(parse_vector_reg(operands[1]), parse_reg(operands[2]));
+            break;
+        case VEC_BROADCAST:
+            if (op_code & 0x01){
+                retval.registers = merge_registers(parse_vector_reg(operands[1]), 0);
+                retval.extend = parse_immediate(operands[2]);
+            }
+            else
+                retval.registers = merge_registers(parse_vector_reg(operands[1]), parse_reg(operands[2]));
+            break;
+        case VEC_STORE:
+            retval.registers = merge_registers(parse_reg(operands[1]), parse_vector_reg(operands[2]));
+            break;
+        case VEC_LANES:
+            retval.registers = merge_registers(parse_vector_reg(operands[1]), parse_vector_reg(operands[2]));
+            if (op_code & 0x01){
+                imm = parse_immediate(operands[3]);
+                if (static_cast<int64_t>(imm << 8) >> 8 != static_cast<int64_t>(imm))
+                    throw std::runtime_error("immediate value out of range for a vector operation");
+                retval.extend = mnemonic->variant | (imm << 8);
+            }
+            else
+                retval.extend = mnemonic->variant | (parse_vector_reg(operands[3]) << 8);
+            break;
+        case VEC_REDUCE:
+            retval.registers = merge_registers(parse_reg(operands[1]), parse_vector_reg(operands[2]));
+            retval.extend = mnemonic->variant;
+            break;
+        case VEC_GET:
+        case VEC_SET:
+            if (op == VEC_GET)
+                retval.registers = merge_registers(parse_reg(operands[1]), parse_vector_reg(operands[2]));
+            else
+                retval.registers = merge_registers(parse_vector_reg(operands[1]), parse_reg(operands[2]));
+            retval.extend = parse_immediate(operands[3]);
+            if (retval.extend >= VECTOR_LANES)
+                throw std::runtime_error("invalid vector lane");
+            break;
+    }
+    return retval;
+}
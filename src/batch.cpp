@@ -0,0 +1,213 @@
+#include <stdexcept>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include <unordered_map>
+
+#include "../inc/batch.h"
+#include "../inc/thread_pool.h"
+#include "../inc/event_loop.h"
+
+/* reads a batch manifest, one job per line as the program, then optionally the input and output
+   files, separated by whitespace. Blank lines and lines starting with # are skipped */
+std::vector<BatchJob> read_manifest(const std::string& path){
+    std::ifstream file(path);
+    if (!file.good())
+        throw std::runtime_error("failed to read the manifest " + path);
+    std::vector<BatchJob> jobs;
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(file, line)){
+        line_no++;
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.program) || job.program[0] == '#')
+            continue;
+        fields >> job.input >> job.output;
+        std::string extra;
+        if (fields >> extra)
+            throw std::runtime_error("too many fields on line " + std::to_string(line_no) + " of the manifest");
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+// opens a job's output file, output without a file goes to a stream with no buffer, which discards it
+static std::ostream* open_output(const BatchJob& job, std::ofstream& output_file, std::ostream& no_output){
+    if (job.output == "-")
+        return &no_output;
+    output_file.open(job.output, std::ios::binary);
+    if (!output_file.good())
+        throw std::runtime_error("failed to open the output file " + job.output);
+    return &output_file;
+}
+
+// records how a job's machine finished
+static void finish_job(Machine& machine, const std::string& error, JobResult& result){
+    result.ok = error.empty();
+    result.error = error;
+    if (result.ok){
+        result.counted = (machine.get_engine() == SWITCH_ENGINE || machine.get_engine() == THREADED_ENGINE);
+        result.instructions = machine.get_executed();
+    }
+}
+
+// runs a job in its own machine, sharing the loaded program with the other jobs
+static void run_job(const BatchJob& job, std::shared_ptr<const Program> program, const std::function<void(Machine&)>& configure, JobResult& result){
+    clock_type::time_point start = clock_type::now();
+    try{
+        std::istringstream no_input;
+        std::ifstream input_file;
+        std::istream* input = &no_input;
+        if (job.input != "-"){
+            input_file.open(job.input);
+            if (!input_file.good())
+                throw std::runtime_error("failed to open the input file " + job.input);
+            input = &input_file;
+        }
+        std::ostream no_output(nullptr);
+        std::ofstream output_file;
+        std::ostream* output = open_output(job, output_file, no_output);
+        Machine machine(program);
+        machine.set_streams(input, output);
+        configure(machine);
+        machine.set_count_instructions(true);
+        machine.exec();
+        output->flush();
+        finish_job(machine, "", result);
+    }
+    catch (std::exception& err){
+        result.error = err.what();
+    }
+    result.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// a job run on an event loop, with the machine and streams it needs until the loop finishes
+struct AsyncJob{
+    std::unique_ptr<AsyncInput> input;
+    std::ofstream output_file;
+    std::ostream no_output {nullptr};
+    std::unique_ptr<Machine> machine;
+};
+
+/* runs a share of the jobs on an event loop, so a machine waiting for its input is suspended
+   rather than blocking the worker thread the other machines are running on */
+static void run_event_loop(const std::vector<BatchJob>& jobs, const std::vector<size_t>& share, const std::vector<std::shared_ptr<const Program> >& programs,
+    const std::function<void(Machine&)>& configure, std::vector<JobResult>& results){
+    EventLoop loop;
+    std::vector<std::unique_ptr<AsyncJob> > running;
+    clock_type::time_point start = clock_type::now();
+    for (size_t i : share){
+        const BatchJob& job = jobs[i];
+        try{
+            std::unique_ptr<AsyncJob> async_job(new AsyncJob());
+            async_job->input.reset(job.input == "-" ? new AsyncInput() : new AsyncInput(job.input));
+            std::ostream* output = open_output(job, async_job->output_file, async_job->no_output);
+            async_job->machine.reset(new Machine(programs[i]));
+            async_job->machine->set_streams(nullptr, output);
+            configure(*async_job->machine);
+            async_job->machine->set_count_instructions(true);
+            Machine* machine = async_job->machine.get();
+            loop.add(machine, async_job->input.get(), [&results, i, machine, output, start](const std::string& error){
+                output->flush();
+                finish_job(*machine, error, results[i]);
+                results[i].seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+            });
+            running.push_back(std::move(async_job));
+        }
+        catch (std::exception& err){
+            results[i].error = err.what();
+        }
+    }
+    loop.run();
+}
+
+/* runs every job on a pool of worker threads. Each distinct program is loaded and decoded once,
+   and shared by the machines running its jobs. With async I/O, the jobs are split between an
+   event loop on each worker instead of each running as its own task */
+std::vector<JobResult> run_batch(const std::vector<BatchJob>& jobs, size_t threads, const std::function<void(Machine&)>& configure, bool async_io){
+    std::vector<JobResult> results(jobs.size());
+    std::unordered_map<std::string, size_t> program_index;
+    std::vector<std::string> names;
+    for (const BatchJob& job : jobs){
+        if (program_index.emplace(job.program, names.size()).second)
+            names.push_back(job.program);
+    }
+    // load the programs in parallel, each task only writes to its own slot
+    ThreadPool pool(threads);
+    std::vector<std::shared_ptr<const Program> > programs(names.size());
+    std::vector<std::string> errors(names.size());
+    for (size_t i = 0; i < names.size(); i++){
+        pool.submit([&, i](){
+            try{
+                Machine machine;
+                configure(machine);
+                machine.load_file(names[i]);
+                programs[i] = machine.share_program();
+            }
+            catch (std::exception& err){
+                errors[i] = err.what();
+            }
+        });
+    }
+    pool.wait();
+    std::vector<std::shared_ptr<const Program> > job_programs(jobs.size());
+    std::vector<std::vector<size_t> > shares(pool.size());
+    for (size_t i = 0; i < jobs.size(); i++){
+        size_t index = program_index[jobs[i].program];
+        if (!programs[index]){
+            results[i].error = errors[index];
+            continue;
+        }
+        job_programs[i] = programs[index];
+        if (async_io){
+            shares[i % shares.size()].push_back(i);
+            continue;
+        }
+        pool.submit([&, i](){
+            run_job(jobs[i], job_programs[i], configure, results[i]);
+        });
+    }
+    if (async_io){
+        for (size_t i = 0; i < shares.size(); i++){
+            if (shares[i].size())
+                pool.submit([&, i](){
+                    run_event_loop(jobs, shares[i], job_programs, configure, results);
+                });
+        }
+    }
+    pool.wait();
+    return results;
+}
+
+// quotes a field for a csv file
+static std::string csv_field(const std::string& field){
+    std::string retval = "\"";
+    for (char chr : field){
+        if (chr == '"')
+            retval += '"';
+        retval += chr;
+    }
+    return retval + "\"";
+}
+
+// writes each job's status, wall time and instruction count to a csv file
+void write_summary(const std::string& path, const std::vector<BatchJob>& jobs, const std::vector<JobResult>& results){
+    std::ofstream file(path);
+    if (!file.good())
+        throw std::runtime_error("failed to write the summary " + path);
+    file << "job,program,status,wall_ms,instructions\n";
+    file << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < jobs.size(); i++){
+        const JobResult& result = results[i];
+        file << i << "," << csv_field(jobs[i].program) << "," << csv_field(result.ok ? "ok" : result.error) << ",";
+        file << result.seconds * 1000 << ",";
+        if (result.counted)
+            file << result.instructions;
+        file << "\n";
+    }
+}
@@ -0,0 +1,79 @@
+#include "../inc/decoder.h"
+#include "../inc/machine.h"
+
+// returns true if the handler transfers control to the instruction stored in the operand
+static bool is_jump_handler(uint8_t handler){
+    return handler >= H_JUMP && handler <= H_CAL;
+}
+
+/* resolves an instruction to the handler it will be run with. Anything the inlined handlers
+   can't reproduce exactly, including instructions reading or writing the program counter,
+   goes through the family function */
+static uint8_t resolve_handler(const DecodedOp& op, uint64_t extend, exec_func family_func){
+    if (family_func == nullptr)
+        return H_INVALID;
+    if (family_func == exec_mem){
+        if (op.op_code == COPY && !op.immediate && op.r1 && op.r2)
+            return H_COPY;
+        if (op.op_code == LOAD_WORD && op.immediate && op.r1 == 0 && op.r2)
+            return H_LOADI;
+    }
+    else if (family_func == exec_logic){
+        if (op.op_code > SL || !op.r1 || !op.r2)
+            return H_GENERIC;
+        if (!op.immediate && (extend == 0 || extend > 15))
+            return H_GENERIC;
+        return H_ADD + 2 * (op.op_code - ADD) + op.immediate;
+    }
+    else if (family_func == exec_jump){
+        if (op.op_code == JUMP || op.op_code == CAL || op.op_code == RET)
+            return H_JUMP + (op.op_code - JUMP);
+        if (op.op_code <= JLT && op.r1 && op.r2)
+            return H_JUMP + (op.op_code - JUMP);
+    }
+    else if (family_func == exec_thread){
+        if (op.op_code == VEC_LOAD && op.r2)
+            return H_VLOAD;
+        if (op.op_code == VEC_STORE && op.r1)
+            return H_VSTORE;
+        if (op.op_code == VEC_LANES && (extend & 0xff) <= V_GT && (op.immediate || (extend >> 8) <= 15))
+            return H_VLANES + op.immediate;
+        if (op.op_code == VEC_REDUCE && extend <= V_MAX && op.r1)
+            return H_VREDUCE;
+    }
+    return H_GENERIC;
+}
+
+void DecodedCode::reserve(size_t count){
+    this->ops.reserve(count);
+    this->operands.reserve(count);
+}
+
+// decodes an instruction and appends it to the end of the program
+void DecodedCode::append(const Instruction& inst){
+    DecodedOp op;
+    op.family = (inst.op_code & 0xE0) >> 5;
+    op.op_code = inst.op_code >> 1;
+    op.immediate = inst.op_code & 0x01;
+    op.r1 = inst.registers >> 4;
+    op.r2 = inst.registers & 0x0f;
+    op.handler = resolve_handler(op, inst.extend, this->families[op.family]);
+    // jumps store the index they continue from, rather than the index before it
+    uint64_t operand = inst.extend;
+    if (is_jump_handler(op.handler))
+        operand++;
+    this->ops.push_back(op);
+    this->operands.push_back(operand);
+}
+
+// converts a decoded instruction back to its bytecode form
+Instruction DecodedCode::encode(size_t index) const{
+    const DecodedOp& op = this->ops[index];
+    Instruction retval;
+    retval.op_code = (op.op_code << 1) | op.immediate;
+    retval.registers = (op.r1 << 4) | op.r2;
+    retval.extend = this->operands[index];
+    if (is_jump_handler(op.handler))
+        retval.extend--;
+    return retval;
+}
@@ -0,0 +1,132 @@
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+#include "../inc/decoder.h"
+#include "../inc/machine.h"
+#include "../inc/jit.h"
+#include "../inc/profiler.h"
+
+// runs the decoded program, dispatching each instruction through a switch on its handler
+void Machine::exec_switch(){
+#include "dispatch.inc"
+}
+
+// runs the decoded program as threaded code, jumping directly from one handler to the next
+void Machine::exec_threaded(){
+// computed goto is a GNU extension, other compilers fall back to the switch dispatch
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+#include "dispatch.inc"
+#undef THREADED_DISPATCH
+}
+
+// runs a verified program as threaded code, without checking the program counter before each instruction
+void Machine::exec_unchecked(){
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+#define UNCHECKED_DISPATCH
+#include "dispatch.inc"
+#undef UNCHECKED_DISPATCH
+#undef THREADED_DISPATCH
+}
+
+// runs the decoded program as threaded code, counting each instruction executed
+void Machine::exec_counted(){
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+#define COUNT_INSTRUCTIONS
+#include "dispatch.inc"
+#undef COUNT_INSTRUCTIONS
+#undef THREADED_DISPATCH
+}
+
+// runs the decoded program as threaded code, reporting each instruction, call and return to the profiler
+void Machine::exec_profiling(){
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+#define PROFILE_EXECUTION
+#include "dispatch.inc"
+#undef PROFILE_EXECUTION
+#undef THREADED_DISPATCH
+}
+
+// compiles the whole program to native code and runs it, falling back to the threaded engine on unsupported hosts
+void Machine::exec_jit(){
+    if (!Jit::supported()){
+        this->exec_threaded();
+        return;
+    }
+    size_t count = this->program->size();
+    uint64_t pc = this->registers[PROGRAM_COUNTER];
+    if (pc >= count || count == 0)
+        return;
+    this->jit.reset(new Jit(this));
+    const JitRegion& region = this->jit->compile(0, count);
+    while (pc < count && !this->suspended)
+        pc = this->jit->run(region, pc);
+    this->registers[PROGRAM_COUNTER] = pc;
+    this->jit.reset();
+}
+
+// interprets the program while counting backwards jumps, returning the end of a loop that crossed the threshold, or zero once the program finishes
+uint64_t Machine::exec_profiled(uint32_t* backedges, uint32_t threshold){
+    uint64_t loop_end = 0;
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+#define COUNT_BACKEDGES
+#include "dispatch.inc"
+#undef COUNT_BACKEDGES
+#undef THREADED_DISPATCH
+    return loop_end;
+}
+
+/* interprets the program until a loop crosses the tier threshold, then compiles the loop and
+   continues in compiled code from its header, returning to the interpreter when the loop exits */
+void Machine::exec_tiered(){
+    if (!Jit::supported()){
+        this->exec_threaded();
+        return;
+    }
+    typedef std::chrono::steady_clock clock;
+    size_t count = this->program->size();
+    this->backedges.assign(count, 0);
+    this->loops.clear();
+    this->jit.reset(new Jit(this));
+    uint32_t threshold = std::max<uint32_t>(this->tier_stats.threshold, 1);
+    clock::time_point start = clock::now(), end;
+    while (true){
+        uint64_t loop_end = this->exec_profiled(this->backedges.data(), threshold);
+        end = clock::now();
+        this->tier_stats.interpreter_seconds += std::chrono::duration<double>(end - start).count();
+        start = end;
+        if (!loop_end)
+            break;
+        // compile the loop unless this back edge is already covered by its compiled code
+        uint64_t header = this->registers[PROGRAM_COUNTER];
+        auto itt = this->loops.find(header);
+        if (itt == this->loops.end() || itt->second->end < loop_end){
+            size_t compiled_before = this->jit->get_compiled_bytes();
+            this->loops[header] = &this->jit->compile(header, loop_end);
+            this->tier_stats.events.push_back({header, loop_end, this->backedges[header], this->jit->get_compiled_bytes() - compiled_before});
+            end = clock::now();
+            this->tier_stats.compile_seconds += std::chrono::duration<double>(end - start).count();
+            start = end;
+        }
+        // enter the compiled loop at its header
+        this->registers[PROGRAM_COUNTER] = this->jit->run(*this->loops[header], header);
+        end = clock::now();
+        this->tier_stats.native_seconds += std::chrono::duration<double>(end - start).count();
+        start = end;
+        if (this->suspended)
+            break;
+    }
+    this->loops.clear();
+    this->jit.reset();
+}
@@ -0,0 +1,207 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+
+#include "../inc/event_loop.h"
+#include "../inc/machine.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#define HAS_EPOLL
+#include <sys/epoll.h>
+#endif
+
+// the most bytes read from an input at once
+#define INPUT_CHUNK_SIZE 65536
+
+// opens the file for non-blocking reads
+AsyncInput::AsyncInput(const std::string& path){
+    this->fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (this->fd < 0)
+        throw std::runtime_error("failed to open the input file " + path);
+    this->eof = false;
+}
+
+AsyncInput::~AsyncInput(){
+    if (this->fd >= 0)
+        close(this->fd);
+}
+
+// drops the buffered input before the given position
+void AsyncInput::consume(size_t end){
+    this->pos = end;
+    // only move what's left to the front once most of the buffer has been read
+    if (this->pos > INPUT_CHUNK_SIZE && this->pos * 2 > this->buffer.size()){
+        this->buffer.erase(0, this->pos);
+        this->pos = 0;
+    }
+}
+
+// reads the next line without its newline, returning false if the whole line hasn't arrived yet
+bool AsyncInput::read_line(std::string& line){
+    size_t end = this->buffer.find('\n', this->pos);
+    if (end == std::string::npos){
+        if (!this->eof)
+            return false;
+        // like getline, the last line doesn't need a newline
+        line.assign(this->buffer, this->pos, std::string::npos);
+        this->consume(this->buffer.size());
+        return true;
+    }
+    line.assign(this->buffer, this->pos, end - this->pos);
+    this->consume(end + 1);
+    return true;
+}
+
+/* reads the next integer, skipping any whitespace before it, returning false if it hasn't
+   arrived yet. As with reading from a stream, anything that isn't a number reads as zero */
+bool AsyncInput::read_int(uint64_t& val){
+    const std::string& buf = this->buffer;
+    size_t i = this->pos;
+    while (i < buf.size() && std::isspace(static_cast<unsigned char>(buf[i])))
+        i++;
+    bool negative = false;
+    if (i < buf.size() && (buf[i] == '-' || buf[i] == '+'))
+        negative = buf[i++] == '-';
+    size_t start = i;
+    uint64_t retval = 0;
+    while (i < buf.size() && std::isdigit(static_cast<unsigned char>(buf[i])))
+        retval = retval * 10 + (buf[i++] - '0');
+    // the number isn't finished until something other than a digit follows it
+    if (i == buf.size() && !this->eof)
+        return false;
+    val = (i == start) ? 0 : (negative ? -retval : retval);
+    this->consume(i);
+    return true;
+}
+
+// reads what's available, returning false if nothing could be read without blocking
+bool AsyncInput::fill(){
+    if (this->eof)
+        return true;
+    char chunk[INPUT_CHUNK_SIZE];
+    while (true){
+        ssize_t count = read(this->fd, chunk, sizeof(chunk));
+        if (count > 0){
+            this->buffer.append(chunk, count);
+            return true;
+        }
+        if (count == 0){
+            this->eof = true;
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        if (errno != EINTR)
+            throw std::runtime_error(std::string("failed to read input: ") + std::strerror(errno));
+    }
+}
+
+// blocks until the input is readable, for guest threads which can't be suspended
+void AsyncInput::wait(){
+    if (this->eof)
+        return;
+    pollfd entry {this->fd, POLLIN, 0};
+    while (poll(&entry, 1, -1) < 0 && errno == EINTR);
+}
+
+EventLoop::EventLoop(){
+#ifdef HAS_EPOLL
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0)
+        throw std::runtime_error("failed to create the event loop");
+#endif
+}
+
+EventLoop::~EventLoop(){
+    if (this->epoll_fd >= 0)
+        close(this->epoll_fd);
+}
+
+// adds a machine to run once the loop starts, done is called with an empty error if it exits normally
+void EventLoop::add(Machine* machine, AsyncInput* input, std::function<void(const std::string& error)> done){
+    machine->set_async_input(input);
+    this->tasks.emplace_back(new Task{machine, input, std::move(done)});
+}
+
+// runs a machine until it exits or is suspended, returning whether it's finished
+bool EventLoop::resume(Task& task){
+    try{
+        if (!task.machine->resume()){
+            this->suspensions++;
+            return false;
+        }
+        task.done("");
+    }
+    catch (std::exception& err){
+        task.done(err.what());
+    }
+    return true;
+}
+
+// waits for a suspended machine's input to become readable
+void EventLoop::watch(Task& task){
+#ifdef HAS_EPOLL
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.ptr = &task;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, task.input->get_fd(), &event) < 0)
+        throw std::runtime_error(std::string("failed to watch an input: ") + std::strerror(errno));
+#endif
+    this->watched.push_back(&task);
+}
+
+void EventLoop::unwatch(Task& task){
+#ifdef HAS_EPOLL
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, task.input->get_fd(), nullptr);
+#endif
+    this->watched.erase(std::find(this->watched.begin(), this->watched.end(), &task));
+}
+
+// blocks until at least one watched input is readable, or has been closed, and returns the machines waiting on them
+std::vector<EventLoop::Task*> EventLoop::wait(){
+    std::vector<Task*> ready;
+#ifdef HAS_EPOLL
+    epoll_event events[64];
+    int count;
+    while ((count = epoll_wait(this->epoll_fd, events, 64, -1)) < 0){
+        if (errno != EINTR)
+            throw std::runtime_error(std::string("failed to wait for input: ") + std::strerror(errno));
+    }
+    for (int i = 0; i < count; i++)
+        ready.push_back(static_cast<Task*>(events[i].data.ptr));
+#else
+    std::vector<pollfd> entries;
+    for (Task* task : this->watched)
+        entries.push_back({task->input->get_fd(), POLLIN, 0});
+    while (poll(entries.data(), entries.size(), -1) < 0){
+        if (errno != EINTR)
+            throw std::runtime_error(std::string("failed to wait for input: ") + std::strerror(errno));
+    }
+    for (size_t i = 0; i < entries.size(); i++){
+        if (entries[i].revents)
+            ready.push_back(this->watched[i]);
+    }
+#endif
+    return ready;
+}
+
+// runs every machine added to the loop until they've all exited
+void EventLoop::run(){
+    for (std::unique_ptr<Task>& task : this->tasks){
+        if (!this->resume(*task))
+            this->watch(*task);
+    }
+    while (this->watched.size()){
+        for (Task* task : this->wait()){
+            if (this->resume(*task))
+                this->unwatch(*task);
+        }
+    }
+    this->tasks.clear();
+}
@@ -0,0 +1,692 @@
+#include <algorithm>
+
+#include "../inc/flow_graph.h"
+#include "../inc/machine.h"
+
+// how a block ends once it's laid out: its last jump may be left out or inverted, and a jump may follow it
+struct BlockEnd{
+    bool drop {false};
+    bool invert {false};
+    size_t jump {NO_BLOCK};
+};
+
+// returns the operation a block ends with if it leaves the block, like a jump or a return, otherwise returns zero
+static uint8_t terminator(const BasicBlock& block){
+    if (block.code.empty() || !ends_block(block.code.back()))
+        return 0;
+    return block.code.back().op_code >> 1;
+}
+
+// returns true if an operation reads or writes the stack
+static bool uses_stack(uint8_t op){
+    // a spawned thread starts with a copy of the stack
+    return op == PUSH || op == PUSH_B || op == POP || op == POP_B || op == SPAWN;
+}
+
+// drops the instructions of a block that are marked, along with their targets
+static void drop_code(BasicBlock& block, const std::vector<bool>& drop){
+    size_t count = 0;
+    for (size_t i = 0; i < block.code.size(); i++){
+        if (drop[i])
+            continue;
+        block.code[count] = block.code[i];
+        block.targets[count] = block.targets[i];
+        count++;
+    }
+    block.code.resize(count);
+    block.targets.resize(count);
+}
+
+/* splits the program into blocks at each entry, finding the blocks its jumps, calls and spawns go
+   to. A block for the end of the program follows the last one, so jumping there exits */
+FlowGraph::FlowGraph(const std::vector<Instruction>& code, const std::vector<bool>& entries) : size(code.size()){
+    std::vector<size_t> block_at(code.size() + 1, NO_BLOCK);
+    for (size_t i = 0; i < code.size(); i++){
+        if (!i || entries[i] || ends_block(code[i - 1]) || inst_effects(code[i - 1]).barrier){
+            block_at[i] = this->blocks.size();
+            this->blocks.emplace_back();
+            this->blocks.back().start = i;
+        }
+        this->blocks.back().code.push_back(code[i]);
+    }
+    this->exit = this->blocks.size();
+    this->blocks.emplace_back();
+    this->blocks.back().start = code.size();
+    block_at[code.size()] = this->exit;
+    this->entry = 0;
+    for (size_t b = 0; b < this->exit; b++){
+        BasicBlock& block = this->blocks[b];
+        block.targets.assign(block.code.size(), NO_BLOCK);
+        for (size_t i = 0; i < block.code.size(); i++){
+            if (!has_target(block.code[i]))
+                continue;
+            uint64_t target = block.code[i].extend + 1;
+            block.targets[i] = (target >= code.size()) ? this->exit : block_at[target];
+        }
+        uint8_t op = terminator(block);
+        block.next = (op == JUMP || op == RET) ? NO_BLOCK : b + 1;
+    }
+    // threads can start at the blocks they're spawned at, which aren't entered from the block before
+    for (size_t b = 0; b < this->exit; b++){
+        for (size_t i = 0; i < this->blocks[b].code.size(); i++){
+            if ((this->blocks[b].code[i].op_code >> 1) == SPAWN && this->blocks[b].targets[i] != NO_BLOCK)
+                this->blocks[this->blocks[b].targets[i]].root = true;
+        }
+    }
+}
+
+// returns the blocks that can run right after a block, not counting the threads it spawns
+std::vector<size_t> FlowGraph::successors(size_t block) const{
+    const BasicBlock& current = this->blocks[block];
+    std::vector<size_t> succs;
+    if (terminator(current) && current.targets.back() != NO_BLOCK)
+        succs.push_back(current.targets.back());
+    if (current.next != NO_BLOCK)
+        succs.push_back(current.next);
+    return succs;
+}
+
+// marks the blocks that can be reached from the start of the program or the start of a thread
+void FlowGraph::find_reachable(){
+    for (BasicBlock& block : this->blocks)
+        block.reachable = false;
+    std::vector<size_t> pending{this->entry, this->exit};
+    for (size_t b = 0; b < this->blocks.size(); b++){
+        if (this->blocks[b].root)
+            pending.push_back(b);
+    }
+    while (!pending.empty()){
+        size_t b = pending.back();
+        pending.pop_back();
+        if (this->blocks[b].reachable)
+            continue;
+        this->blocks[b].reachable = true;
+        for (size_t succ : this->successors(b))
+            pending.push_back(succ);
+    }
+}
+
+// finds the reachable blocks each block can be run after
+void FlowGraph::find_preds(){
+    for (BasicBlock& block : this->blocks)
+        block.preds.clear();
+    for (size_t b = 0; b < this->blocks.size(); b++){
+        if (!this->blocks[b].reachable)
+            continue;
+        for (size_t succ : this->successors(b))
+            this->blocks[succ].preds.push_back(b);
+    }
+}
+
+/* finds the registers that may be read before they're written at the start and end of each
+   block, starting from every register being live at the end of the program */
+void FlowGraph::compute_liveness(){
+    for (BasicBlock& block : this->blocks){
+        block.live_in = 0;
+        block.live_out = 0;
+    }
+    this->blocks[this->exit].live_in = ALL_REGS;
+    for (bool changed = true; changed;){
+        changed = false;
+        for (size_t b = this->blocks.size(); b-- > 0;){
+            if (b == this->exit)
+                continue;
+            BasicBlock& block = this->blocks[b];
+            uint16_t live = 0;
+            for (size_t succ : this->successors(b))
+                live |= this->blocks[succ].live_in;
+            block.live_out = live;
+            for (size_t i = block.code.size(); i-- > 0;){
+                InstEffects effects = inst_effects(block.code[i]);
+                live = effects.barrier ? ALL_REGS : (live & ~effects.defs) | effects.uses;
+            }
+            if (live != block.live_in){
+                block.live_in = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+/* finds the immediate dominator of each reachable block, then numbers the dominator tree so
+   dominance can be checked at once. Every block the graph is entered at hangs off a virtual root */
+void FlowGraph::compute_dominators(){
+    size_t count = this->blocks.size();
+    size_t root = count;
+    std::vector<std::vector<size_t> > succs(count + 1);
+    std::vector<std::vector<size_t> > preds(count + 1);
+    for (size_t b = 0; b < count; b++){
+        if (!this->blocks[b].reachable)
+            continue;
+        succs[b] = this->successors(b);
+        preds[b] = this->blocks[b].preds;
+        if (b == this->entry || this->blocks[b].root){
+            succs[root].push_back(b);
+            preds[b].push_back(root);
+        }
+    }
+    // number the blocks in reverse postorder
+    std::vector<size_t> order;
+    std::vector<size_t> rpo_num(count + 1, NO_BLOCK);
+    std::vector<bool> visited(count + 1, false);
+    std::vector<std::pair<size_t, size_t> > stack{{root, 0}};
+    visited[root] = true;
+    while (!stack.empty()){
+        size_t b = stack.back().first;
+        size_t& child = stack.back().second;
+        if (child < succs[b].size()){
+            size_t succ = succs[b][child++];
+            if (!visited[succ]){
+                visited[succ] = true;
+                stack.push_back({succ, 0});
+            }
+            continue;
+        }
+        order.push_back(b);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++)
+        rpo_num[order[i]] = i;
+    this->idom.assign(count + 1, NO_BLOCK);
+    this->idom[root] = root;
+    auto intersect = [&](size_t a, size_t b){
+        while (a != b){
+            while (rpo_num[a] > rpo_num[b])
+                a = this->idom[a];
+            while (rpo_num[b] > rpo_num[a])
+                b = this->idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;){
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++){
+            size_t b = order[i];
+            size_t new_idom = NO_BLOCK;
+            for (size_t pred : preds[b]){
+                if (this->idom[pred] == NO_BLOCK)
+                    continue;
+                new_idom = (new_idom == NO_BLOCK) ? pred : intersect(pred, new_idom);
+            }
+            if (new_idom != this->idom[b]){
+                this->idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    // number the dominator tree, a block dominates the blocks numbered within its own range
+    std::vector<std::vector<size_t> > children(count + 1);
+    for (size_t b : order){
+        if (b != root)
+            children[this->idom[b]].push_back(b);
+    }
+    this->dom_pre.assign(count + 1, NO_BLOCK);
+    this->dom_post.assign(count + 1, NO_BLOCK);
+    size_t counter = 0;
+    stack.assign(1, {root, 0});
+    this->dom_pre[root] = counter++;
+    while (!stack.empty()){
+        size_t b = stack.back().first;
+        size_t& child = stack.back().second;
+        if (child < children[b].size()){
+            size_t next = children[b][child++];
+            this->dom_pre[next] = counter++;
+            stack.push_back({next, 0});
+            continue;
+        }
+        this->dom_post[b] = counter++;
+        stack.pop_back();
+    }
+}
+
+// returns true if every path to block b passes through block a
+bool FlowGraph::dominates(size_t a, size_t b) const{
+    if (this->dom_pre[a] == NO_BLOCK || this->dom_pre[b] == NO_BLOCK)
+        return false;
+    return this->dom_pre[a] <= this->dom_pre[b] && this->dom_post[b] <= this->dom_post[a];
+}
+
+/* finds the natural loops, each made of a header that dominates the blocks jumping back to it,
+   and the blocks that reach those without passing through the header. Each block's depth is the
+   number of loops it's in */
+std::vector<Loop> FlowGraph::find_loops(){
+    size_t count = this->blocks.size();
+    std::vector<std::vector<size_t> > tails(count);
+    for (size_t b = 0; b < count; b++){
+        this->blocks[b].depth = 0;
+        if (!this->blocks[b].reachable)
+            continue;
+        for (size_t succ : this->successors(b)){
+            if (this->dominates(succ, b))
+                tails[succ].push_back(b);
+        }
+    }
+    std::vector<Loop> loops;
+    std::vector<size_t> stamp(count, NO_BLOCK);
+    for (size_t header = 0; header < count; header++){
+        if (tails[header].empty())
+            continue;
+        Loop loop{header, {header}};
+        stamp[header] = loops.size();
+        std::vector<size_t> pending = tails[header];
+        while (!pending.empty()){
+            size_t b = pending.back();
+            pending.pop_back();
+            if (stamp[b] == loops.size())
+                continue;
+            stamp[b] = loops.size();
+            loop.body.push_back(b);
+            for (size_t pred : this->blocks[b].preds)
+                pending.push_back(pred);
+        }
+        for (size_t b : loop.body)
+            this->blocks[b].depth++;
+        loops.push_back(std::move(loop));
+    }
+    return loops;
+}
+
+/* replaces calls to small functions that don't jump, call or touch the return address with the
+   function's body. A call sets the return address and so does the function's ret, so a call is
+   only inlined if the return address isn't read after it */
+void FlowGraph::inline_calls(OptStats& stats){
+    for (size_t b = 0; b < this->blocks.size(); b++){
+        BasicBlock& block = this->blocks[b];
+        if (!block.reachable || terminator(block) != CAL || block.next == NO_BLOCK)
+            continue;
+        size_t callee = block.targets.back();
+        if (callee == this->exit || callee == b)
+            continue;
+        const BasicBlock& func = this->blocks[callee];
+        if (terminator(func) != RET || func.code.size() - 1 > MAX_INLINE_SIZE)
+            continue;
+        if (this->blocks[block.next].live_in & REG_BIT(RET_ADDR))
+            continue;
+        bool leaf = true;
+        for (size_t i = 0; i + 1 < func.code.size(); i++){
+            InstEffects effects = inst_effects(func.code[i]);
+            if (effects.barrier || has_target(func.code[i]) || ((effects.uses | effects.defs) & (REG_BIT(PROGRAM_COUNTER) | REG_BIT(RET_ADDR))))
+                leaf = false;
+        }
+        if (!leaf)
+            continue;
+        block.code.pop_back();
+        block.targets.pop_back();
+        block.code.insert(block.code.end(), func.code.begin(), func.code.end() - 1);
+        block.targets.resize(block.code.size(), NO_BLOCK);
+        stats.inlined++;
+    }
+}
+
+/* removes a push of a register followed by a pop back into it, as long as the stack isn't used
+   and the register isn't written in between, like the save and restore of the return address
+   around a call that was inlined. The pop can be in a later block, if the code only falls
+   through to it and it can't be entered any other way */
+void FlowGraph::remove_push_pops(OptStats& stats){
+    std::vector<std::vector<bool> > drop(this->blocks.size());
+    for (size_t b = 0; b < this->blocks.size(); b++)
+        drop[b].assign(this->blocks[b].code.size(), false);
+    auto falls_into = [this](size_t b){
+        const BasicBlock& block = this->blocks[b];
+        if (terminator(block) || block.next == NO_BLOCK || block.next == this->exit)
+            return false;
+        const BasicBlock& next = this->blocks[block.next];
+        return !next.root && next.preds.size() == 1;
+    };
+    // inner pairs are removed first, so the pairs around them are found
+    for (size_t b = this->blocks.size(); b-- > 0;){
+        if (!this->blocks[b].reachable)
+            continue;
+        for (size_t i = this->blocks[b].code.size(); i-- > 0;){
+            const Instruction& push = this->blocks[b].code[i];
+            if (push.op_code != (PUSH << 1))
+                continue;
+            uint8_t reg = push.registers & 0x0f;
+            size_t current = b;
+            size_t j = i + 1;
+            while (true){
+                if (j == this->blocks[current].code.size()){
+                    if (!falls_into(current))
+                        break;
+                    current = this->blocks[current].next;
+                    j = 0;
+                    continue;
+                }
+                if (drop[current][j]){
+                    j++;
+                    continue;
+                }
+                const Instruction& inst = this->blocks[current].code[j];
+                InstEffects effects = inst_effects(inst);
+                if (inst.op_code == (POP << 1) && (inst.registers & 0x0f) == reg){
+                    drop[b][i] = drop[current][j] = true;
+                    stats.dead_stores += 2;
+                    break;
+                }
+                if (effects.barrier || uses_stack(inst.op_code >> 1) || (effects.defs & REG_BIT(reg)))
+                    break;
+                j++;
+            }
+        }
+    }
+    for (size_t b = 0; b < this->blocks.size(); b++){
+        if (std::find(drop[b].begin(), drop[b].end(), true) != drop[b].end())
+            drop_code(this->blocks[b], drop[b]);
+    }
+}
+
+// removes pure instructions whose results are never read on any path, until none are left
+void FlowGraph::remove_dead_stores(OptStats& stats){
+    for (bool changed = true; changed;){
+        changed = false;
+        this->compute_liveness();
+        for (BasicBlock& block : this->blocks){
+            if (!block.reachable)
+                continue;
+            std::vector<bool> drop(block.code.size(), false);
+            bool dropped = false;
+            uint16_t live = block.live_out;
+            for (size_t i = block.code.size(); i-- > 0;){
+                InstEffects effects = inst_effects(block.code[i]);
+                if (effects.pure && effects.defs && !(effects.defs & live)){
+                    drop[i] = dropped = true;
+                    stats.dead_stores++;
+                    continue;
+                }
+                live = effects.barrier ? ALL_REGS : (live & ~effects.defs) | effects.uses;
+            }
+            if (dropped){
+                drop_code(block, drop);
+                changed = true;
+            }
+        }
+    }
+}
+
+/* moves pure instructions computing the same value on every iteration of a loop into a new block
+   run once before the loop. An instruction is moved if what it reads isn't written in the loop,
+   it's the only write to its register in the loop, its register isn't read at the header before
+   it's written, and either its register isn't read once the loop is left or it runs before every
+   exit. Loops that call, return or run extensions are left as they are */
+bool FlowGraph::hoist_invariants(const Loop& loop, const std::vector<bool>& in_loop, OptStats& stats){
+    // a thread can start at the header, without running anything placed before it
+    if (this->blocks[loop.header].root)
+        return false;
+    size_t defs[16] = {0};
+    uint16_t loop_defs = 0;
+    uint16_t exit_live = 0;
+    std::vector<size_t> exiting;
+    for (size_t b : loop.body){
+        for (const Instruction& inst : this->blocks[b].code){
+            InstEffects effects = inst_effects(inst);
+            if (effects.barrier)
+                return false;
+            for (size_t reg = 0; reg < 16; reg++){
+                if (effects.defs & REG_BIT(reg))
+                    defs[reg]++;
+            }
+            loop_defs |= effects.defs;
+        }
+        for (size_t succ : this->successors(b)){
+            if (!in_loop[succ]){
+                exit_live |= this->blocks[succ].live_in;
+                exiting.push_back(b);
+            }
+        }
+    }
+    std::vector<Instruction> hoisted;
+    // moving an instruction can leave the instructions reading its result invariant, so the loop is searched until nothing moves
+    for (bool moved = true; moved;){
+        moved = false;
+        for (size_t b : loop.body){
+            BasicBlock& block = this->blocks[b];
+            std::vector<bool> drop(block.code.size(), false);
+            bool dropped = false;
+            for (size_t i = 0; i < block.code.size(); i++){
+                InstEffects effects = inst_effects(block.code[i]);
+                if (!effects.pure || !effects.defs || ((effects.uses | effects.defs) & (REG_BIT(PROGRAM_COUNTER) | REG_BIT(RET_ADDR))))
+                    continue;
+                if ((effects.uses & loop_defs) || (effects.defs & this->blocks[loop.header].live_in))
+                    continue;
+                size_t reg = 0;
+                while (!(effects.defs & REG_BIT(reg)))
+                    reg++;
+                if (defs[reg] != 1)
+                    continue;
+                if (effects.defs & exit_live){
+                    bool before_exits = true;
+                    for (size_t exit_block : exiting)
+                        before_exits = before_exits && this->dominates(b, exit_block);
+                    if (!before_exits)
+                        continue;
+                }
+                hoisted.push_back(block.code[i]);
+                drop[i] = dropped = moved = true;
+                defs[reg] = 0;
+                loop_defs &= ~effects.defs;
+            }
+            if (dropped)
+                drop_code(block, drop);
+        }
+    }
+    if (hoisted.empty())
+        return false;
+    // the preheader takes the place of the header for every block entering the loop from outside of it
+    size_t header = loop.header;
+    BasicBlock preheader;
+    preheader.code = hoisted;
+    preheader.targets.assign(hoisted.size(), NO_BLOCK);
+    preheader.start = this->blocks[header].start;
+    preheader.preheader = true;
+    preheader.next = header;
+    preheader.reachable = true;
+    size_t pre = this->blocks.size();
+    std::vector<size_t> preds = this->blocks[header].preds;
+    this->blocks.push_back(std::move(preheader));
+    for (size_t pred : preds){
+        if (in_loop[pred])
+            continue;
+        BasicBlock& block = this->blocks[pred];
+        for (size_t& target : block.targets){
+            if (target == header)
+                target = pre;
+        }
+        if (block.next == header)
+            block.next = pre;
+    }
+    if (this->entry == header)
+        this->entry = pre;
+    stats.hoisted += hoisted.size();
+    return true;
+}
+
+/* runs the passes over the graph: inlining calls to small functions, removing pushes and pops
+   that cancel out and stores that are never read, then hoisting invariant code out of loops */
+void FlowGraph::optimize(OptStats& stats){
+    if (!this->exit)
+        return;
+    this->find_reachable();
+    this->find_preds();
+    this->compute_liveness();
+    this->inline_calls(stats);
+    this->remove_push_pops(stats);
+    this->find_reachable();
+    this->remove_dead_stores(stats);
+    // hoisting out of a loop changes the loops around it, so loops sharing a block with one that changed wait for the next round
+    for (bool changed = true; changed;){
+        changed = false;
+        this->find_reachable();
+        this->find_preds();
+        this->compute_liveness();
+        this->compute_dominators();
+        std::vector<Loop> loops = this->find_loops();
+        std::vector<bool> touched(this->blocks.size(), false);
+        std::vector<bool> in_loop(this->blocks.size(), false);
+        for (const Loop& loop : loops){
+            bool overlaps = false;
+            for (size_t b : loop.body)
+                overlaps = overlaps || touched[b];
+            if (overlaps)
+                continue;
+            for (size_t b : loop.body)
+                in_loop[b] = true;
+            bool hoisted = this->hoist_invariants(loop, in_loop, stats);
+            for (size_t b : loop.body){
+                in_loop[b] = false;
+                touched[b] = hoisted;
+            }
+            changed = changed || hoisted;
+        }
+    }
+}
+
+/* picks the block to lay out after a block, so the path most likely taken falls through. A block
+   that's only jumped to can follow the jump, which is left out. Of a branch's two blocks, the one
+   in more loops is the likelier, otherwise jne is likely taken and jeq isn't */
+size_t FlowGraph::preferred_next(size_t block, const std::vector<bool>& placed, const std::vector<size_t>& fall_preds) const{
+    const BasicBlock& current = this->blocks[block];
+    uint8_t op = terminator(current);
+    if (!op)
+        return current.next;
+    size_t target = current.targets.back();
+    bool can_follow = target != this->exit && target != NO_BLOCK && !placed[target] && !fall_preds[target];
+    size_t target_depth, next_depth;
+    switch (op){
+        case JUMP:
+            return can_follow ? target : NO_BLOCK;
+        case JEQ:
+        case JNE:
+            if (!can_follow)
+                return current.next;
+            target_depth = this->blocks[target].depth;
+            next_depth = this->blocks[current.next].depth;
+            if (target_depth > next_depth || (target_depth == next_depth && op == JNE))
+                return target;
+            return current.next;
+        case RET:
+            return NO_BLOCK;
+    }
+    return current.next;
+}
+
+/* orders the reachable blocks, starting from the entry, by following each block with the block
+   it's most likely to run next, and otherwise keeping the order of the program */
+std::vector<size_t> FlowGraph::layout(OptStats& stats){
+    std::vector<size_t> order;
+    std::vector<size_t> fall_preds(this->blocks.size(), 0);
+    for (size_t b = 0; b < this->blocks.size(); b++){
+        if (!this->blocks[b].reachable || b == this->exit)
+            continue;
+        order.push_back(b);
+        if (this->blocks[b].next != NO_BLOCK)
+            fall_preds[this->blocks[b].next]++;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+        if (this->blocks[a].start != this->blocks[b].start)
+            return this->blocks[a].start < this->blocks[b].start;
+        return this->blocks[a].preheader && !this->blocks[b].preheader;
+    });
+    std::vector<size_t> rank(this->blocks.size(), 0);
+    for (size_t i = 0; i < order.size(); i++)
+        rank[order[i]] = i;
+    std::vector<bool> placed(this->blocks.size(), false);
+    std::vector<size_t> result;
+    auto chain = [&](size_t b){
+        while (b != NO_BLOCK && b != this->exit && !placed[b]){
+            placed[b] = true;
+            result.push_back(b);
+            b = this->preferred_next(b, placed, fall_preds);
+        }
+    };
+    chain(this->entry);
+    for (size_t b : order)
+        chain(b);
+    for (size_t i = 0; i < result.size(); i++){
+        if (rank[result[i]] != (i ? rank[result[i - 1]] + 1 : 0))
+            stats.moved_blocks++;
+    }
+    result.push_back(this->exit);
+    return result;
+}
+
+/* writes the graph back out as a program, adding and removing jumps where the layout changed
+   which block follows which. Returns where each instruction of the original program went, the
+   instructions of a block that was never reached are removed along with it */
+std::vector<size_t> FlowGraph::emit(std::vector<Instruction>& code, OptStats& stats){
+    this->find_reachable();
+    std::vector<size_t> order = this->layout(stats);
+    std::vector<size_t> follows(this->blocks.size(), NO_BLOCK);
+    for (size_t i = 0; i + 1 < order.size(); i++)
+        follows[order[i]] = order[i + 1];
+    auto ending = [&](size_t b){
+        const BasicBlock& block = this->blocks[b];
+        BlockEnd end;
+        uint8_t op = terminator(block);
+        size_t after = follows[b];
+        if (op == JUMP)
+            end.drop = block.targets.back() == after;
+        else if (op == CAL || !op){
+            if (block.next != NO_BLOCK && block.next != after)
+                end.jump = block.next;
+        }
+        else if (op != RET && block.next != after){
+            if (block.targets.back() == after && (op == JEQ || op == JNE))
+                end.invert = true;
+            else
+                end.jump = block.next;
+        }
+        return end;
+    };
+    std::vector<size_t> starts(this->blocks.size(), NO_POSITION);
+    size_t pos = 0;
+    for (size_t b : order){
+        starts[b] = pos;
+        if (b == this->exit)
+            break;
+        BlockEnd end = ending(b);
+        pos += this->blocks[b].code.size() - end.drop + (end.jump != NO_BLOCK);
+    }
+    std::vector<Instruction> out;
+    out.reserve(pos);
+    for (size_t b : order){
+        if (b == this->exit)
+            break;
+        const BasicBlock& block = this->blocks[b];
+        BlockEnd end = ending(b);
+        for (size_t i = 0; i < block.code.size() - end.drop; i++){
+            Instruction inst = block.code[i];
+            size_t target = block.targets[i];
+            if (end.invert && i + 1 == block.code.size()){
+                uint8_t op = ((inst.op_code >> 1) == JEQ) ? JNE : JEQ;
+                inst.op_code = (op << 1) | (inst.op_code & 0x01);
+                target = block.next;
+            }
+            if (target != NO_BLOCK)
+                inst.extend = starts[target] - 1;
+            out.push_back(inst);
+        }
+        if (end.jump != NO_BLOCK){
+            Instruction jump;
+            jump.op_code = JUMP << 1;
+            jump.registers = 0;
+            jump.extend = starts[end.jump] - 1;
+            out.push_back(jump);
+        }
+    }
+    // every instruction of the original program goes where its block went
+    std::vector<size_t> moved(this->size + 1, NO_POSITION);
+    for (size_t b = 0; b < this->exit; b++){
+        const BasicBlock& block = this->blocks[b];
+        size_t end = (b + 1 < this->exit) ? this->blocks[b + 1].start : this->size;
+        if (!block.reachable){
+            stats.unreachable += end - block.start;
+            continue;
+        }
+        for (size_t i = block.start; i < end; i++)
+            moved[i] = starts[b];
+    }
+    moved[this->size] = out.size();
+    code.swap(out);
+    return moved;
+}
@@ -0,0 +1,48 @@
+#include "../inc/fusion.h"
+
+// the instruction sequences that get fused, in the order they are tried
+const std::vector<FusionPattern> fusion_patterns{
+    {"add+branch",      H_ADD,      H_ADD,      H_JEQ,      H_JLT,      H_ADD_JEQ},
+    {"addi+branch",     H_ADDI,     H_ADDI,     H_JEQ,      H_JLT,      H_ADDI_JEQ},
+    {"subi+branch",     H_SUBI,     H_SUBI,     H_JEQ,      H_JLT,      H_SUBI_JEQ},
+    {"compi+branch",    H_COMPI,    H_COMPI,    H_JEQ,      H_JLT,      H_COMPI_JEQ},
+    {"copy+copy",       H_COPY,     H_COPY,     H_COPY,     H_COPY,     H_COPY_COPY},
+    {"generic+generic", H_GENERIC,  H_GENERIC,  H_GENERIC,  H_GENERIC,  H_GENERIC_PAIR},
+};
+
+/* replaces each matching pair of instructions with a superinstruction in the first slot, and
+   returns the number of fusions made per pattern. The second instruction is left untouched, so
+   jumps landing on it still run it on its own */
+std::vector<size_t> fuse_instructions(DecodedCode& code){
+    std::vector<size_t> counts(fusion_patterns.size(), 0);
+    size_t inst_count = code.size();
+    for (size_t i = 0; i + 1 < inst_count; i++){
+        uint8_t first = code.ops[i].handler;
+        uint8_t second = code.ops[i + 1].handler;
+        for (size_t j = 0; j < fusion_patterns.size(); j++){
+            const FusionPattern& pattern = fusion_patterns[j];
+            if (first < pattern.first_min || first > pattern.first_max)
+                continue;
+            if (second < pattern.second_min || second > pattern.second_max)
+                continue;
+            size_t second_range = pattern.second_max - pattern.second_min + 1;
+            code.ops[i].handler = pattern.fused_base + (first - pattern.first_min) * second_range + (second - pattern.second_min);
+            counts[j]++;
+            // the second instruction is now part of this one, so it can't start another fusion
+            i++;
+            break;
+        }
+    }
+    return counts;
+}
+
+// returns the handler of the first instruction in a superinstruction, or the handler itself if it isn't fused
+uint8_t unfused_handler(uint8_t handler){
+    for (const FusionPattern& pattern : fusion_patterns){
+        size_t second_range = pattern.second_max - pattern.second_min + 1;
+        size_t fused_count = (pattern.first_max - pattern.first_min + 1) * second_range;
+        if (handler >= pattern.fused_base && handler < pattern.fused_base + fused_count)
+            return pattern.first_min + (handler - pattern.fused_base) / second_range;
+    }
+    return handler;
+}
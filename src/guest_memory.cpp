@@ -0,0 +1,108 @@
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+
+#include "../inc/guest_memory.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// memfds let a frozen image be shared by every fork without copying it
+#if defined(__linux__)
+#define HAS_MEMFD
+#endif
+
+// commit pages lazily, the region is only reserved up front
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+GuestImage::~GuestImage(){
+#ifdef HAS_MMAP
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+}
+
+GuestMemory::GuestMemory(){
+    this->map();
+}
+
+// maps an image copy-on-write, so the fork only copies the pages it writes to
+GuestMemory::GuestMemory(const GuestImage& image){
+    this->map();
+    this->top = image.length;
+#ifdef HAS_MEMFD
+    if (image.fd >= 0){
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t length = (image.length + page_size - 1) / page_size * page_size;
+        if (mmap(this->region, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image.fd, 0) == MAP_FAILED)
+            throw std::runtime_error("failed to map the snapshot's memory");
+        return;
+    }
+#endif
+    std::memcpy(this->region, image.bytes.data(), image.length);
+}
+
+GuestMemory::~GuestMemory(){
+#ifdef HAS_MMAP
+    munmap(this->region, GUEST_MEMORY_SIZE);
+#else
+    std::free(this->region);
+#endif
+}
+
+void GuestMemory::map(){
+#ifdef HAS_MMAP
+    void* mem = mmap(nullptr, GUEST_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::runtime_error("failed to reserve guest memory");
+    this->region = static_cast<uint8_t*>(mem);
+#else
+    this->region = static_cast<uint8_t*>(std::calloc(GUEST_MEMORY_SIZE, 1));
+    if (!this->region)
+        throw std::runtime_error("failed to reserve guest memory");
+#endif
+}
+
+// bumps a zeroed, 16-byte aligned block off the end of the used memory, returning its guest address
+uint64_t GuestMemory::reserve(size_t size){
+    size = (size + 15) & ~static_cast<size_t>(15);
+    size_t retval = this->top.load(std::memory_order_relaxed);
+    do{
+        if (size > GUEST_MEMORY_SIZE - retval)
+            throw std::runtime_error("out of guest memory");
+    } while (!this->top.compare_exchange_weak(retval, retval + size, std::memory_order_acq_rel));
+    return retval;
+}
+
+// copies the used memory into an image that forks can be created from
+std::shared_ptr<const GuestImage> GuestMemory::freeze(){
+    std::shared_ptr<GuestImage> image = std::make_shared<GuestImage>();
+    size_t top = this->used();
+    image->length = top;
+#ifdef HAS_MEMFD
+    image->fd = memfd_create("tvm-snapshot", MFD_CLOEXEC);
+    if (image->fd >= 0){
+        size_t written = 0;
+        if (ftruncate(image->fd, top) == 0){
+            while (written < top){
+                ssize_t count = pwrite(image->fd, this->region + written, top - written, written);
+                if (count <= 0)
+                    break;
+                written += count;
+            }
+        }
+        if (written == top)
+            return image;
+        // fall back to a plain copy if the memfd couldn't be filled
+        close(image->fd);
+        image->fd = -1;
+    }
+#endif
+    image->bytes.assign(this->region, this->region + top);
+    return image;
+}
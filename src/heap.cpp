@@ -0,0 +1,170 @@
+#include <stdexcept>
+#include <string>
+
+#include "../inc/heap.h"
+
+// the header before every block, which keeps blocks 16-byte aligned
+struct alignas(16) BlockHeader{
+    uint64_t size;
+};
+
+// the size stored in the header of a block that has been freed
+#define FREED_SIZE UINT64_MAX
+
+static_assert(sizeof(BlockHeader) == 16, "block headers must keep blocks 16-byte aligned");
+
+// returns the index of the smallest size class that fits the given size
+static size_t size_class_of(size_t size){
+    size_t size_class = 0;
+    size_t class_size = HEAP_MIN_CLASS;
+    while (class_size < size){
+        class_size <<= 1;
+        size_class++;
+    }
+    return size_class;
+}
+
+static BlockHeader* header_of(GuestMemory& memory, uint64_t addr){
+    return reinterpret_cast<BlockHeader*>(memory.at(addr - sizeof(BlockHeader), sizeof(BlockHeader)));
+}
+
+// a freed block holds the guest address of the next block on its free list
+static uint64_t& link_of(GuestMemory& memory, uint64_t addr){
+    return *reinterpret_cast<uint64_t*>(memory.at(addr, sizeof(uint64_t)));
+}
+
+// rounds a size up to keep blocks aligned, throwing an error rather than wrapping a size that could never fit
+static size_t round_up(size_t size){
+    if (size > GUEST_MEMORY_SIZE)
+        throw std::runtime_error("out of guest memory");
+    return (size + 15) & ~static_cast<size_t>(15);
+}
+
+// bumps a span off the current chunk, starting a new chunk if it doesn't fit
+uint64_t Heap::carve(GuestMemory& memory, size_t size){
+    if (size > HEAP_CHUNK_SIZE / 4){
+        // spans this large get a chunk to themselves rather than wasting the rest of the current one
+        size = round_up(size);
+        this->stats.reserved_bytes += size;
+        return memory.reserve(size);
+    }
+    if (this->bump_end - this->bump < size){
+        this->bump = memory.reserve(HEAP_CHUNK_SIZE);
+        this->bump_end = this->bump + HEAP_CHUNK_SIZE;
+        this->stats.reserved_bytes += HEAP_CHUNK_SIZE;
+    }
+    uint64_t retval = this->bump;
+    this->bump += size;
+    return retval;
+}
+
+// fills an empty size class's free list with a batch of blocks, each linked by the guest address of the next
+void Heap::refill(GuestMemory& memory, size_t size_class){
+    size_t capacity = HEAP_MIN_CLASS << size_class;
+    size_t block_size = sizeof(BlockHeader) + capacity;
+    size_t count = HEAP_CHUNK_SIZE / 16 / block_size;
+    uint64_t span = this->carve(memory, block_size * count);
+    this->spans[span] = {span, span + block_size * count, capacity};
+    this->recent_spans[size_class] = this->spans[span];
+    for (size_t i = count; i > 0; i--){
+        uint64_t addr = span + (i - 1) * block_size + sizeof(BlockHeader);
+        header_of(memory, addr)->size = FREED_SIZE;
+        link_of(memory, addr) = this->free_lists[size_class];
+        this->free_lists[size_class] = addr;
+    }
+}
+
+// returns the capacity of the block at a guest address, or zero if the heap never handed out a block there
+size_t Heap::capacity_of(uint64_t addr){
+    const HeapSpan* span = nullptr;
+    for (const HeapSpan& recent : this->recent_spans){
+        if (addr >= recent.start && addr < recent.end){
+            span = &recent;
+            break;
+        }
+    }
+    if (!span){
+        auto itt = this->spans.upper_bound(addr);
+        if (itt == this->spans.begin())
+            return 0;
+        span = &(--itt)->second;
+        if (addr >= span->end)
+            return 0;
+        if (span->capacity <= HEAP_MAX_CLASS)
+            span = &(this->recent_spans[size_class_of(span->capacity)] = *span);
+    }
+    size_t block_size = sizeof(BlockHeader) + span->capacity;
+    if (addr - span->start < sizeof(BlockHeader) || (addr - span->start - sizeof(BlockHeader)) % block_size)
+        return 0;
+    return span->capacity;
+}
+
+// allocates a block of the given size, throwing an error if it would take the heap past its limit
+uint64_t Heap::alloc(GuestMemory& memory, size_t size){
+    std::unique_lock<std::mutex> guard(this->lock.mutex, std::defer_lock);
+    if (this->shared)
+        guard.lock();
+    if (this->stats.limit && size > this->stats.limit - this->stats.live_bytes)
+        throw std::runtime_error("heap limit exceeded (allocating " + std::to_string(size) + " bytes with " + std::to_string(this->stats.live_bytes) + " of " + std::to_string(this->stats.limit) + " in use)");
+    uint64_t addr;
+    if (size <= HEAP_MAX_CLASS){
+        size_t size_class = size_class_of(size);
+        if (!this->free_lists[size_class])
+            this->refill(memory, size_class);
+        addr = this->free_lists[size_class];
+        // the guest can write over a freed block, so its link is only followed to a freed block of the same class
+        uint64_t next = link_of(memory, addr);
+        if (next && (this->capacity_of(next) != (HEAP_MIN_CLASS << size_class) || header_of(memory, next)->size != FREED_SIZE))
+            throw std::runtime_error("heap corrupted (invalid free list link)");
+        this->free_lists[size_class] = next;
+    }
+    else{
+        size_t capacity = round_up(size);
+        // reuse the smallest freed block that fits, as long as it doesn't waste more than half of it
+        auto itt = this->large_free.lower_bound(capacity);
+        if (itt != this->large_free.end() && itt->first / 2 <= capacity){
+            addr = itt->second;
+            this->large_free.erase(itt);
+        }
+        else{
+            uint64_t span = this->carve(memory, sizeof(BlockHeader) + capacity);
+            this->spans[span] = {span, span + sizeof(BlockHeader) + capacity, capacity};
+            addr = span + sizeof(BlockHeader);
+        }
+        this->stats.large_allocs++;
+    }
+    header_of(memory, addr)->size = size;
+    this->stats.live_bytes += size;
+    if (this->stats.live_bytes > this->stats.peak_bytes)
+        this->stats.peak_bytes = this->stats.live_bytes;
+    this->stats.allocs++;
+    return addr;
+}
+
+// returns a block to its free list, freeing a null address does nothing
+void Heap::free(GuestMemory& memory, uint64_t addr){
+    if (!addr)
+        return;
+    std::unique_lock<std::mutex> guard(this->lock.mutex, std::defer_lock);
+    if (this->shared)
+        guard.lock();
+    // the header is in guest memory, so the capacity comes from the heap's own spans
+    size_t capacity = this->capacity_of(addr);
+    if (!capacity)
+        throw std::runtime_error("invalid heap block");
+    BlockHeader* header = header_of(memory, addr);
+    if (header->size == FREED_SIZE)
+        throw std::runtime_error("heap block freed twice");
+    if (header->size > capacity)
+        throw std::runtime_error("heap corrupted (invalid block size)");
+    this->stats.live_bytes -= header->size;
+    this->stats.frees++;
+    header->size = FREED_SIZE;
+    if (capacity <= HEAP_MAX_CLASS){
+        size_t size_class = size_class_of(capacity);
+        link_of(memory, addr) = this->free_lists[size_class];
+        this->free_lists[size_class] = addr;
+    }
+    else
+        this->large_free.insert({capacity, addr});
+}
@@ -0,0 +1,336 @@
+#include <stdexcept>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include "../inc/image_cache.h"
+#include "../inc/program.h"
+#include "../inc/fusion.h"
+#include "../inc/machine.h"
+#include "../inc/mapped_file.h"
+
+// the name of every handler in order, so reordering the handlers changes the VM's key
+#define HANDLER_NAME(name) #name ","
+static const char handler_names[] = HANDLER_LIST(HANDLER_NAME);
+
+// where the family functions the decoder looks for are stored in a program's configuration
+enum family_kinds{
+    NO_FAMILY,
+    MEM_FAMILY,
+    LOGIC_FAMILY,
+    JUMP_FAMILY,
+    OTHER_FAMILY,
+};
+
+static inline uint64_t rotate_left(uint64_t val, int bits){
+    return (val << bits) | (val >> (64 - bits));
+}
+
+/* hashes bytes eight at a time, mixing each word in with a multiply and a rotate, so hashing a
+   file runs close to the speed of reading it */
+uint64_t hash_bytes(const uint8_t* data, size_t size, uint64_t seed){
+    const uint64_t prime_1 = 0x9e3779b97f4a7c15ull;
+    const uint64_t prime_2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t hash = seed ^ (size * prime_1);
+    size_t pos = 0;
+    for (; pos + 8 <= size; pos += 8){
+        uint64_t word;
+        std::memcpy(&word, data + pos, 8);
+        hash = rotate_left(hash ^ (word * prime_1), 31) * prime_2;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + pos, size - pos);
+    hash = rotate_left(hash ^ (tail * prime_1), 31) * prime_2;
+    // spread every bit of the state over the whole hash
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/* identifies the build of the VM, from its version and everything a decoded program depends on:
+   the handlers and their order, the fusion patterns and the layout of a decoded instruction */
+uint64_t vm_key(){
+    static const uint64_t key = [](){
+        std::string desc = std::string(TVM_VERSION) + ";" + std::to_string(IMAGE_VERSION) + ";" + std::to_string(sizeof(DecodedOp)) + ";" + handler_names;
+        for (const FusionPattern& pattern : fusion_patterns){
+            desc += pattern.name;
+            desc += {(char) pattern.first_min, (char) pattern.first_max, (char) pattern.second_min, (char) pattern.second_max, (char) pattern.fused_base};
+        }
+        return hash_bytes(reinterpret_cast<const uint8_t*>(desc.data()), desc.size(), 0);
+    }();
+    return key;
+}
+
+// the decoder only tells the built-in memory, logic and jump families apart from any other function, so those are all a cached program depends on
+static uint64_t family_kind(exec_func func){
+    if (func == nullptr)
+        return NO_FAMILY;
+    if (func == exec_mem)
+        return MEM_FAMILY;
+    if (func == exec_logic)
+        return LOGIC_FAMILY;
+    if (func == exec_jump)
+        return JUMP_FAMILY;
+    return OTHER_FAMILY;
+}
+
+// returns the key of the image a tcode file decodes to, against the given family functions
+ImageKey image_key(const uint8_t* tcode, size_t size, const std::array<exec_func, FAMILY_COUNT>& families, bool fusion){
+    ImageKey key;
+    key.vm = vm_key();
+    key.source = hash_bytes(tcode, size, 0);
+    key.config = fusion;
+    for (size_t i = 0; i < FAMILY_COUNT; i++)
+        key.config |= family_kind(families[i]) << (3 * i + 1);
+    return key;
+}
+
+// returns the directory images are cached in, or an empty string if there's nowhere to cache them
+std::string image_cache_dir(){
+    const char* dir = std::getenv("TVM_CACHE_DIR");
+    if (dir && *dir)
+        return dir;
+    dir = std::getenv("XDG_CACHE_HOME");
+    if (dir && *dir)
+        return std::string(dir) + "/tvm";
+    dir = std::getenv("HOME");
+    if (dir && *dir)
+        return std::string(dir) + "/.cache/tvm";
+    return "";
+}
+
+static std::string to_hex(uint64_t val){
+    const char digits[] = "0123456789abcdef";
+    std::string retval(16, '0');
+    for (int i = 15; i >= 0; i--, val >>= 4)
+        retval[i] = digits[val & 0xf];
+    return retval;
+}
+
+// returns the path an image is cached at, named by the file it was decoded from and what it was decoded against
+std::string image_cache_path(const std::string& dir, const ImageKey& key){
+    return dir + "/" + to_hex(key.source) + "-" + to_hex(hash_bytes(reinterpret_cast<const uint8_t*>(&key.config), sizeof(key.config), key.vm)) + IMAGE_EXTENSION;
+}
+
+// appends a value to an image in the host's byte order, as an image is only read by the host that wrote it
+template <typename T>
+static void write_raw(std::vector<uint8_t>& out, const T& val){
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&val);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// appends an array of bytes to an image, padded so the next value is 8-byte aligned
+static void write_array(std::vector<uint8_t>& out, const void* data, size_t size){
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+    out.resize((out.size() + 7) & ~static_cast<size_t>(7), 0);
+}
+
+// reads the values of an image's payload in the order they were written, throwing a std::runtime_error if it runs out
+class ImageReader{
+    public:
+        ImageReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+        template <typename T>
+        T read(){
+            T retval;
+            std::memcpy(&retval, this->take(1, sizeof(T), false), sizeof(T));
+            return retval;
+        }
+        const uint8_t* take(size_t count, size_t elem_size, bool padded = true){
+            if (count > (this->size - this->pos) / elem_size)
+                throw std::runtime_error("truncated image");
+            const uint8_t* retval = this->data + this->pos;
+            this->pos += count * elem_size;
+            if (padded)
+                this->pos = std::min(this->size, (this->pos + 7) & ~static_cast<size_t>(7));
+            return retval;
+        }
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t pos {0};
+};
+
+/* checks an image's header and payload against its checksum, returning its payload, or null if it
+   isn't a complete image. The key it was written with is returned through the header */
+static const uint8_t* check_image(const MappedFile& file, ImageHeader& header){
+    if (file.size() < sizeof(ImageHeader))
+        return nullptr;
+    std::memcpy(&header, file.data(), sizeof(ImageHeader));
+    if (std::memcmp(header.magic, IMAGE_MAGIC, 4) != 0 || header.version != IMAGE_VERSION)
+        return nullptr;
+    const uint8_t* payload = file.data() + sizeof(ImageHeader);
+    if (header.payload_size != file.size() - sizeof(ImageHeader) || hash_bytes(payload, header.payload_size, IMAGE_VERSION) != header.checksum)
+        return nullptr;
+    return payload;
+}
+
+/* replaces the program's contents with a cached image, returning false and leaving the program
+   untouched if the image is missing, was written for another key, or is corrupt */
+bool Program::read_image(const std::string& path, const ImageKey& key){
+    try{
+        MappedFile file(path);
+        ImageHeader header;
+        const uint8_t* payload = check_image(file, header);
+        if (!payload || header.key.vm != key.vm || header.key.source != key.source || header.key.config != key.config)
+            return false;
+        ImageReader reader(payload, header.payload_size);
+        DecodedCode code;
+        uint64_t inst_count = reader.read<uint64_t>();
+        const uint8_t* ops = reader.take(inst_count, sizeof(DecodedOp));
+        const uint8_t* operands = reader.take(inst_count, sizeof(uint64_t));
+        code.ops.resize(inst_count);
+        code.operands.resize(inst_count);
+        std::memcpy(code.ops.data(), ops, inst_count * sizeof(DecodedOp));
+        std::memcpy(code.operands.data(), operands, inst_count * sizeof(uint64_t));
+        // the handlers index the engines' tables, so a bad one must never reach them
+        for (const DecodedOp& op : code.ops){
+            if (op.handler >= HANDLER_COUNT || op.family >= FAMILY_COUNT || op.r1 > 15 || op.r2 > 15)
+                return false;
+        }
+        std::vector<size_t> fusion_counts(reader.read<uint64_t>());
+        for (size_t& count : fusion_counts)
+            count = reader.read<uint64_t>();
+        std::vector<std::string> strings(reader.read<uint64_t>());
+        for (std::string& str : strings){
+            uint64_t length = reader.read<uint64_t>();
+            str.assign(reinterpret_cast<const char*>(reader.take(length, 1)), length);
+        }
+        std::vector<DataLabel> data_labels(reader.read<uint64_t>());
+        for (DataLabel& label : data_labels){
+            label.type = reader.read<uint32_t>();
+            label.str_index = reader.read<uint32_t>();
+            label.size = reader.read<uint64_t>();
+        }
+        std::vector<Symbol> symbols(reader.read<uint64_t>());
+        for (Symbol& symbol : symbols){
+            symbol.kind = reader.read<uint32_t>();
+            uint32_t length = reader.read<uint32_t>();
+            symbol.value = reader.read<uint64_t>();
+            symbol.name.assign(reinterpret_cast<const char*>(reader.take(length, 1)), length);
+        }
+        code.families = this->code.families;
+        this->code = std::move(code);
+        this->fusion_counts = std::move(fusion_counts);
+        this->strings = std::move(strings);
+        this->data_labels = std::move(data_labels);
+        this->symbols = std::move(symbols);
+        return true;
+    }
+    catch (std::exception&){
+        return false;
+    }
+}
+
+/* writes the program to the image cache, to a temporary file that's renamed into place so no other
+   process ever reads a partial image. The cache only saves time, so failing to write it is ignored */
+void Program::write_image(const std::string& path, const ImageKey& key) const{
+    std::vector<uint8_t> payload;
+    write_raw<uint64_t>(payload, this->code.size());
+    write_array(payload, this->code.ops.data(), this->code.size() * sizeof(DecodedOp));
+    write_array(payload, this->code.operands.data(), this->code.size() * sizeof(uint64_t));
+    write_raw<uint64_t>(payload, this->fusion_counts.size());
+    for (size_t count : this->fusion_counts)
+        write_raw<uint64_t>(payload, count);
+    write_raw<uint64_t>(payload, this->strings.size());
+    for (const std::string& str : this->strings){
+        write_raw<uint64_t>(payload, str.size());
+        write_array(payload, str.data(), str.size());
+    }
+    write_raw<uint64_t>(payload, this->data_labels.size());
+    for (const DataLabel& label : this->data_labels){
+        write_raw<uint32_t>(payload, label.type);
+        write_raw<uint32_t>(payload, label.str_index);
+        write_raw<uint64_t>(payload, label.size);
+    }
+    write_raw<uint64_t>(payload, this->symbols.size());
+    for (const Symbol& symbol : this->symbols){
+        write_raw<uint32_t>(payload, symbol.kind);
+        write_raw<uint32_t>(payload, symbol.name.size());
+        write_raw<uint64_t>(payload, symbol.value);
+        write_array(payload, symbol.name.data(), symbol.name.size());
+    }
+    ImageHeader header {};
+    std::memcpy(header.magic, IMAGE_MAGIC, 4);
+    header.version = IMAGE_VERSION;
+    header.key = key;
+    header.payload_size = payload.size();
+    header.checksum = hash_bytes(payload.data(), payload.size(), IMAGE_VERSION);
+    std::error_code err;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), err);
+    // the temporary file is named by the writing thread and the time, so concurrent writers never share one
+    uint64_t writer = std::hash<std::thread::id>()(std::this_thread::get_id()) ^ std::chrono::steady_clock::now().time_since_epoch().count();
+    std::string temp_path = path + "." + to_hex(writer) + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out.good())
+        return;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    out.close();
+    if (out.good())
+        std::filesystem::rename(temp_path, path, err);
+    if (!out.good() || err)
+        std::filesystem::remove(temp_path, err);
+}
+
+// counts the images in the cache directory, and those that can't be used by this build of the VM
+CacheStats image_cache_stats(const std::string& dir){
+    CacheStats stats;
+    stats.dir = dir;
+    std::error_code err;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir, err)){
+        if (!entry.is_regular_file(err) || entry.path().extension() != IMAGE_EXTENSION)
+            continue;
+        stats.entries++;
+        stats.bytes += entry.file_size(err);
+        try{
+            MappedFile file(entry.path().string());
+            ImageHeader header;
+            if (check_image(file, header)){
+                if (header.key.vm != vm_key())
+                    stats.stale++;
+                continue;
+            }
+            // an image written in another layout can't be checked, so it's only known to be stale
+            uint32_t version = IMAGE_VERSION;
+            if (file.size() >= 8 && !std::memcmp(file.data(), IMAGE_MAGIC, 4))
+                std::memcpy(&version, file.data() + 4, sizeof(version));
+            if (version != IMAGE_VERSION)
+                stats.stale++;
+            else
+                stats.corrupt++;
+        }
+        catch (std::exception&){
+            stats.corrupt++;
+        }
+    }
+    return stats;
+}
+
+// removes every image in the cache directory, along with any left half written, returning how many were removed
+size_t clear_image_cache(const std::string& dir, size_t& bytes){
+    size_t removed = 0;
+    bytes = 0;
+    std::error_code err;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir, err)){
+        std::string name = entry.path().filename().string();
+        bool image = entry.path().extension() == IMAGE_EXTENSION;
+        bool temp = entry.path().extension() == ".tmp" && name.find(IMAGE_EXTENSION ".") != std::string::npos;
+        if (!entry.is_regular_file(err) || (!image && !temp))
+            continue;
+        size_t size = entry.file_size(err);
+        if (std::filesystem::remove(entry.path(), err)){
+            removed += image;
+            bytes += size;
+        }
+    }
+    return removed;
+}
@@ -0,0 +1,347 @@
+#include <stdexcept>
+#include <fstream>
+#include <cstring>
+
+#include "../inc/jit.h"
+#include "../inc/machine.h"
+#include "../inc/fusion.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// the signature of a compiled region's entry stub
+typedef uint64_t(*jit_entry)(uint64_t* regs, Jit* jit, uint8_t** entries, uint8_t* target);
+
+// x86-64 condition codes for the conditional branches, in the order of the jump op codes
+static const uint8_t branch_conditions[] = {
+    0x84,   // JEQ: je
+    0x85,   // JNE: jne
+    0x87,   // JGT: ja
+    0x82,   // JLT: jb
+};
+
+// an append-only buffer of machine code, with rel32 jumps patched once every label is placed
+class Emitter{
+    public:
+        Emitter(size_t label_count) : labels(label_count, SIZE_MAX) {}
+        void byte(uint8_t val) {this->buf.push_back(val);}
+        void bytes(std::initializer_list<uint8_t> vals) {this->buf.insert(this->buf.end(), vals);}
+        void imm64(uint64_t val){
+            for (int i = 0; i < 8; i++)
+                this->buf.push_back((val >> (8 * i)) & 0xff);
+        }
+        // loads a guest register into rax (dst = 0) or rcx (dst = 1)
+        void load_reg(uint8_t dst, uint8_t reg) {this->bytes({0x48, 0x8b, (uint8_t)(0x43 | (dst << 3)), (uint8_t)(reg * 8)});}
+        // stores rax into a guest register
+        void store_reg(uint8_t reg) {this->bytes({0x48, 0x89, 0x43, (uint8_t)(reg * 8)});}
+        // loads a 64 bit value into rax (dst = 0), rcx (dst = 1), rdx (dst = 2) or rsi (dst = 6)
+        void load_imm(uint8_t dst, uint64_t val){
+            this->bytes({0x48, (uint8_t)(0xb8 + dst)});
+            this->imm64(val);
+        }
+        // emits a jump (or conditional jump) to a label that may not have been placed yet
+        void jump(size_t label, uint8_t condition = 0){
+            if (condition)
+                this->bytes({0x0f, condition});
+            else
+                this->byte(0xe9);
+            this->fixups.push_back({this->buf.size(), label});
+            this->bytes({0, 0, 0, 0});
+        }
+        void place(size_t label){
+            if (label >= this->labels.size())
+                this->labels.resize(label + 1, SIZE_MAX);
+            this->labels[label] = this->buf.size();
+        }
+        size_t new_label(){
+            this->labels.push_back(SIZE_MAX);
+            return this->labels.size() - 1;
+        }
+        size_t offset(size_t label) {return this->labels[label];}
+        size_t size() {return this->buf.size();}
+        void patch(){
+            for (auto& fixup : this->fixups){
+                int32_t rel = this->labels[fixup.second] - (fixup.first + 4);
+                std::memcpy(&this->buf[fixup.first], &rel, 4);
+            }
+        }
+        std::vector<uint8_t> buf;
+    private:
+        std::vector<size_t> labels;
+        std::vector<std::pair<size_t, size_t> > fixups;
+};
+
+Jit::Jit(Machine* machine){
+    this->machine = machine;
+}
+
+Jit::~Jit(){
+    for (JitRegion* region : this->regions){
+#ifdef JIT_SUPPORTED
+        munmap(region->code, region->code_size);
+#endif
+        delete region;
+    }
+}
+
+// returns true if the host can run compiled code
+bool Jit::supported(){
+#ifdef JIT_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* runs an instruction the compiler doesn't handle through its family function, and returns the
+   index of the next instruction. Exceptions can't unwind through compiled code, so they are held
+   until the region exits, which is forced by returning an index outside of the program */
+uint64_t Jit::exec_fallback(Jit* jit, uint64_t pc){
+    Machine* machine = jit->machine;
+    try{
+        const DecodedCode& code = machine->program->get_code();
+        const DecodedOp& op = code.ops[pc];
+        exec_func family_func = code.families[op.family];
+        if (family_func == nullptr)
+            throw std::runtime_error("malformed binary (invalid operation)");
+        machine->registers[PROGRAM_COUNTER] = pc;
+        family_func(machine, op.op_code, op.immediate, (op.r1 << 4) | op.r2, code.operands[pc]);
+        // leave native code if the machine was suspended, like for an error
+        if (machine->suspended)
+            return UINT64_MAX;
+        return machine->registers[PROGRAM_COUNTER] + 1;
+    }
+    catch (...){
+        jit->pending = std::current_exception();
+        return UINT64_MAX;
+    }
+}
+
+// compiles the instructions in [start, end) to native code
+const JitRegion& Jit::compile(size_t start, size_t end){
+#ifndef JIT_SUPPORTED
+    throw std::runtime_error("the jit compiler is not supported on this host");
+#else
+    const DecodedCode& code = this->machine->program->get_code();
+    size_t count = code.size();
+    size_t length = end - start;
+    // labels [0, length] belong to the instructions, the last one being the end of the region
+    Emitter emit(length + 1);
+    size_t exit_label = emit.new_label();
+    size_t dispatch_label = emit.new_label();
+    std::vector<std::pair<size_t, uint64_t> > exit_stubs;
+    std::vector<size_t> leaders{start};
+    // returns the label to jump to for a target index, leaving the region if it's outside of it
+    auto target_label = [&](uint64_t target){
+        if (target >= start && target < end){
+            leaders.push_back(target);
+            return (size_t) (target - start);
+        }
+        size_t label = emit.new_label();
+        exit_stubs.push_back({label, target});
+        return label;
+    };
+
+    // entry: push rbx, r12, r13, pin the registers, the jit and the entry table, then jump to the target
+    emit.bytes({0x53, 0x41, 0x54, 0x41, 0x55});
+    emit.bytes({0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4, 0x49, 0x89, 0xd5, 0xff, 0xe1});
+    // exit: returns the index in rax
+    emit.place(exit_label);
+    emit.bytes({0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+    // dispatch: jumps to the index in rax through the entry table, or exits if it's outside of the region
+    emit.place(dispatch_label);
+    emit.bytes({0x48, 0x89, 0xc1});
+    emit.load_imm(2, start);
+    emit.bytes({0x48, 0x29, 0xd1});
+    emit.load_imm(2, length);
+    emit.bytes({0x48, 0x39, 0xd1});
+    emit.jump(exit_label, 0x83);
+    emit.bytes({0x41, 0xff, 0x64, 0xcd, 0x00});
+
+    for (size_t pc = start; pc < end; pc++){
+        emit.place(pc - start);
+        const DecodedOp& op = code.ops[pc];
+        uint64_t operand = code.operands[pc];
+        // superinstructions compile as their first instruction, the second is compiled in its own slot
+        uint8_t handler = unfused_handler(op.handler);
+        if (handler >= H_ADD && handler <= H_SLI){
+            bool immediate = (handler - H_ADD) % 2;
+            uint8_t op_code = ADD + (handler - H_ADD) / 2;
+            emit.load_reg(0, op.r2);
+            if (immediate)
+                emit.load_imm(1, operand);
+            else
+                emit.load_reg(1, operand);
+            switch (op_code){
+                case ADD:
+                    emit.bytes({0x48, 0x01, 0xc8});
+                    break;
+                case SUB:
+                    emit.bytes({0x48, 0x29, 0xc8});
+                    break;
+                case MUL:
+                    emit.bytes({0x48, 0x0f, 0xaf, 0xc1});
+                    break;
+                case DIV:
+                case REM:
+                    // xor edx, edx; div rcx, the remainder is left in rdx
+                    emit.bytes({0x31, 0xd2, 0x48, 0xf7, 0xf1});
+                    if (op_code == REM)
+                        emit.bytes({0x48, 0x89, 0xd0});
+                    break;
+                case COMP:
+                    // cmp rax, rcx; sete al; movzx eax, al
+                    emit.bytes({0x48, 0x39, 0xc8, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0});
+                    break;
+                case AND:
+                    emit.bytes({0x48, 0x21, 0xc8});
+                    break;
+                case OR:
+                    emit.bytes({0x48, 0x09, 0xc8});
+                    break;
+                case XOR:
+                    emit.bytes({0x48, 0x31, 0xc8});
+                    break;
+                case SR:
+                    emit.bytes({0x48, 0xd3, 0xe8});
+                    break;
+                case SL:
+                    emit.bytes({0x48, 0xd3, 0xe0});
+                    break;
+            }
+            emit.store_reg(op.r1);
+            continue;
+        }
+        switch (handler){
+            case H_COPY:
+                emit.load_reg(0, op.r2);
+                emit.store_reg(op.r1);
+                break;
+            case H_LOADI:
+                emit.load_imm(0, operand);
+                emit.store_reg(op.r2);
+                break;
+            case H_JUMP:
+                emit.jump(target_label(operand));
+                leaders.push_back(pc + 1);
+                break;
+            case H_JEQ:
+            case H_JNE:
+            case H_JGT:
+            case H_JLT:
+                // mov rax, r1; cmp rax, r2
+                emit.load_reg(0, op.r1);
+                emit.bytes({0x48, 0x3b, 0x43, (uint8_t)(op.r2 * 8)});
+                emit.jump(target_label(operand), branch_conditions[handler - H_JEQ]);
+                leaders.push_back(pc + 1);
+                break;
+            case H_CAL:
+                emit.load_imm(0, pc);
+                emit.store_reg(RET_ADDR);
+                emit.jump(target_label(operand));
+                leaders.push_back(pc + 1);
+                break;
+            case H_RET:
+                // rax = r6 + 1, r6 = the instruction count, then jump to rax
+                emit.load_reg(0, RET_ADDR);
+                emit.bytes({0x48, 0x83, 0xc0, 0x01});
+                emit.load_imm(1, count);
+                emit.bytes({0x48, 0x89, 0x4b, RET_ADDR * 8});
+                emit.jump(dispatch_label);
+                leaders.push_back(pc + 1);
+                break;
+            default:
+                // mov rdi, r12; call exec_fallback(jit, pc), then continue unless control was transferred
+                emit.bytes({0x4c, 0x89, 0xe7});
+                emit.load_imm(6, pc);
+                emit.load_imm(0, reinterpret_cast<uint64_t>(&Jit::exec_fallback));
+                emit.bytes({0xff, 0xd0});
+                emit.load_imm(1, pc + 1);
+                emit.bytes({0x48, 0x39, 0xc8});
+                emit.jump(dispatch_label, 0x85);
+                leaders.push_back(pc + 1);
+                break;
+        }
+    }
+    // falling off the end of the region exits at the next index
+    emit.place(length);
+    emit.load_imm(0, end);
+    emit.jump(exit_label);
+    for (auto& stub : exit_stubs){
+        emit.place(stub.first);
+        emit.load_imm(0, stub.second);
+        emit.jump(exit_label);
+    }
+    emit.patch();
+
+    // copy the code to executable memory
+    JitRegion* region = new JitRegion;
+    region->start = start;
+    region->end = end;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    region->code_size = (emit.size() + page_size - 1) / page_size * page_size;
+    void* mem = mmap(nullptr, region->code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED){
+        delete region;
+        throw std::runtime_error("failed to allocate memory for compiled code");
+    }
+    region->code = static_cast<uint8_t*>(mem);
+    std::memcpy(region->code, emit.buf.data(), emit.size());
+    mprotect(region->code, region->code_size, PROT_READ | PROT_EXEC);
+    std::vector<size_t> offsets(length + 1);
+    region->entries.resize(length);
+    for (size_t i = 0; i <= length; i++){
+        offsets[i] = emit.offset(i);
+        if (i < length)
+            region->entries[i] = region->code + offsets[i];
+    }
+    this->regions.push_back(region);
+    this->compiled_bytes += emit.size();
+    this->write_perf_map(*region, offsets, leaders);
+    return *region;
+#endif
+}
+
+// runs compiled code from the given index until it leaves the region, returning the index it left at
+uint64_t Jit::run(const JitRegion& region, uint64_t pc){
+#ifdef JIT_SUPPORTED
+    jit_entry entry = reinterpret_cast<jit_entry>(region.code);
+    JitRegion& entered = const_cast<JitRegion&>(region);
+    pc = entry(this->machine->registers.data(), this, entered.entries.data(), entered.entries[pc - region.start]);
+    if (this->pending){
+        std::exception_ptr err = this->pending;
+        this->pending = nullptr;
+        std::rethrow_exception(err);
+    }
+    // a suspended machine resumes at the instruction it stopped at
+    if (this->machine->suspended)
+        pc = this->machine->registers[PROGRAM_COUNTER];
+#endif
+    return pc;
+}
+
+// records a symbol for each basic block in the region, so perf can attribute samples to the program
+void Jit::write_perf_map(const JitRegion& region, const std::vector<size_t>& offsets, const std::vector<size_t>& leaders){
+    std::vector<bool> is_leader(offsets.size(), false);
+    for (size_t leader : leaders){
+        if (leader >= region.start && leader < region.end)
+            is_leader[leader - region.start] = true;
+    }
+    std::ofstream map("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+    if (!map.good())
+        return;
+    map << std::hex;
+    // the entry, exit and dispatch stubs come before the first instruction
+    map << reinterpret_cast<uint64_t>(region.code) << " " << offsets[0] << " tcode_stubs_" << std::dec << region.start << std::hex << "\n";
+    size_t block_start = 0;
+    for (size_t i = 1; i < offsets.size(); i++){
+        if (i != offsets.size() - 1 && !is_leader[i])
+            continue;
+        map << reinterpret_cast<uint64_t>(region.code + offsets[block_start]) << " " << offsets[i] - offsets[block_start];
+        map << std::dec << " tcode_block_" << region.start + block_start << "_" << region.start + i - 1 << std::hex << "\n";
+        block_start = i;
+    }
+}
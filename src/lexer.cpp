@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cstring>
+
+#include "../inc/lexer.h"
+
+// the characters between tokens
+static inline bool is_separator(char chr){
+    return chr == ' ' || chr == '\t' || chr == ',' || chr == '\r' || chr == '\v' || chr == '\f';
+}
+
+/* reads the tokens of the next line that has any into the given vector, which is reused so lines
+   don't allocate once it's grown, returning false once the source has run out */
+bool Lexer::next(Tokens& tokens){
+    const char* data = this->source.data();
+    size_t size = this->source.size();
+    while (this->pos < size){
+        const char* newline = static_cast<const char*>(std::memchr(data + this->pos, '\n', size - this->pos));
+        size_t end = newline ? newline - data : size;
+        std::string_view line(data + this->pos, end - this->pos);
+        this->pos = newline ? end + 1 : size;
+        this->line_no++;
+        tokenize(line, tokens);
+        if (!tokens.empty())
+            return true;
+    }
+    return false;
+}
+
+// splits a single line into its tokens, leaving out any comment
+void tokenize(std::string_view line, Tokens& tokens){
+    tokens.clear();
+    size_t pos = 0, size = line.size();
+    while (true){
+        while (pos < size && is_separator(line[pos]))
+            pos++;
+        if (pos == size || line[pos] == COMMENT_CHAR)
+            return;
+        size_t start = pos;
+        if (line[pos] == '"'){
+            // a string literal runs to its closing quote, skipping any escaped character, or to the end of the line if it isn't closed
+            pos++;
+            while (pos < size && line[pos] != '"')
+                pos += (line[pos] == '\\') ? 2 : 1;
+            pos = (pos < size) ? pos + 1 : size;
+        }
+        else{
+            while (pos < size && !is_separator(line[pos]) && line[pos] != COMMENT_CHAR)
+                pos++;
+        }
+        tokens.push_back(line.substr(start, pos - start));
+    }
+}
+
+/* splits the source into at most the given number of pieces of roughly equal size, each ending
+   just after a newline so no line is split between two pieces */
+std::vector<std::string_view> split_lines(std::string_view source, size_t count){
+    std::vector<std::string_view> pieces;
+    size_t start = 0, size = source.size();
+    for (size_t i = 1; i < count && start < size; i++){
+        size_t end = std::max(start, size * i / count);
+        end = source.find('\n', end);
+        if (end == std::string_view::npos)
+            break;
+        pieces.push_back(source.substr(start, end + 1 - start));
+        start = end + 1;
+    }
+    if (start < size || pieces.empty())
+        pieces.push_back(source.substr(start));
+    return pieces;
+}
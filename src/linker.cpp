@@ -0,0 +1,317 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#include "../inc/linker.h"
+#include "../inc/mapped_file.h"
+
+// returns true if an instruction allocates a data label, which the linker moves to the start of the program
+static bool is_alloc(const Instruction& inst){
+    uint8_t op = inst.op_code >> 1;
+    return op == ALLOC_MEM || op == ALLOC_STR;
+}
+
+// returns the name of an object file without its directory or extension, to qualify its local labels
+static std::string object_stem(const std::string& path){
+    size_t start = path.find_last_of('/');
+    start = (start == std::string::npos) ? 0 : start + 1;
+    size_t end = path.find_last_of('.');
+    if (end == std::string::npos || end < start)
+        end = path.size();
+    return path.substr(start, end - start);
+}
+
+// reads an object file, checking every relocation refers to something in the object
+void Linker::add_object(const std::string& path){
+    MappedFile file(path);
+    // objects are always version 2 files, so anything else is read no further
+    bool is_v2 = file.size() >= 4 && std::memcmp(file.data(), TCODE_MAGIC, 4) == 0;
+    TcodeView view;
+    if (is_v2)
+        view = parse_tcode(file.data(), file.size());
+    if (!(view.flags & TCODE_OBJECT_FLAG))
+        throw std::runtime_error(path + " is not an object file, build it with 'tvm build -c'");
+    LinkObject object;
+    object.name = path;
+    object.code.reserve(view.inst_count);
+    for (size_t i = 0; i < view.inst_count; i++)
+        object.code.push_back(view.instruction(i));
+    object.strings = std::move(view.strings);
+    object.data_labels = std::move(view.data_labels);
+    object.symbols = std::move(view.object_symbols);
+    object.relocations = std::move(view.relocations);
+    for (const ObjectSymbol& symbol : object.symbols){
+        if (!(symbol.flags & SYMBOL_DEFINED))
+            continue;
+        if ((symbol.kind == PROGRAM_SYMBOL && symbol.value > object.code.size()) || (symbol.kind == DATA_SYMBOL && symbol.value >= object.data_labels.size()))
+            throw std::runtime_error("malformed object file (invalid symbol): " + path);
+    }
+    object.reloc_at.assign(object.code.size(), -1);
+    for (size_t i = 0; i < object.relocations.size(); i++){
+        const Relocation& reloc = object.relocations[i];
+        bool valid = reloc.inst < object.code.size();
+        if (reloc.kind == STRING_RELOC)
+            valid = valid && reloc.target < object.strings.size();
+        else{
+            uint32_t kind = (reloc.kind == LABEL_RELOC) ? PROGRAM_SYMBOL : DATA_SYMBOL;
+            valid = valid && reloc.kind <= DATA_RELOC && reloc.target < object.symbols.size() && object.symbols[reloc.target].kind == kind;
+        }
+        if (!valid)
+            throw std::runtime_error("malformed object file (invalid relocation): " + path);
+        object.reloc_at[reloc.inst] = i;
+    }
+    // each data label is allocated by an instruction, and each string copied by one has a relocation
+    size_t allocs = 0;
+    for (size_t i = 0; i < object.code.size(); i++){
+        if (!is_alloc(object.code[i]))
+            continue;
+        allocs++;
+        if ((object.code[i].op_code >> 1) == ALLOC_STR && (object.reloc_at[i] < 0 || object.relocations[object.reloc_at[i]].kind != STRING_RELOC))
+            throw std::runtime_error("malformed object file (invalid string): " + path);
+    }
+    if (allocs != object.data_labels.size())
+        throw std::runtime_error("malformed object file (mismatched data labels): " + path);
+    this->objects.push_back(std::move(object));
+}
+
+// finds the definition of every symbol, from the object itself or another object's global labels
+void Linker::resolve_symbols(){
+    std::unordered_map<std::string, std::pair<size_t, size_t> > globals;
+    for (size_t i = 0; i < this->objects.size(); i++){
+        const std::vector<ObjectSymbol>& symbols = this->objects[i].symbols;
+        for (size_t j = 0; j < symbols.size(); j++){
+            if (!(symbols[j].flags & SYMBOL_GLOBAL))
+                continue;
+            auto itt = globals.find(symbols[j].name);
+            if (itt != globals.end())
+                throw std::runtime_error("duplicate global label: " + symbols[j].name + ", declared in " + this->objects[itt->second.first].name + " and " + this->objects[i].name);
+            globals[symbols[j].name] = {i, j};
+        }
+    }
+    for (size_t i = 0; i < this->objects.size(); i++){
+        LinkObject& object = this->objects[i];
+        object.resolved.resize(object.symbols.size());
+        for (size_t j = 0; j < object.symbols.size(); j++){
+            const ObjectSymbol& symbol = object.symbols[j];
+            if (symbol.flags & SYMBOL_DEFINED){
+                object.resolved[j] = {i, j};
+                continue;
+            }
+            auto itt = globals.find(symbol.name);
+            if (itt == globals.end())
+                throw std::runtime_error("undefined label: " + symbol.name + ", used in " + object.name);
+            const ObjectSymbol& definition = this->objects[itt->second.first].symbols[itt->second.second];
+            if (definition.kind != symbol.kind){
+                const char* kind = (symbol.kind == PROGRAM_SYMBOL) ? "program" : "data";
+                throw std::runtime_error(symbol.name + " is used as a " + kind + " label in " + object.name + ", but isn't one in " + this->objects[itt->second.first].name);
+            }
+            object.resolved[j] = itt->second;
+        }
+    }
+}
+
+// returns the region holding the instruction at a position
+size_t Linker::region_of(const LinkObject& object, size_t pos) const{
+    return std::upper_bound(object.regions.begin(), object.regions.end(), pos) - object.regions.begin() - 1;
+}
+
+// returns true if running off the end of a region runs into the next one, rather than jumping or returning
+bool Linker::falls_through(const LinkObject& object, size_t region) const{
+    size_t start = object.regions[region];
+    size_t end = (region + 1 < object.regions.size()) ? object.regions[region + 1] : object.code.size();
+    for (size_t i = end; i > start; i--){
+        const Instruction& inst = object.code[i - 1];
+        if (is_alloc(inst))
+            continue;
+        uint8_t op = inst.op_code >> 1;
+        return op != JUMP && op != RET;
+    }
+    return true;
+}
+
+// marks the region holding a position as live, a label at the very end of an object labels the end of the program
+void Linker::mark_region(std::vector<std::pair<size_t, size_t> >& pending, size_t obj, size_t pos){
+    LinkObject& object = this->objects[obj];
+    if (pos >= object.code.size())
+        return;
+    size_t region = this->region_of(object, pos);
+    if (!object.live_regions[region]){
+        object.live_regions[region] = true;
+        pending.push_back({obj, region});
+    }
+}
+
+// splits each object into regions at its labels, then marks the code and data reachable from the entry point
+void Linker::mark_live(){
+    for (LinkObject& object : this->objects){
+        object.regions.push_back(0);
+        for (const ObjectSymbol& symbol : object.symbols){
+            if (symbol.kind == PROGRAM_SYMBOL && (symbol.flags & SYMBOL_DEFINED) && symbol.value < object.code.size())
+                object.regions.push_back(symbol.value);
+        }
+        std::sort(object.regions.begin(), object.regions.end());
+        object.regions.erase(std::unique(object.regions.begin(), object.regions.end()), object.regions.end());
+        object.live_regions.assign(object.regions.size(), !this->gc);
+        object.live_data.assign(object.data_labels.size(), !this->gc);
+    }
+    if (!this->gc || this->objects.empty())
+        return;
+    std::vector<std::pair<size_t, size_t> > pending;
+    this->mark_region(pending, 0, 0);
+    while (!pending.empty()){
+        size_t obj = pending.back().first;
+        size_t region = pending.back().second;
+        pending.pop_back();
+        LinkObject& object = this->objects[obj];
+        size_t start = object.regions[region];
+        size_t end = (region + 1 < object.regions.size()) ? object.regions[region + 1] : object.code.size();
+        for (size_t i = start; i < end; i++){
+            if (object.reloc_at[i] < 0)
+                continue;
+            const Relocation& reloc = object.relocations[object.reloc_at[i]];
+            if (reloc.kind == STRING_RELOC)
+                continue;
+            std::pair<size_t, size_t> target = object.resolved[reloc.target];
+            const ObjectSymbol& symbol = this->objects[target.first].symbols[target.second];
+            if (reloc.kind == LABEL_RELOC)
+                this->mark_region(pending, target.first, symbol.value);
+            else
+                this->objects[target.first].live_data[symbol.value] = true;
+        }
+        if (region + 1 < object.regions.size() && this->falls_through(object, region))
+            this->mark_region(pending, obj, object.regions[region + 1]);
+    }
+}
+
+/* links the objects into a program and writes it. The data labels are allocated first, in the
+   order of the objects, then each object's live code follows in order. An object whose code
+   runs off its end jumps to the end of the program, exiting as it would have on its own */
+LinkStats Linker::link(const std::string& out_path){
+    LinkStats stats;
+    stats.objects = this->objects.size();
+    this->resolve_symbols();
+    this->mark_live();
+    TcodeImage image;
+    std::unordered_map<std::string, size_t> string_ids;
+    size_t data_count = 0;
+    // allocate the live data labels, giving each distinct string a single entry
+    for (LinkObject& object : this->objects){
+        object.data_indices.assign(object.data_labels.size(), 0);
+        size_t data = 0;
+        for (size_t i = 0; i < object.code.size(); i++){
+            if (!is_alloc(object.code[i]))
+                continue;
+            size_t index = data++;
+            stats.removed_data_labels += !object.live_data[index];
+            if (!object.live_data[index])
+                continue;
+            Instruction inst = object.code[i];
+            DataLabel label = object.data_labels[index];
+            if ((inst.op_code >> 1) == ALLOC_STR){
+                const std::string& str = object.strings[object.relocations[object.reloc_at[i]].target];
+                auto itt = string_ids.find(str);
+                if (itt == string_ids.end()){
+                    itt = string_ids.insert({str, image.strings.size()}).first;
+                    image.strings.push_back(str);
+                }
+                else
+                    stats.merged_strings++;
+                inst.extend = itt->second;
+                label.str_index = itt->second;
+            }
+            image.instructions.push_back(inst);
+            image.data_labels.push_back(label);
+            object.data_indices[index] = ++data_count;
+        }
+    }
+    // lay out the live code, leaving a jump to the end of the program after any object that runs off its end
+    // each instruction placed, as its object and position in the object, and its index in the program
+    std::vector<std::pair<size_t, size_t> > placed;
+    std::vector<size_t> placed_at;
+    std::vector<size_t> exits;
+    bool exit_pending = false;
+    for (size_t obj = 0; obj < this->objects.size(); obj++){
+        LinkObject& object = this->objects[obj];
+        object.region_starts.assign(object.regions.size(), 0);
+        for (size_t region = 0; region < object.regions.size(); region++){
+            size_t start = object.regions[region];
+            size_t end = (region + 1 < object.regions.size()) ? object.regions[region + 1] : object.code.size();
+            if (!object.live_regions[region]){
+                for (size_t i = start; i < end; i++)
+                    stats.removed_instructions += !is_alloc(object.code[i]);
+                continue;
+            }
+            if (exit_pending && start < end){
+                exits.push_back(image.instructions.size());
+                image.instructions.push_back(Instruction());
+                exit_pending = false;
+            }
+            object.region_starts[region] = image.instructions.size();
+            for (size_t i = start; i < end; i++){
+                if (is_alloc(object.code[i]))
+                    continue;
+                placed.push_back({obj, i});
+                placed_at.push_back(image.instructions.size());
+                image.instructions.push_back(object.code[i]);
+            }
+            if (region + 1 == object.regions.size() && this->falls_through(object, region))
+                exit_pending = true;
+        }
+    }
+    size_t end = image.instructions.size();
+    // program labels are stored as the index before the labelled instruction
+    auto label_index = [&](size_t obj, size_t pos){
+        const LinkObject& object = this->objects[obj];
+        if (pos >= object.code.size())
+            return end;
+        return object.region_starts[this->region_of(object, pos)];
+    };
+    for (size_t i = 0; i < placed.size(); i++){
+        const LinkObject& object = this->objects[placed[i].first];
+        int64_t reloc_id = object.reloc_at[placed[i].second];
+        if (reloc_id < 0)
+            continue;
+        const Relocation& reloc = object.relocations[reloc_id];
+        std::pair<size_t, size_t> target = object.resolved[reloc.target];
+        const ObjectSymbol& symbol = this->objects[target.first].symbols[target.second];
+        Instruction& inst = image.instructions[placed_at[i]];
+        if (reloc.kind == LABEL_RELOC)
+            inst.extend = label_index(target.first, symbol.value) - 1;
+        else
+            inst.extend = this->objects[target.first].data_indices[symbol.value];
+    }
+    for (size_t exit : exits){
+        image.instructions[exit].op_code = JUMP << 1;
+        image.instructions[exit].registers = 0;
+        image.instructions[exit].extend = end - 1;
+    }
+    // the entry object's labels and global labels keep their names, any other label is qualified with its object's name
+    if (this->debug_info){
+        for (size_t obj = 0; obj < this->objects.size(); obj++){
+            const LinkObject& object = this->objects[obj];
+            for (const ObjectSymbol& symbol : object.symbols){
+                if (!(symbol.flags & SYMBOL_DEFINED))
+                    continue;
+                std::string name = (obj == 0 || (symbol.flags & SYMBOL_GLOBAL)) ? symbol.name : object_stem(object.name) + ":" + symbol.name;
+                if (symbol.kind == DATA_SYMBOL && object.live_data[symbol.value])
+                    image.symbols.push_back({DATA_SYMBOL, object.data_indices[symbol.value], name});
+                else if (symbol.kind == PROGRAM_SYMBOL && (symbol.value >= object.code.size() || object.live_regions[this->region_of(object, symbol.value)]))
+                    image.symbols.push_back({PROGRAM_SYMBOL, label_index(obj, symbol.value), name});
+            }
+        }
+        std::sort(image.symbols.begin(), image.symbols.end(), [](const Symbol& a, const Symbol& b){
+            return (a.kind != b.kind) ? a.kind < b.kind : a.value < b.value;
+        });
+    }
+    std::ofstream out(out_path, std::ios::binary);
+    if (!out.good())
+        throw std::runtime_error("Error: failed to write the output file");
+    write_tcode(out, image, this->format);
+    out.close();
+    stats.instructions = image.instructions.size();
+    stats.data_labels = image.data_labels.size();
+    stats.strings = image.strings.size();
+    return stats;
+}
@@ -1,53 +1,15 @@
 #include <stdio.h>
 #include <iostream>
 #include <stdexcept>
-#include <fstream>
 #include <cstring>
+#include <chrono>
 #include <unordered_map>
-#include <iostream>
+#include <atomic>
+#include <unistd.h>
 
 #include "../inc/instruction.h"
 #include "../inc/machine.h"
-
-void exec_mem(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-void exec_logic(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-void exec_jump(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-void exec_stack(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-void exec_io(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-void exec_heap(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend);
-
-// reads a string literal wrapped in quotations from a file
-std::string read_str(std::ifstream& file){
-    std::unordered_map<char, char> escapes{
-        {'n', '\n'},
-        {'t', '\t'},
-        {'b', '\b'},
-        {'v', '\v'},
-        {'f', '\f'},
-        {'r', '\r'}
-    };
-    std::string retval;
-    std::string str;
-    char curr_char;
-    while (true){
-        file >> std::noskipws >> curr_char;
-        if (curr_char == '"')
-            break;
-        else if (curr_char == '\\'){
-            file >> std::noskipws >> curr_char;
-            if (file.eof())
-                throw std::runtime_error("malformed binary (invalid string)");
-            if (escapes.count(curr_char))
-                curr_char = escapes[curr_char];
-        }
-        retval.push_back(curr_char);
-    }
-    if (curr_char != '"')
-        throw std::runtime_error("malformed binary (invalid string)");
-    return retval;   
-}
-
-
+#include "../inc/fusion.h"
 
 // splits a merged register into two seperate values
 void Machine::split_registers(uint8_t registers, uint8_t& r1, uint8_t& r2){
@@ -57,7 +19,11 @@ void Machine::split_registers(uint8_t registers, uint8_t& r1, uint8_t& r2){
 }
 
 Machine::Machine(bool init_default){
+    this->output.reset(new OutputBuffer(STDOUT_FILENO));
+    this->heap.reset(new Heap());
+    this->memory.reset(new GuestMemory());
     this->registers.fill(0);
+    this->tier_stats.threshold = DEFAULT_TIER_THRESHOLD;
     if (init_default){
         this->add_extension(0x00, exec_mem);
         this->add_extension(0x10, exec_logic);
@@ -65,13 +31,59 @@ Machine::Machine(bool init_default){
         this->add_extension(0x30, exec_stack);
         this->add_extension(0x40, exec_io);
         this->add_extension(0x50, exec_heap);
+        this->add_extension(0x70, exec_thread);
     }
 }
 
+// creates a machine to run an already loaded program
+Machine::Machine(std::shared_ptr<const Program> program){
+    this->output.reset(new OutputBuffer(STDOUT_FILENO));
+    this->heap.reset(new Heap());
+    this->memory.reset(new GuestMemory());
+    this->registers.fill(0);
+    this->tier_stats.threshold = DEFAULT_TIER_THRESHOLD;
+    this->reset(program);
+}
+
+// forks a machine from a snapshot, mapping the snapshot's memory copy-on-write
+Machine::Machine(const Snapshot& snapshot) : registers(snapshot.registers), vectors(snapshot.vectors), labels(snapshot.labels), program(snapshot.program),
+    stack(snapshot.stack_size), heap(new Heap(snapshot.heap)), engine(snapshot.engine){
+    this->output.reset(new OutputBuffer(STDOUT_FILENO));
+    this->memory.reset(new GuestMemory(*snapshot.memory));
+    this->tier_stats.threshold = snapshot.tier_threshold;
+    for (uint64_t val : snapshot.stack)
+        this->stack.push(val);
+}
+
+// creates a machine to run a guest thread from the given instruction, sharing its parent's program, memory and heap
+Machine::Machine(Machine& parent, size_t start) : labels(parent.labels), program(parent.program), stack(parent.stack.capacity() * sizeof(uint64_t)),
+    heap(parent.heap), memory(parent.memory), threads(parent.threads), guest_thread(true), input(parent.input), output(parent.output),
+    async_input(parent.async_input), engine(parent.engine), count_instructions(parent.count_instructions){
+    this->registers.fill(0);
+    // the arguments are passed the same way as to a function
+    for (size_t reg = ARG_1; reg <= ARG_4; reg++)
+        this->registers[reg] = parent.registers[reg];
+    this->registers[PROGRAM_COUNTER] = start;
+    // returning from the function ends the thread
+    this->registers[RET_ADDR] = this->program->size() + 1;
+    this->tier_stats.threshold = parent.tier_stats.threshold;
+}
+
+// waits for any guest threads that are still running, since they share the machine's memory
 Machine::~Machine(){
-    size_t label_count = this->labels.size(); 
-    for (int i = 0; i < label_count; i++)
-        delete this->labels[i];
+    if (this->guest_thread || !this->threads)
+        return;
+    try{
+        this->join_threads();
+    }
+    catch (...){
+    }
+}
+
+// sets the streams the program reads its input from and writes its output to
+void Machine::set_streams(std::istream* input, std::ostream* output){
+    this->input = input;
+    this->output.reset(new OutputBuffer(output));
 }
 
 // sets the value of the given register
@@ -85,24 +97,17 @@ uint64_t Machine::get_register(size_t reg_no){
 }
 
 // adds a label to the machine
-void Machine::add_label(uint8_t* ptr){
-    this->labels.push_back(ptr);
+void Machine::add_label(uint64_t addr){
+    this->labels.push_back(addr);
 }
 
-// returns the pointer of a label at the given index
-uint8_t* Machine::get_label(size_t index){
+// returns the guest address of a label at the given index
+uint64_t Machine::get_label(size_t index){
     if (index >= this->labels.size())
         throw std::runtime_error("invalid label");
     return this->labels[index];
 }
 
-// returns the program string at a given index
-std::string Machine::get_str(size_t index){
-    if (index >= this->prog_strings.size())
-        throw std::runtime_error("invalid string index");
-    return this->prog_strings[index];
-}
-
 // adds an extension and associates it with an operation family
 void Machine::add_extension(uint8_t op_family, void(*op)(Machine*, uint8_t, bool, uint8_t, uint64_t)){
     // check if the operation family is already implemented by another extension
@@ -114,46 +119,241 @@ void Machine::add_extension(uint8_t op_family, void(*op)(Machine*, uint8_t, bool
     this->instruction_map[op_family] = op;
 }
 
-// reads all the instructions from a bytecode file
-void Machine::read_file(const std::string& file_path){
-    std::ifstream file(file_path);
-    file >> std::noskipws;
-    if (!file.good())
-        throw std::runtime_error("failed to read the binary");
-    char curr_char;
-    file.get(curr_char);
-    while (curr_char != 0x0 && !file.eof()){
-        std::string tmp = read_str(file);
-        this->prog_strings.push_back(tmp);
-        file.get(curr_char);
-    }
-    // read each instruction
-    std::array<uint8_t, 10> inst_bytes;
-    Instruction inst;
-    while (!file.eof()){
-        file.read(reinterpret_cast<char*>(&inst_bytes[0]), 10);
-        if (file.eof())
-            break;
-        inst = Instruction::from_bytes(inst_bytes);
-        this->instructions.push_back(inst);
-        this->instruction_count++;
-    }
+// returns the program the machine is running
+const Program& Machine::get_program(){
+    if (!this->program)
+        throw std::runtime_error("no program has been loaded");
+    return *this->program;
+}
+
+// starts running a program from its first instruction
+void Machine::reset(std::shared_ptr<const Program> program){
+    this->program = program;
+    this->registers[PROGRAM_COUNTER] = 0;
     // set the return value to exit the program if called outside of a function
-    this->registers[RET_ADDR] = this->instruction_count + 1;
+    this->registers[RET_ADDR] = program->size() + 1;
 }
 
 // reads all instructions from a tcode file and runs the program
 void Machine::exec_file(const std::string& file_path){
-    this->read_file(file_path);
-    // keep executing the program until we run out of instructions
-    while (this->registers[PROGRAM_COUNTER] < this->instruction_count)
-        this->exec_next();
+    this->load_file(file_path);
+    this->exec();
+}
+
+// reads and decodes a tcode file against the machine's extensions without running it
+void Machine::load_file(const std::string& file_path){
+    this->reset(Program::load(file_path, this->instruction_map, this->fusion_enabled, this->cache_enabled, this->verify_mode));
+}
+
+// runs the loaded program from the current program counter until it exits, then waits for the threads it spawned
+void Machine::exec(){
+    this->get_program();
+    try{
+        try{
+            this->exec_guarded(&Machine::exec_engine);
+        }
+        catch (...){
+            if (this->threads){
+                try{
+                    this->join_threads();
+                }
+                catch (...){
+                }
+            }
+            throw;
+        }
+        if (this->threads)
+            this->join_threads();
+    }
+    catch (...){
+        this->output->flush();
+        throw;
+    }
+    this->output->flush();
+}
+
+/* runs the program until it exits or is suspended at an instruction waiting for its input,
+   returning whether it exited. A suspended machine resumes from the instruction it stopped at */
+bool Machine::resume(){
+    this->suspended = false;
+    this->exec();
+    return !this->suspended;
+}
+
+// starts a guest thread at the given instruction, returning its id
+uint64_t Machine::spawn(size_t start){
+    if (start >= this->get_inst_count())
+        throw std::runtime_error("invalid thread entry point");
+    if (!this->threads){
+        // from here on the heap is shared, no other thread can be using it yet
+        this->threads = std::make_shared<ThreadGroup>();
+        this->heap->set_shared(true);
+    }
+    std::shared_ptr<GuestThread> thread = std::make_shared<GuestThread>();
+    std::unique_ptr<Machine> child(new Machine(*this, start));
+    std::lock_guard<std::mutex> lock(this->threads->lock);
+    uint64_t id = this->threads->next_id++;
+    thread->thread = std::thread([thread, machine = std::move(child)](){
+        try{
+            machine->exec_guarded(&Machine::exec_engine);
+            thread->result = machine->registers[RET_VAL];
+        }
+        catch (const std::exception& e){
+            thread->failed = true;
+            thread->error = e.what();
+        }
+        thread->executed = machine->executed;
+    });
+    this->threads->threads[id] = thread;
+    return id;
+}
+
+// waits for a guest thread to return, and returns the value it left in the return value register
+uint64_t Machine::join(uint64_t id){
+    std::shared_ptr<GuestThread> thread;
+    if (this->threads){
+        std::lock_guard<std::mutex> lock(this->threads->lock);
+        auto itt = this->threads->threads.find(id);
+        if (itt != this->threads->threads.end()){
+            thread = itt->second;
+            this->threads->threads.erase(itt);
+        }
+    }
+    if (!thread)
+        throw std::runtime_error("invalid thread id: " + std::to_string(id));
+    thread->thread.join();
+    if (thread->failed)
+        throw std::runtime_error("guest thread " + std::to_string(id) + " failed: " + thread->error);
+    this->executed += thread->executed;
+    return thread->result;
+}
+
+// waits for every guest thread that hasn't been joined, including any they spawned, reporting the first that failed
+void Machine::join_threads(){
+    std::string error;
+    while (true){
+        uint64_t id;
+        {
+            std::lock_guard<std::mutex> lock(this->threads->lock);
+            if (this->threads->threads.empty())
+                break;
+            id = this->threads->threads.begin()->first;
+        }
+        try{
+            this->join(id);
+        }
+        catch (const std::runtime_error& e){
+            if (error.empty())
+                error = e.what();
+        }
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+/* interprets the loaded program until it's about to run the instruction at the given index,
+   returning false if the program exits first. A breakpoint handler is patched over the
+   instruction for the run, splitting it from any superinstruction it was fused into */
+bool Machine::exec_until(size_t stop){
+    std::shared_ptr<const Program> original = this->program;
+    if (stop >= this->get_program().size())
+        throw std::runtime_error("invalid stopping point");
+    // the shared program can't change, so the breakpoint goes in a copy that's only used for this run
+    std::shared_ptr<Program> patched = std::make_shared<Program>(*original);
+    std::vector<DecodedOp>& ops = patched->code.ops;
+    if (stop && unfused_handler(ops[stop - 1].handler) != ops[stop - 1].handler)
+        ops[stop - 1].handler = unfused_handler(ops[stop - 1].handler);
+    ops[stop].handler = H_BREAK;
+    this->program = patched;
+    try{
+        this->exec_guarded(&Machine::exec_threaded);
+    }
+    catch (...){
+        this->program = original;
+        this->output->flush();
+        throw;
+    }
+    this->program = original;
+    this->output->flush();
+    return this->registers[PROGRAM_COUNTER] == stop;
+}
+
+// captures the machine's state, to fork new machines from
+std::shared_ptr<const Snapshot> Machine::snapshot(){
+    if (this->threads){
+        std::lock_guard<std::mutex> lock(this->threads->lock);
+        if (!this->threads->threads.empty())
+            throw std::runtime_error("can't snapshot a machine while its guest threads are running");
+    }
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+    snapshot->program = this->program;
+    snapshot->registers = this->registers;
+    snapshot->vectors = this->vectors;
+    snapshot->labels = this->labels;
+    snapshot->stack.assign(this->stack.data(), this->stack.data() + this->stack.size());
+    snapshot->stack_size = this->stack.capacity() * sizeof(uint64_t);
+    snapshot->heap = *this->heap;
+    snapshot->memory = this->memory->freeze();
+    snapshot->engine = this->engine;
+    snapshot->tier_threshold = this->tier_stats.threshold;
+    return snapshot;
+}
+
+/* runs the program with the given engine, reporting a push onto the stack's guard page as an
+   overflow. The fault jumps straight back here, so the engines must not keep anything with a
+   destructor in their frames, which is why the jit engines keep their state in the machine */
+void Machine::exec_guarded(void (Machine::*engine)()){
+    sigjmp_buf env;
+    if (sigsetjmp(env, 1)){
+        Stack::disarm_guard();
+        throw std::runtime_error("stack overflow");
+    }
+    Stack::arm_guard(&this->stack, &env);
+    try{
+        (this->*engine)();
+    }
+    catch (...){
+        Stack::disarm_guard();
+        throw;
+    }
+    Stack::disarm_guard();
+}
+
+/* runs the program with the selected engine, or the profiling interpreter if there's a profiler.
+   Instructions can only be counted by the interpreters, and a verified program is interpreted
+   without its checks */
+void Machine::exec_engine(){
+    if (this->profiler){
+        this->exec_profiling();
+        return;
+    }
+    if (this->count_instructions && (this->engine == SWITCH_ENGINE || this->engine == THREADED_ENGINE)){
+        this->exec_counted();
+        return;
+    }
+    switch (this->engine){
+        case SWITCH_ENGINE:
+            this->exec_switch();
+            break;
+        case THREADED_ENGINE:
+            if (this->program->is_verified())
+                this->exec_unchecked();
+            else
+                this->exec_threaded();
+            break;
+        case JIT_ENGINE:
+            this->exec_jit();
+            break;
+        case TIERED_ENGINE:
+            this->exec_tiered();
+            break;
+    }
 }
 
 // executes the instruction that the PC currently points to and increments the PC
 void Machine::exec_next(){
     size_t inst_no = this->registers[PROGRAM_COUNTER];
-    this->exec_inst(this->instructions[inst_no]);
+    this->exec_inst(this->get_program().get_code().encode(inst_no));
     this->registers[PROGRAM_COUNTER]++;
 }
 
@@ -166,19 +366,27 @@ void Machine::exec_inst(const Instruction& inst){
     uint8_t op_type = (op_code & 0xE0) >> 1;
     op_code &= 0xfe;
     op_code >>= 1;   
-    auto itt = this->instruction_map.find(op_type);
-    if (itt == this->instruction_map.end())
+    // a loaded program carries the extensions it was decoded against, resolved for each family
+    exec_func op = nullptr;
+    if (this->program)
+        op = this->program->get_code().families[op_type >> 4];
+    else{
+        auto itt = this->instruction_map.find(op_type);
+        if (itt != this->instruction_map.end())
+            op = itt->second;
+    }
+    if (!op)
         throw std::runtime_error("malformed binary (invalid operation)");
-    itt->second(this, op_code, immediate, inst.registers, inst.extend);
+    op(this, op_code, immediate, inst.registers, inst.extend);
 }
 
 // executes a memory operation
 void exec_mem(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend){
     uint8_t reg_1, reg_2;
-    uint64_t rhs, tmp, val;
+    uint64_t rhs, tmp, val = 0;
     uint8_t* ptr;
-    size_t size;
     std::string str;
+    GuestMemory& memory = machine->get_memory();
     if (immediate){
         reg_1 = registers;
         rhs = extend;
@@ -186,6 +394,7 @@ void exec_mem(Machine* machine, uint8_t op_code, bool immediate, uint8_t registe
     else {
         machine->split_registers(registers, reg_1, reg_2);
         val = machine->get_register(reg_2);
+        rhs = val;
     }
     switch (op_code){
         case COPY:
@@ -193,44 +402,41 @@ void exec_mem(Machine* machine, uint8_t op_code, bool immediate, uint8_t registe
             machine->set_register(reg_1, val);
             break;
         case STORE_WORD:
-            // copy rhs to the address stored in r2
-            ptr = reinterpret_cast<uint8_t*>(machine->get_register(reg_2));
+            // copy rhs to the address stored in r1
+            ptr = memory.at(machine->get_register(reg_1), 8);
             std::memcpy(ptr, &rhs, 8);
             break;
         case STORE_BYTE:
             // store the rightmost byte of rhs to the address in r1
-            ptr = reinterpret_cast<uint8_t*>(machine->get_register(reg_1));
-            rhs &= 0x0f;
-            *ptr = rhs;
+            ptr = memory.at(machine->get_register(reg_1), 1);
+            *ptr = rhs & 0xff;
             break;
         case LOAD_WORD:
             if (immediate)
                 machine->set_register(reg_1, rhs);
             else{
                 // read in the word pointed to by reg_2
-                ptr = reinterpret_cast<uint8_t*>(machine->get_register(reg_2));
+                ptr = memory.at(val, 8);
                 std::memcpy(&val, ptr, 8);
                 machine->set_register(reg_1, val);
             }
             break;
         case LOAD_BYTE:
-            ptr = reinterpret_cast<uint8_t*>(machine->get_register(reg_2));
-            val = (*ptr) & 0x000f;
+            ptr = memory.at(val, 1);
+            machine->set_register(reg_1, *ptr);
             break;
         case ALLOC_MEM:
-            size = extend;
-            machine->add_label(new uint8_t(size));
+            machine->add_label(memory.reserve(extend));
             break;
         case ALLOC_STR:
             str = machine->get_str(extend);
-            // create a char array to the string
-            ptr = new uint8_t[str.size()];
-            std::copy(str.begin(), str.end(), ptr);
-            machine->add_label(ptr);
+            // copy the string into guest memory
+            tmp = memory.reserve(str.size());
+            std::copy(str.begin(), str.end(), memory.base() + tmp);
+            machine->add_label(tmp);
             break;
         case LOAD_ADDR:
-            ptr = machine->get_label(extend - 1);
-            tmp = reinterpret_cast<uint64_t>(ptr);
+            tmp = machine->get_label(extend - 1);
             machine->set_register(registers, tmp);
             break;
     }
@@ -343,8 +549,7 @@ void exec_stack(Machine* machine, uint8_t op_code, bool immediate, uint8_t regis
         rhs = extend;
     else
         rhs = machine->get_register(reg);
-    Stack stack = machine->get_stack();
-    uint64_t val;
+    Stack& stack = machine->get_stack();
     switch (op_code){
         case PUSH:
             // push the value of the register onto the stack
@@ -352,64 +557,168 @@ void exec_stack(Machine* machine, uint8_t op_code, bool immediate, uint8_t regis
             break;
         case PUSH_B:
             // push the rightmost byte of the register onto the stack
-            stack.push(static_cast<uint8_t>(rhs & 0xff));
+            stack.push(rhs & 0xff);
             break;
         case POP:
             if (stack.is_empty())
                 throw std::runtime_error("no values on the stack to pop!");
-            val = stack.pop_type<uint64_t>();
-            machine->set_register(reg, val);
+            machine->set_register(reg, stack.pop());
             break;
         case POP_B:
             if (stack.is_empty())
                 throw std::runtime_error("no values on the stack to pop!");
-            machine->set_register(reg, *stack.pop());
+            machine->set_register(reg, stack.pop() & 0xff);
             break;
     }
 }
 
+/* reads a line or an integer from the machine's async input. If it hasn't arrived, the machine
+   is suspended and false is returned, unless the program has guest threads, which share the
+   input and can't be suspended, so they block until it's ready */
+template <typename T>
+static bool read_async(Machine* machine, bool (AsyncInput::*read)(T&), T& val){
+    AsyncInput* input = machine->get_async_input();
+    while (!(input->*read)(val)){
+        if (input->fill())
+            continue;
+        if (!machine->get_threads()){
+            machine->suspend();
+            return false;
+        }
+        input->wait();
+    }
+    return true;
+}
+
 // executes an IO operation
 void exec_io(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend){
     uint8_t reg = registers & 0x0f;
     uint8_t index;
-    uint64_t input_int;
+    uint64_t input_int, addr;
     const char* str;
     std::string input;
+    GuestMemory& memory = machine->get_memory();
+    // guest threads share the streams, so their I/O is serialized once any have been spawned
+    std::unique_lock<std::mutex> lock;
+    if (machine->get_threads())
+        lock = std::unique_lock<std::mutex>(machine->get_threads()->io_lock);
     switch (op_code){
         case PUT_S:
-            str = reinterpret_cast<const char*>(machine->get_register(reg));
-            printf("%s", str);
+            // print up to the string's null terminator, or the end of the guest memory
+            addr = machine->get_register(reg);
+            str = reinterpret_cast<const char*>(memory.at(addr, 0));
+            machine->get_output().write(str, strnlen(str, memory.used() - addr));
             break;
         case PUT_I:
-            printf("%lu", machine->get_register(reg));
+            machine->get_output().write_uint(machine->get_register(reg));
             break;
         case GET_S:
-            std::getline(std::cin, input);
-            machine->add_str(input);
-            str = input.c_str();
-            machine->set_register(reg, reinterpret_cast<uint64_t>(str));
+            // anything the program printed, like a prompt, is written before waiting for input
+            machine->get_output().flush();
+            // copy the line into guest memory as a null terminated string
+            if (machine->get_async_input()){
+                if (!read_async(machine, &AsyncInput::read_line, input))
+                    break;
+            }
+            else
+                std::getline(machine->get_input(), input);
+            addr = memory.reserve(input.size() + 1);
+            std::copy(input.begin(), input.end(), memory.base() + addr);
+            machine->set_register(reg, addr);
             break;
         case GET_I:
-            std::cin >> input_int;
+            machine->get_output().flush();
+            if (machine->get_async_input()){
+                if (!read_async(machine, &AsyncInput::read_int, input_int))
+                    break;
+            }
+            else
+                machine->get_input() >> input_int;
             machine->set_register(reg, input_int);
             break;
     }
 }
 
 void exec_heap(Machine *machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend){
-    uint8_t* ptr;
-    uint8_t reg, _;
-    machine->split_registers(registers, reg, _);
+    uint64_t addr;
+    uint8_t reg = registers & 0x0f;
     switch (op_code){
         case HEAP_ALLOC:
             // allocate memory of the specified size and store the pointer in the desitnation register
-            ptr = new uint8_t[extend];
-            machine->set_register(reg, reinterpret_cast<uint64_t>(ptr));
+            addr = machine->get_heap().alloc(machine->get_memory(), extend);
+            machine->set_register(reg, addr);
             break;
         case HEAP_FREE:
             // free the memory in the given register
-            ptr = reinterpret_cast<uint8_t*>(machine->get_register(reg));
-            delete ptr;
+            addr = machine->get_register(reg);
+            machine->get_heap().free(machine->get_memory(), addr);
             break;
     }
-}
\ No newline at end of file
+}
+
+// returns the word at the guest address in the given register, for an atomic operation on it
+static std::atomic<uint64_t>* atomic_word(Machine* machine, uint8_t reg){
+    uint64_t addr = machine->get_register(reg);
+    if (addr % sizeof(uint64_t))
+        throw std::runtime_error("misaligned atomic access");
+    return reinterpret_cast<std::atomic<uint64_t>*>(machine->get_memory().at(addr, sizeof(uint64_t)));
+}
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomic words must be laid out like plain words");
+
+// executes a thread, atomic memory or vector operation
+void exec_thread(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend){
+    uint8_t r1, r2, r3, r4;
+    uint64_t val;
+    std::atomic<uint64_t>* word;
+    machine->split_registers(registers, r1, r2);
+    switch (op_code){
+        case SPAWN:
+            // program labels point at the instruction before their target, as they do for call
+            machine->set_register(r2, machine->spawn(extend + 1));
+            break;
+        case JOIN:
+            machine->set_register(r1, machine->join(machine->get_register(r2)));
+            break;
+        case ATOMIC_LOAD:
+            word = atomic_word(machine, r2);
+            machine->set_register(r1, word->load());
+            break;
+        case ATOMIC_STORE:
+            if (immediate){
+                word = atomic_word(machine, r2);
+                val = extend;
+            }
+            else{
+                word = atomic_word(machine, r1);
+                val = machine->get_register(r2);
+            }
+            word->store(val);
+            break;
+        case FETCH_ADD:
+            // add to the word, and keep the value it held before
+            val = immediate ? extend : machine->get_register(extend);
+            word = atomic_word(machine, r2);
+            machine->set_register(r1, word->fetch_add(val));
+            break;
+        case COMP_SWAP:
+            // replace the word if it holds the expected value, either way keeping the value it held
+            machine->split_registers(extend, r3, r4);
+            word = atomic_word(machine, r2);
+            val = machine->get_register(r3);
+            word->compare_exchange_strong(val, machine->get_register(r4));
+            machine->set_register(r1, val);
+            break;
+        case VEC_LOAD:
+        case VEC_STORE:
+        case VEC_BROADCAST:
+        case VEC_LANES:
+        case VEC_REDUCE:
+        case VEC_GET:
+        case VEC_SET:
+            exec_vector(machine, op_code, immediate, registers, extend);
+            break;
+        default:
+            throw std::runtime_error("malformed binary (invalid operation)");
+    }
+}
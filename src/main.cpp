@@ -1,9 +1,19 @@
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
 
 #include "../inc/assembler.h"
+#include "../inc/linker.h"
 #include "../inc/machine.h"
+#include "../inc/fusion.h"
+#include "../inc/batch.h"
+#include "../inc/image_cache.h"
 #include "../extensions/pow.h"
 
 enum Command{
@@ -12,13 +22,89 @@ enum Command{
     BUILD,
     RUN,
     DEBUG,
+    RUN_BATCH,
+    PROFILE,
+    CACHE,
+    LINK,
+    OPT,
+};
+
+// the settings a program is assembled with, read from the --name=value flags
+struct BuildOptions{
+    int format {TCODE_VERSION};
+    bool debug_info {true};
+    size_t threads {1};
+    bool object {false};
+    int opt_level {0};
+};
+
+// the settings objects are linked with, on top of the build options
+struct LinkOptions{
+    std::string output {"out.tcode"};
+    bool gc {true};
+};
+
+// the settings a batch of programs is run with, on top of the run options each job uses
+struct BatchOptions{
+    size_t threads {std::thread::hardware_concurrency()};
+    std::string summary {"batch-summary.csv"};
+    bool async_io {false};
+};
+
+// the settings a program is profiled with, on top of the run options
+struct ProfileOptions{
+    uint32_t sample_us {0};
+    size_t top {20};
+    std::string collapsed;
+};
+
+// the settings a program is run with, read from the --name=value flags
+struct RunOptions{
+    int engine {THREADED_ENGINE};
+    bool fusion {true};
+    bool cache {true};
+    int verify {VERIFY_ON};
+    int vector_isa {get_vector_isa()};
+    uint32_t tier_threshold {DEFAULT_TIER_THRESHOLD};
+    bool tier_stats {false};
+    bool load_stats {false};
+    size_t stack_size {DEFAULT_STACK_SIZE};
+    size_t heap_limit {0};
+    bool heap_stats {false};
+    std::string snapshot_at;
+    size_t forks {1};
+    int flush_policy {FLUSH_AUTO};
+    bool output_stats {false};
 };
 
 void print_error(const std::string& err_msg);
 Command parse_command(const std::string& command);
 void print_help();
-int assemble_prog(const std::string& in, const std::string& out);
-int exec_prog(const std::string& in, bool debug);
+void print_tier_stats(const TierStats& stats);
+void print_load_stats(const LoadStats& stats);
+void print_heap_stats(const HeapStats& stats);
+void print_output_stats(const OutputStats& stats, double seconds);
+void print_opt_stats(const OptStats& stats, int level);
+void parse_args(int argc, char** argv, std::vector<std::string>& positional, std::unordered_map<std::string, std::string>& flags);
+int parse_engine(const std::string& engine);
+int parse_flush_policy(const std::string& policy);
+int parse_verify_mode(const std::string& mode);
+int parse_vector_isa(const std::string& isa);
+bool parse_run_options(std::unordered_map<std::string, std::string>& flags, RunOptions& options);
+bool parse_build_options(std::unordered_map<std::string, std::string>& flags, BuildOptions& options);
+int assemble_prog(const std::string& in, const std::string& out, const BuildOptions& options);
+std::unique_ptr<Machine> exec_forks(Machine& vm, const RunOptions& options);
+int exec_prog(const std::string& in, bool debug, const RunOptions& options);
+bool parse_batch_options(std::unordered_map<std::string, std::string>& flags, BatchOptions& batch_options, RunOptions& options);
+void configure_machine(Machine& vm, const RunOptions& options);
+int exec_batch(const std::string& manifest, const BatchOptions& batch_options, const RunOptions& options);
+bool parse_profile_options(std::unordered_map<std::string, std::string>& flags, ProfileOptions& profile_options, RunOptions& options);
+int exec_profile(const std::string& in, const ProfileOptions& profile_options, const RunOptions& options);
+int exec_cache(const std::string& action);
+bool parse_link_options(std::unordered_map<std::string, std::string>& flags, LinkOptions& link_options, BuildOptions& options);
+int link_objects(const std::vector<std::string>& objects, const LinkOptions& link_options, const BuildOptions& options);
+bool parse_opt_options(std::unordered_map<std::string, std::string>& flags, BuildOptions& options);
+int optimize_prog(const std::string& in, const std::string& out, const BuildOptions& options);
 
 int main(int argc, char** argv){
     if (argc == 1){
@@ -26,8 +112,15 @@ int main(int argc, char** argv){
         return 0;
     }
     Command cmd = parse_command(argv[1]);
-    std::string in, out;
+    std::string in, out, ext;
     bool debug;
+    RunOptions options;
+    BuildOptions build_options;
+    BatchOptions batch_options;
+    ProfileOptions profile_options;
+    LinkOptions link_options;
+    std::vector<std::string> positional;
+    std::unordered_map<std::string, std::string> flags;
     switch (cmd){
         case NULL_CMD:
             print_error("Unrecognized command: " + cmd);
@@ -37,25 +130,78 @@ int main(int argc, char** argv){
             print_help();
             return 0;
         case BUILD:
-            if (argc < 3 || argc > 4){
+            parse_args(argc, argv, positional, flags);
+            if (positional.size() < 1 || positional.size() > 2){
                 print_error("this command expects between one and two arguments. Use 'tvm help' for more information");
                 return 1;
             }
-            in = argv[2];
-            out = "out.tcode";
-            if (argc == 4){
-                out = argv[3];
-                if (out.size() < 7 || out.substr(out.size() - 6) != ".tcode")
-                    out.append(".tcode");
+            if (!parse_build_options(flags, build_options))
+                return 1;
+            in = positional[0];
+            // objects get their own extension, so they aren't mistaken for programs
+            ext = build_options.object ? ".tobj" : ".tcode";
+            out = "out" + ext;
+            if (positional.size() == 2){
+                out = positional[1];
+                if (out.size() <= ext.size() || out.substr(out.size() - ext.size()) != ext)
+                    out.append(ext);
             }
-            return assemble_prog(in, out);
+            return assemble_prog(in, out, build_options);
         case RUN:
         case DEBUG:
-            if (argc != 3)
+            parse_args(argc, argv, positional, flags);
+            if (positional.size() != 1){
                 print_error("this command only accepts one argument. Use 'tvm help' for more information");
-            in = argv[2];
+                return 1;
+            }
+            if (!parse_run_options(flags, options))
+                return 1;
+            in = positional[0];
             debug = (cmd == DEBUG);
-            return exec_prog(in, debug);
+            return exec_prog(in, debug, options);
+        case RUN_BATCH:
+            parse_args(argc, argv, positional, flags);
+            if (positional.size() != 1){
+                print_error("this command only accepts one argument. Use 'tvm help' for more information");
+                return 1;
+            }
+            if (!parse_batch_options(flags, batch_options, options))
+                return 1;
+            return exec_batch(positional[0], batch_options, options);
+        case PROFILE:
+            parse_args(argc, argv, positional, flags);
+            if (positional.size() != 1){
+                print_error("this command only accepts one argument. Use 'tvm help' for more information");
+                return 1;
+            }
+            if (!parse_profile_options(flags, profile_options, options))
+                return 1;
+            return exec_profile(positional[0], profile_options, options);
+        case LINK:
+            parse_args(argc, argv, positional, flags);
+            if (positional.empty()){
+                print_error("this command expects at least one object file. Use 'tvm help' for more information");
+                return 1;
+            }
+            if (!parse_link_options(flags, link_options, build_options))
+                return 1;
+            return link_objects(positional, link_options, build_options);
+        case OPT:
+            parse_args(argc, argv, positional, flags);
+            if (positional.size() < 1 || positional.size() > 2){
+                print_error("this command expects between one and two arguments. Use 'tvm help' for more information");
+                return 1;
+            }
+            if (!parse_opt_options(flags, build_options))
+                return 1;
+            out = (positional.size() == 2) ? positional[1] : "out.tcode";
+            return optimize_prog(positional[0], out, build_options);
+        case CACHE:
+            if (argc != 3){
+                print_error("this command only accepts one argument. Use 'tvm help' for more information");
+                return 1;
+            }
+            return exec_cache(argv[2]);
     }
     return 0;
 }
@@ -69,7 +215,12 @@ Command parse_command(const std::string& command){
         {"help", HELP},
         {"build", BUILD},
         {"run", RUN},
-        {"run-debug", DEBUG}
+        {"run-debug", DEBUG},
+        {"run-batch", RUN_BATCH},
+        {"profile", PROFILE},
+        {"cache", CACHE},
+        {"link", LINK},
+        {"opt", OPT}
     };
     auto cmd_itt = options.find(command);
     if (cmd_itt == options.end())
@@ -77,27 +228,461 @@ Command parse_command(const std::string& command){
     return cmd_itt->second;
 }
 
+/* splits the arguments following the command into positional arguments and --name=value flags,
+   -j <count> is read as --jobs=<count>, -O<level> as --opt=<level> and -c as --object */
+void parse_args(int argc, char** argv, std::vector<std::string>& positional, std::unordered_map<std::string, std::string>& flags){
+    for (int i = 2; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "-c"){
+            flags["object"] = "";
+            continue;
+        }
+        if (arg.substr(0, 2) == "-O"){
+            flags["opt"] = arg.substr(2);
+            continue;
+        }
+        if (arg.substr(0, 2) == "-j"){
+            if (arg.size() > 2)
+                flags["jobs"] = arg.substr(2);
+            else
+                flags["jobs"] = (i + 1 < argc) ? argv[++i] : "";
+            continue;
+        }
+        if (arg.size() < 3 || arg.substr(0, 2) != "--"){
+            positional.push_back(arg);
+            continue;
+        }
+        size_t eq_pos = arg.find('=');
+        if (eq_pos == arg.npos)
+            flags[arg.substr(2)] = "";
+        else
+            flags[arg.substr(2, eq_pos - 2)] = arg.substr(eq_pos + 1);
+    }
+}
+
+// converts the name of an execution engine to its engine type, returns -1 if the name is invalid
+int parse_engine(const std::string& engine){
+    if (engine == "switch")
+        return SWITCH_ENGINE;
+    if (engine == "threaded")
+        return THREADED_ENGINE;
+    if (engine == "jit")
+        return JIT_ENGINE;
+    if (engine == "tiered")
+        return TIERED_ENGINE;
+    return -1;
+}
+
+// returns the flush policy with the given name, or -1 if there's no such policy
+int parse_flush_policy(const std::string& policy){
+    if (policy == "line")
+        return FLUSH_LINE;
+    if (policy == "full")
+        return FLUSH_FULL;
+    if (policy == "exit")
+        return FLUSH_EXIT;
+    return -1;
+}
+
+// returns the verification mode with the given name, or -1 if there's no such mode
+int parse_verify_mode(const std::string& mode){
+    if (mode == "off")
+        return VERIFY_OFF;
+    if (mode == "on")
+        return VERIFY_ON;
+    if (mode == "strict")
+        return VERIFY_STRICT;
+    return -1;
+}
+
+// returns the instruction set vector operations run with, picking AVX2 for auto if the CPU supports it, or -1 if there's no such instruction set
+int parse_vector_isa(const std::string& isa){
+    if (isa == "auto")
+        return has_avx2() ? VECTOR_AVX2 : VECTOR_SCALAR;
+    if (isa == "avx2")
+        return VECTOR_AVX2;
+    if (isa == "scalar")
+        return VECTOR_SCALAR;
+    return -1;
+}
+
+// reads the build options from the command's flags, printing an error and returning false if any are invalid
+bool parse_build_options(std::unordered_map<std::string, std::string>& flags, BuildOptions& options){
+    for (auto& flag : flags){
+        const std::string& name = flag.first;
+        const std::string& val = flag.second;
+        if (name == "format"){
+            if (val == "v1")
+                options.format = 1;
+            else if (val == "v2")
+                options.format = 2;
+            else{
+                print_error("unrecognized format: " + val + ". Expected 'v1' or 'v2'");
+                return false;
+            }
+        }
+        else if (name == "strip")
+            options.debug_info = false;
+        else if (name == "object")
+            options.object = true;
+        else if (name == "opt"){
+            if (val == "0" || val == "1" || val == "2")
+                options.opt_level = val[0] - '0';
+            else{
+                print_error("unrecognized optimization level: " + val + ". Expected 0, 1 or 2");
+                return false;
+            }
+        }
+        else if (name == "jobs"){
+            try{
+                options.threads = std::stoul(val);
+            }
+            catch (std::exception&){
+                options.threads = 0;
+            }
+            if (!options.threads){
+                print_error("invalid thread count: " + val);
+                return false;
+            }
+        }
+        else{
+            print_error("unrecognized option: --" + name + ". Use 'tvm help' for more information");
+            return false;
+        }
+    }
+    return true;
+}
+
+// reads the link options from the command's flags, leaving the rest to be read as build options
+bool parse_link_options(std::unordered_map<std::string, std::string>& flags, LinkOptions& link_options, BuildOptions& options){
+    auto itt = flags.find("output");
+    if (itt != flags.end()){
+        link_options.output = itt->second;
+        flags.erase(itt);
+    }
+    itt = flags.find("gc");
+    if (itt != flags.end()){
+        link_options.gc = (itt->second != "off");
+        flags.erase(itt);
+    }
+    // the rest of the build options only apply to assembling
+    const char* unsupported[] = {"jobs", "object", "opt"};
+    for (const char* name : unsupported){
+        if (flags.count(name)){
+            print_error(std::string("--") + name + " can't be used with link");
+            return false;
+        }
+    }
+    return parse_build_options(flags, options);
+}
+
+// reads the options a built program is optimized with, which are the build options that don't only apply to assembling
+bool parse_opt_options(std::unordered_map<std::string, std::string>& flags, BuildOptions& options){
+    options.opt_level = 2;
+    const char* unsupported[] = {"jobs", "object"};
+    for (const char* name : unsupported){
+        if (flags.count(name)){
+            print_error(std::string("--") + name + " can't be used with opt");
+            return false;
+        }
+    }
+    return parse_build_options(flags, options);
+}
+
+// reads the batch options from the command's flags, leaving the rest to be read as the run options each job uses
+bool parse_batch_options(std::unordered_map<std::string, std::string>& flags, BatchOptions& batch_options, RunOptions& options){
+    auto itt = flags.find("threads");
+    if (itt != flags.end()){
+        try{
+            batch_options.threads = std::stoul(itt->second);
+        }
+        catch (std::exception&){
+            print_error("invalid thread count: " + itt->second);
+            return false;
+        }
+        flags.erase(itt);
+    }
+    itt = flags.find("summary");
+    if (itt != flags.end()){
+        batch_options.summary = itt->second;
+        flags.erase(itt);
+    }
+    itt = flags.find("async-io");
+    if (itt != flags.end()){
+        batch_options.async_io = true;
+        flags.erase(itt);
+    }
+    // the options that report on or fork a single run don't apply to a batch
+    const char* unsupported[] = {"snapshot-at", "forks", "load-stats", "tier-stats", "heap-stats", "output-stats"};
+    for (const char* name : unsupported){
+        if (flags.count(name)){
+            print_error(std::string("--") + name + " can't be used with run-batch");
+            return false;
+        }
+    }
+    return parse_run_options(flags, options);
+}
+
+// reads the profile options from the command's flags, leaving the rest to be read as the run options
+bool parse_profile_options(std::unordered_map<std::string, std::string>& flags, ProfileOptions& profile_options, RunOptions& options){
+    auto itt = flags.find("sample");
+    if (itt != flags.end()){
+        try{
+            profile_options.sample_us = std::stoul(itt->second);
+        }
+        catch (std::exception&){
+            print_error("invalid sampling interval: " + itt->second);
+            return false;
+        }
+        flags.erase(itt);
+    }
+    itt = flags.find("top");
+    if (itt != flags.end()){
+        try{
+            profile_options.top = std::stoul(itt->second);
+        }
+        catch (std::exception&){
+            print_error("invalid count: " + itt->second);
+            return false;
+        }
+        flags.erase(itt);
+    }
+    itt = flags.find("collapsed");
+    if (itt != flags.end()){
+        profile_options.collapsed = itt->second;
+        flags.erase(itt);
+    }
+    // the profiler runs its own interpreter, and only profiles a single run
+    const char* unsupported[] = {"engine", "fusion", "tier-threshold", "tier-stats", "snapshot-at", "forks"};
+    for (const char* name : unsupported){
+        if (flags.count(name)){
+            print_error(std::string("--") + name + " can't be used with profile");
+            return false;
+        }
+    }
+    return parse_run_options(flags, options);
+}
+
+// reads the run options from the command's flags, printing an error and returning false if any are invalid
+bool parse_run_options(std::unordered_map<std::string, std::string>& flags, RunOptions& options){
+    for (auto& flag : flags){
+        const std::string& name = flag.first;
+        const std::string& val = flag.second;
+        if (name == "engine"){
+            options.engine = parse_engine(val);
+            if (options.engine < 0){
+                print_error("unrecognized engine: " + val + ". Expected 'switch', 'threaded', 'jit' or 'tiered'");
+                return false;
+            }
+        }
+        else if (name == "fusion")
+            options.fusion = (val != "off");
+        else if (name == "cache")
+            options.cache = (val != "off");
+        else if (name == "verify"){
+            options.verify = parse_verify_mode(val);
+            if (options.verify < 0){
+                print_error("unrecognized verification mode: " + val + ". Expected 'off', 'on' or 'strict'");
+                return false;
+            }
+        }
+        else if (name == "simd"){
+            options.vector_isa = parse_vector_isa(val);
+            if (options.vector_isa < 0){
+                print_error("unrecognized instruction set: " + val + ". Expected 'auto', 'avx2' or 'scalar'");
+                return false;
+            }
+        }
+        else if (name == "tier-threshold"){
+            try{
+                options.tier_threshold = std::stoul(val);
+            }
+            catch (std::exception&){
+                print_error("invalid tier threshold: " + val);
+                return false;
+            }
+        }
+        else if (name == "stack-size"){
+            try{
+                options.stack_size = std::stoull(val);
+            }
+            catch (std::exception&){
+                print_error("invalid stack size: " + val);
+                return false;
+            }
+        }
+        else if (name == "heap-limit"){
+            try{
+                options.heap_limit = std::stoull(val);
+            }
+            catch (std::exception&){
+                print_error("invalid heap limit: " + val);
+                return false;
+            }
+        }
+        else if (name == "snapshot-at")
+            options.snapshot_at = val;
+        else if (name == "forks"){
+            try{
+                options.forks = std::stoull(val);
+            }
+            catch (std::exception&){
+                print_error("invalid fork count: " + val);
+                return false;
+            }
+        }
+        else if (name == "flush"){
+            options.flush_policy = parse_flush_policy(val);
+            if (options.flush_policy < 0){
+                print_error("unrecognized flush policy: " + val + ". Expected 'line', 'full' or 'exit'");
+                return false;
+            }
+        }
+        else if (name == "heap-stats")
+            options.heap_stats = true;
+        else if (name == "output-stats")
+            options.output_stats = true;
+        else if (name == "tier-stats")
+            options.tier_stats = true;
+        else if (name == "load-stats")
+            options.load_stats = true;
+        else{
+            print_error("unrecognized option: --" + name + ". Use 'tvm help' for more information");
+            return false;
+        }
+    }
+    return true;
+}
+
+// prints how long the program took to load
+void print_load_stats(const LoadStats& stats){
+    std::cerr << "Load stats:\n";
+    std::cerr << "\tsize: " << stats.bytes << " bytes\n";
+    std::cerr << "\tinstructions: " << stats.instructions << "\n";
+    std::cerr << "\tstrings: " << stats.strings << "\n";
+    std::cerr << "\tsource: " << (stats.cached ? "image cache" : "decoded") << "\n";
+    if (stats.verified)
+        std::cerr << "\tverified: yes\n";
+    else
+        std::cerr << "\tverified: " << (stats.verify_error.empty() ? "off" : "no, " + stats.verify_error) << "\n";
+    std::cerr << std::fixed << std::setprecision(3);
+    std::cerr << "\tload time: " << stats.seconds * 1000 << " ms" << std::endl;
+}
+
+// prints how many allocations the program made, and how much of the heap it used
+void print_heap_stats(const HeapStats& stats){
+    std::cerr << "Heap stats:\n";
+    std::cerr << "\tallocations: " << stats.allocs << " (" << stats.large_allocs << " large)\n";
+    std::cerr << "\tfrees: " << stats.frees << "\n";
+    std::cerr << "\tlive: " << stats.live_bytes << " bytes\n";
+    std::cerr << "\tpeak: " << stats.peak_bytes << " bytes\n";
+    std::cerr << "\treserved: " << stats.reserved_bytes << " bytes\n";
+    if (stats.limit)
+        std::cerr << "\tlimit: " << stats.limit << " bytes\n";
+    std::cerr << std::flush;
+}
+
+// prints how much the program wrote, and its throughput over the whole run
+void print_output_stats(const OutputStats& stats, double seconds){
+    std::cerr << "Output stats:\n";
+    std::cerr << "\tbytes: " << stats.bytes << "\n";
+    std::cerr << "\twrites: " << stats.writes << "\n";
+    std::cerr << std::fixed << std::setprecision(3);
+    std::cerr << "\trun time: " << seconds * 1000 << " ms\n";
+    std::cerr << "\tthroughput: " << (seconds > 0 ? stats.bytes / seconds / (1 << 20) : 0) << " MiB/s" << std::endl;
+}
+
+// prints what each pass of the optimizer changed, the passes over the control flow only run from level 2
+void print_opt_stats(const OptStats& stats, int level){
+    std::cout << "Optimized: " << stats.removed << " instructions removed, " << stats.folded << " constants folded, ";
+    std::cout << stats.reduced << " operations strength reduced, " << stats.threaded << " jumps threaded" << std::endl;
+    if (level < 2)
+        return;
+    std::cout << "\t" << stats.dead_stores << " dead stores removed, " << stats.hoisted << " instructions hoisted out of loops, ";
+    std::cout << stats.inlined << " calls inlined, " << stats.unreachable << " unreachable instructions removed, " << stats.moved_blocks << " blocks moved" << std::endl;
+}
+
+// prints what the tiered engine compiled, and where the time went
+void print_tier_stats(const TierStats& stats){
+    std::cerr << "Tier stats:\n";
+    std::cerr << "\tthreshold: " << stats.threshold << " back-edges\n";
+    std::cerr << "\ttier-ups: " << stats.events.size() << "\n";
+    for (const TierEvent& event : stats.events)
+        std::cerr << "\t\tloop " << event.header << "-" << event.end - 1 << " after " << event.backedges << " back-edges (" << event.code_bytes << " bytes)\n";
+    std::cerr << std::fixed << std::setprecision(3);
+    std::cerr << "\tinterpreter: " << stats.interpreter_seconds * 1000 << " ms\n";
+    std::cerr << "\tcompiler: " << stats.compile_seconds * 1000 << " ms\n";
+    std::cerr << "\tnative: " << stats.native_seconds * 1000 << " ms" << std::endl;
+}
+
 void print_help(){
-    std::string names[] = {"help", "build", "run",  "run-debug"};
-    std::string args[] = {"", "<input_file> [output_file]", "<input_file>", "<input_file>"};
+    std::string names[] = {"help", "build", "link", "opt", "run",  "run-debug", "run-batch", "profile", "cache"};
+    std::string args[] = {"", "[options] <input_file> [output_file]", "[options] <object_files>", "[options] <input_file> [output_file]", "[options] <input_file>", "[options] <input_file>", "[options] <manifest>", "[options] <input_file>", "stats|clear"};
     std::string descriptions[] = {
         "displays this menu",
         "assembles the input_file and stores the bytecode to the output file. If no output file is provided the bytecode will be stored in out.tcode",
+        "links object files into a program, starting from the first object",
+        "optimizes a built or linked tcode file, storing it to the output file (out.tcode by default)",
         "executes the provided tcode file",
-        "executes the provided tcode file and displays the values of all registers at completion" 
+        "executes the provided tcode file and displays the values of all registers at completion",
+        "runs each job in the manifest, a line per job of a tcode file and optionally its input and output files",
+        "executes the provided tcode file and reports the instructions executed under each label",
+        "reports on or empties the cache of decoded programs"
     };
     std::cout << "Program options" << std::endl;
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < 9; i++)
         std::cout << "\t" << std::left << std::setw(15) << names[i] << std::setw(35) << args[i] << descriptions[i] << "\n";
+    std::cout << "Build options" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "--format=v1|v2" << "selects the tcode format to write (defaults to v2)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--strip" << "leaves the label names out of the output" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "-j <count>, --jobs=<count>" << "assembles the program on this many threads (defaults to 1)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "-O0, -O1, -O2" << "optimizes the program with peephole passes at -O1, and passes over its control flow at -O2 (defaults to -O0)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "-c" << "writes an object file to be linked (to out.tobj by default)" << "\n";
+    std::cout << "Opt options (along with --format and --strip)" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "-O1, -O2" << "the optimization level (defaults to -O2)" << "\n";
+    std::cout << "Link options (along with --format and --strip)" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "--output=<file>" << "where to write the program (defaults to out.tcode)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--gc=on|off" << "leaves out code and data unreachable from the first object (defaults to on)" << "\n";
+    std::cout << "Run options" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "--engine=switch|threaded|jit|tiered" << "selects the execution engine (defaults to threaded)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--fusion=on|off" << "fuses common instruction sequences into superinstructions (defaults to on)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--cache=on|off" << "reads and writes decoded programs in the image cache (defaults to on)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--verify=off|on|strict" << "verifies the program as it's loaded, rejecting unsafe programs and running it unchecked if it passes (defaults to on)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--simd=auto|avx2|scalar" << "the instruction set vector operations run with (defaults to auto, AVX2 if the CPU supports it)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--tier-threshold=<count>" << "back-edges before the tiered engine compiles a loop (defaults to " << DEFAULT_TIER_THRESHOLD << ")" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--stack-size=<bytes>" << "the size of the stack, rounded up to whole pages (defaults to " << DEFAULT_STACK_SIZE << ")" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--heap-limit=<bytes>" << "the most memory the program may hold with halloc (unlimited by default)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--heap-stats" << "reports the heap's allocations and peak usage" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--flush=line|full|exit" << "when output is written (defaults to line for a terminal, otherwise full)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--output-stats" << "reports the bytes written and the output throughput" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--snapshot-at=<label>" << "runs the program up to a label, then forks it from there" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--forks=<count>" << "the number of machines to fork from the snapshot (defaults to 1)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--load-stats" << "reports the time taken to load the program" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--tier-stats" << "reports compiled loops and the time spent in each tier" << "\n";
+    std::cout << "Batch options (along with the run options above that don't report on or fork a run)" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "--threads=<count>" << "the number of worker threads (defaults to one per core)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--summary=<file>" << "where to write each job's status, wall time and instruction count (defaults to batch-summary.csv)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--async-io" << "runs each worker's jobs on an event loop, suspending jobs that are waiting for input" << "\n";
+    std::cout << "Profile options (along with the run options above that don't select the engine or fork a run)" << std::endl;
+    std::cout << "\t" << std::left << std::setw(50) << "--sample=<microseconds>" << "samples where the program is at this interval of wall time" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--top=<count>" << "the number of labels and instructions to report (defaults to 20)" << "\n";
+    std::cout << "\t" << std::left << std::setw(50) << "--collapsed=<file>" << "writes the call stacks in the collapsed format flamegraph tools read" << "\n";
     std::cout << "Visit https://github.com/DrewRoss5/TinkerVM for more information" << std::endl;
 }
 
-int assemble_prog(const std::string& in, const std::string& out){
+int assemble_prog(const std::string& in, const std::string& out, const BuildOptions& options){
     try{
         Assembler assembler; 
         init_pow_assembler(assembler);
+        assembler.set_format(options.format);
+        assembler.set_debug_info(options.debug_info);
+        assembler.set_threads(options.threads);
+        assembler.set_object(options.object);
+        assembler.set_opt_level(options.opt_level);
         assembler.assemble_file(in, out);
         std::cout << "Built " << out << " succesfully." << std::endl;
+        if (options.opt_level)
+            print_opt_stats(assembler.get_opt_stats(), options.opt_level);
     }
     catch (std::runtime_error err){
         print_error(err.what());
@@ -106,22 +691,212 @@ int assemble_prog(const std::string& in, const std::string& out){
     return 0;
 }
 
-int exec_prog(const std::string& in, bool debug){
-    Machine vm;
+int optimize_prog(const std::string& in, const std::string& out, const BuildOptions& options){
+    try{
+        OptStats stats = optimize_file(in, out, options.opt_level, options.format, options.debug_info);
+        std::cout << "Optimized " << in << " into " << out << ": " << stats.original << " instructions down to " << stats.instructions << std::endl;
+        print_opt_stats(stats, options.opt_level);
+    }
+    catch (std::runtime_error& err){
+        print_error(err.what());
+        return -1;
+    }
+    return 0;
+}
+
+int link_objects(const std::vector<std::string>& objects, const LinkOptions& link_options, const BuildOptions& options){
+    try{
+        Linker linker;
+        linker.set_format(options.format);
+        linker.set_debug_info(options.debug_info);
+        linker.set_gc(link_options.gc);
+        for (const std::string& object : objects)
+            linker.add_object(object);
+        LinkStats stats = linker.link(link_options.output);
+        std::cout << "Linked " << stats.objects << " objects into " << link_options.output << ": ";
+        std::cout << stats.instructions << " instructions (" << stats.removed_instructions << " unreachable removed), ";
+        std::cout << stats.data_labels << " data labels (" << stats.removed_data_labels << " unused removed), ";
+        std::cout << stats.strings << " strings (" << stats.merged_strings << " duplicates merged)" << std::endl;
+    }
+    catch (std::runtime_error& err){
+        print_error(err.what());
+        return -1;
+    }
+    return 0;
+}
+
+/* runs the loaded program up to the snapshot label, then forks the given number of machines
+   from that point and runs each of them to completion, returning the last one */
+std::unique_ptr<Machine> exec_forks(Machine& vm, const RunOptions& options){
+    if (!vm.exec_until(vm.find_label(options.snapshot_at)))
+        throw std::runtime_error("the program exited before reaching " + options.snapshot_at);
+    std::shared_ptr<const Snapshot> snapshot = vm.snapshot();
+    std::unique_ptr<Machine> fork;
+    for (size_t i = 0; i < options.forks; i++){
+        fork.reset(new Machine(*snapshot));
+        fork->set_flush_policy(options.flush_policy);
+        fork->exec();
+    }
+    return fork;
+}
+
+// applies the run options to a machine
+void configure_machine(Machine& vm, const RunOptions& options){
     init_pow_machine(vm);
+    vm.set_engine(options.engine);
+    vm.set_fusion(options.fusion);
+    vm.set_image_cache(options.cache);
+    vm.set_verify(options.verify);
+    set_vector_isa(options.vector_isa);
+    vm.set_tier_threshold(options.tier_threshold);
+    vm.set_stack_size(options.stack_size);
+    vm.set_heap_limit(options.heap_limit);
+    vm.set_flush_policy(options.flush_policy);
+}
+
+int exec_prog(const std::string& in, bool debug, const RunOptions& options){
+    typedef std::chrono::steady_clock clock;
+    Machine machine;
+    std::unique_ptr<Machine> fork;
+    double seconds;
     try{
-        vm.exec_file(in);
+        configure_machine(machine, options);
+        machine.load_file(in);
+        clock::time_point start = clock::now();
+        if (options.snapshot_at.empty())
+            machine.exec();
+        else
+            fork = exec_forks(machine, options);
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
     }
     catch (std::runtime_error err){
         print_error(err.what());
         return -1;
     }
+    // report on the last fork if the program was forked
+    Machine& vm = fork ? *fork : machine;
+    if (options.load_stats)
+        print_load_stats(vm.get_load_stats());
+    if (options.tier_stats)
+        print_tier_stats(vm.get_tier_stats());
+    if (options.heap_stats)
+        print_heap_stats(vm.get_heap().get_stats());
+    if (options.output_stats)
+        print_output_stats(vm.get_output().get_stats(), seconds);
     // print the value of each register if we're in debug mode
     if (debug){
         std::cout << "Registers:";
         for (int i = 0; i < 16; i++)
             std::cout << "\n\tR" << i << ": " << vm.get_register(i);
+        // report how many of each superinstruction were fused at load time
+        const std::vector<size_t>& fusions = vm.get_fusion_counts();
+        if (fusions.size()){
+            std::cout << "\nFusions:";
+            for (size_t i = 0; i < fusions.size(); i++)
+                std::cout << "\n\t" << fusion_patterns[i].name << ": " << fusions[i];
+        }
         std::cout << std::endl;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+// runs every job in a manifest, writing each job's results to the summary file
+int exec_batch(const std::string& manifest, const BatchOptions& batch_options, const RunOptions& options){
+    typedef std::chrono::steady_clock clock;
+    try{
+        std::vector<BatchJob> jobs = read_manifest(manifest);
+        clock::time_point start = clock::now();
+        std::vector<JobResult> results = run_batch(jobs, batch_options.threads, [&options](Machine& vm){
+            configure_machine(vm, options);
+        }, batch_options.async_io);
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        write_summary(batch_options.summary, jobs, results);
+        size_t failed = 0;
+        for (const JobResult& result : results)
+            failed += !result.ok;
+        std::cerr << "Ran " << jobs.size() << " jobs (" << failed << " failed) on " << std::max<size_t>(batch_options.threads, 1) << " threads in ";
+        std::cerr << std::fixed << std::setprecision(3) << seconds * 1000 << " ms, see " << batch_options.summary << std::endl;
+        return failed ? 1 : 0;
+    }
+    catch (std::runtime_error& err){
+        print_error(err.what());
+        return -1;
+    }
+}
+
+// runs the program under the profiler, then reports where it spent its time, even if it stopped with an error
+int exec_profile(const std::string& in, const ProfileOptions& profile_options, const RunOptions& options){
+    typedef std::chrono::steady_clock clock;
+    Machine machine;
+    std::unique_ptr<Profiler> profiler;
+    std::string error;
+    double seconds = 0;
+    try{
+        // without fusion every instruction is dispatched on its own, so each one is counted
+        RunOptions profile_run = options;
+        profile_run.fusion = false;
+        configure_machine(machine, profile_run);
+        machine.load_file(in);
+        profiler.reset(new Profiler(machine.get_inst_count()));
+        machine.set_profiler(profiler.get());
+        if (profile_options.sample_us)
+            profiler->start_sampling(profile_options.sample_us);
+        clock::time_point start = clock::now();
+        try{
+            machine.exec();
+        }
+        catch (std::runtime_error& err){
+            error = err.what();
+        }
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+        profiler->stop_sampling();
+        profiler->report(std::cerr, machine.get_program(), seconds, profile_options.top);
+        if (!profile_options.collapsed.empty()){
+            std::ofstream file(profile_options.collapsed);
+            if (!file.good())
+                throw std::runtime_error("failed to write the collapsed stacks to " + profile_options.collapsed);
+            profiler->write_collapsed(file, machine.get_program());
+        }
+    }
+    catch (std::runtime_error& err){
+        error = err.what();
+    }
+    if (!error.empty()){
+        print_error(error);
+        return -1;
+    }
+    if (options.load_stats)
+        print_load_stats(machine.get_load_stats());
+    if (options.heap_stats)
+        print_heap_stats(machine.get_heap().get_stats());
+    if (options.output_stats)
+        print_output_stats(machine.get_output().get_stats(), seconds);
+    return 0;
+}
+
+// reports on the image cache, or removes every image from it
+int exec_cache(const std::string& action){
+    std::string dir = image_cache_dir();
+    if (dir.empty()){
+        print_error("there is no cache directory, set TVM_CACHE_DIR or HOME");
+        return 1;
+    }
+    if (action == "stats"){
+        CacheStats stats = image_cache_stats(dir);
+        std::cout << "Cache stats:\n";
+        std::cout << "\tdirectory: " << stats.dir << "\n";
+        std::cout << "\timages: " << stats.entries << " (" << stats.bytes << " bytes)\n";
+        std::cout << "\tstale: " << stats.stale << "\n";
+        std::cout << "\tcorrupt: " << stats.corrupt << std::endl;
+    }
+    else if (action == "clear"){
+        size_t bytes;
+        size_t removed = clear_image_cache(dir, bytes);
+        std::cout << "Removed " << removed << " images (" << bytes << " bytes) from " << dir << std::endl;
+    }
+    else{
+        print_error("unrecognized cache action: " + action + ". Expected 'stats' or 'clear'");
+        return 1;
+    }
+    return 0;
+}
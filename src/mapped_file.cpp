@@ -0,0 +1,57 @@
+#include <stdexcept>
+#include <fstream>
+
+#include "../inc/mapped_file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// prefault the whole mapping up front where the host supports it, as the file is read in full
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+MappedFile::MappedFile(const std::string& path){
+#ifdef HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("failed to read the binary");
+    struct stat info;
+    if (fstat(fd, &info) != 0){
+        close(fd);
+        throw std::runtime_error("failed to read the binary");
+    }
+    this->length = info.st_size;
+    if (this->length){
+        void* mem = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (mem != MAP_FAILED){
+            this->ptr = static_cast<const uint8_t*>(mem);
+            this->mapped = true;
+        }
+    }
+    close(fd);
+    if (this->mapped || !this->length)
+        return;
+#endif
+    // read the whole file into memory if it can't be mapped
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.good())
+        throw std::runtime_error("failed to read the binary");
+    this->length = file.tellg();
+    this->buffer.resize(this->length);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(this->buffer.data()), this->length);
+    this->ptr = this->buffer.data();
+}
+
+MappedFile::~MappedFile(){
+#ifdef HAS_MMAP
+    if (this->mapped)
+        munmap(const_cast<uint8_t*>(this->ptr), this->length);
+#endif
+}
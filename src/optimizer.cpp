@@ -0,0 +1,645 @@
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+
+#include "../inc/optimizer.h"
+#include "../inc/flow_graph.h"
+#include "../inc/machine.h"
+#include "../inc/mapped_file.h"
+
+// returns true if an instruction jumps, calls or spawns a thread at a label
+bool has_target(const Instruction& inst){
+    uint8_t op = inst.op_code >> 1;
+    return (op >= JUMP && op <= CAL) || op == SPAWN;
+}
+
+// returns true if an instruction may leave the code that follows it
+bool ends_block(const Instruction& inst){
+    uint8_t op = inst.op_code >> 1;
+    return op >= JUMP && op <= RET;
+}
+
+// returns the power of two a value is, or -1 if it isn't one
+static int log2_exact(uint64_t val){
+    if (!val || (val & (val - 1)))
+        return -1;
+    int shift = 0;
+    while (val >>= 1)
+        shift++;
+    return shift;
+}
+
+// builds an instruction loading a constant into a register
+static Instruction load_imm(uint8_t reg, uint64_t val){
+    Instruction inst;
+    inst.op_code = (LOAD_WORD << 1) | 0x01;
+    inst.registers = reg;
+    inst.extend = val;
+    return inst;
+}
+
+// builds an instruction copying one register to another
+static Instruction copy_reg(uint8_t dst, uint8_t src){
+    Instruction inst;
+    inst.op_code = COPY << 1;
+    inst.registers = (dst << 4) | src;
+    inst.extend = 0;
+    return inst;
+}
+
+/* computes an arithmetic or logical operation as the machine would, returning false if it can't
+   be computed ahead of time, like a division by zero, which stops the program when it's run */
+static bool evaluate(uint8_t op, uint64_t lhs, uint64_t rhs, uint64_t& result){
+    switch (op){
+        case ADD:
+            result = lhs + rhs;
+            return true;
+        case SUB:
+            result = lhs - rhs;
+            return true;
+        case MUL:
+            result = lhs * rhs;
+            return true;
+        case DIV:
+            if (!rhs)
+                return false;
+            result = lhs / rhs;
+            return true;
+        case REM:
+            if (!rhs)
+                return false;
+            result = lhs % rhs;
+            return true;
+        case COMP:
+            result = lhs == rhs;
+            return true;
+        case AND:
+            result = lhs & rhs;
+            return true;
+        case OR:
+            result = lhs | rhs;
+            return true;
+        case XOR:
+            result = lhs ^ rhs;
+            return true;
+        case SR:
+            if (rhs >= 64)
+                return false;
+            result = lhs >> rhs;
+            return true;
+        case SL:
+            if (rhs >= 64)
+                return false;
+            result = lhs << rhs;
+            return true;
+    }
+    return false;
+}
+
+/* replaces an operation on an immediate with a cheaper one that gives the same result, like a
+   multiplication by a power of two with a shift, returning false if there's nothing cheaper */
+static bool reduce(Instruction& inst){
+    uint8_t op = inst.op_code >> 1;
+    uint8_t dst = inst.registers >> 4;
+    uint8_t src = inst.registers & 0x0f;
+    uint64_t rhs = inst.extend;
+    int shift = log2_exact(rhs);
+    switch (op){
+        case ADD:
+        case SUB:
+        case OR:
+        case XOR:
+        case SR:
+        case SL:
+            if (rhs)
+                return false;
+            inst = copy_reg(dst, src);
+            return true;
+        case MUL:
+            if (!rhs)
+                inst = load_imm(dst, 0);
+            else if (rhs == 1)
+                inst = copy_reg(dst, src);
+            else if (shift > 0){
+                inst.op_code = (SL << 1) | 0x01;
+                inst.extend = shift;
+            }
+            else
+                return false;
+            return true;
+        case DIV:
+            if (rhs == 1)
+                inst = copy_reg(dst, src);
+            else if (shift > 0){
+                inst.op_code = (SR << 1) | 0x01;
+                inst.extend = shift;
+            }
+            else
+                return false;
+            return true;
+        case REM:
+            if (rhs == 1)
+                inst = load_imm(dst, 0);
+            else if (shift > 0){
+                inst.op_code = (AND << 1) | 0x01;
+                inst.extend = rhs - 1;
+            }
+            else
+                return false;
+            return true;
+        case AND:
+            if (!rhs)
+                inst = load_imm(dst, 0);
+            else if (rhs == UINT64_MAX)
+                inst = copy_reg(dst, src);
+            else
+                return false;
+            return true;
+    }
+    return false;
+}
+
+// returns the registers an instruction reads and writes
+InstEffects inst_effects(const Instruction& inst){
+    InstEffects effects;
+    uint8_t op = inst.op_code >> 1;
+    bool immediate = inst.op_code & 0x01;
+    uint8_t r1 = inst.registers >> 4;
+    uint8_t r2 = inst.registers & 0x0f;
+    switch (op){
+        case COPY:
+            if (immediate)
+                break;
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2);
+            effects.pure = true;
+            return effects;
+        case STORE_WORD:
+        case STORE_BYTE:
+            effects.uses = immediate ? REG_BIT(inst.registers) : REG_BIT(r1) | REG_BIT(r2);
+            return effects;
+        case LOAD_WORD:
+            // loadi only writes its register, while loadw reads guest memory, which can fail
+            if (immediate){
+                effects.defs = REG_BIT(inst.registers);
+                effects.pure = true;
+                return effects;
+            }
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2);
+            return effects;
+        case LOAD_BYTE:
+            if (immediate)
+                break;
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2);
+            return effects;
+        case ALLOC_MEM:
+        case ALLOC_STR:
+            return effects;
+        case LOAD_ADDR:
+            effects.defs = REG_BIT(inst.registers);
+            effects.pure = true;
+            return effects;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case REM:
+        case COMP:
+        case AND:
+        case OR:
+        case XOR:
+        case SR:
+        case SL:
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2) | (immediate ? 0 : REG_BIT(inst.extend));
+            // dividing by zero stops the program, so a division is only pure if its divisor is known
+            effects.pure = !((op == DIV || op == REM) && (!immediate || !inst.extend));
+            return effects;
+        case JUMP:
+            return effects;
+        case JEQ:
+        case JNE:
+        case JGT:
+        case JLT:
+            effects.uses = REG_BIT(r1) | REG_BIT(r2);
+            return effects;
+        case PUSH:
+        case PUSH_B:
+            effects.uses = immediate ? 0 : REG_BIT(r2);
+            return effects;
+        case POP:
+        case POP_B:
+        case GET_S:
+        case GET_I:
+        case HEAP_ALLOC:
+            effects.defs = REG_BIT(r2);
+            return effects;
+        case SPAWN:
+            // the new thread starts with a copy of every register
+            effects.defs = REG_BIT(r2);
+            effects.uses = ALL_REGS;
+            return effects;
+        case PUT_S:
+        case PUT_I:
+        case HEAP_FREE:
+            effects.uses = REG_BIT(r2);
+            return effects;
+        case JOIN:
+        case ATOMIC_LOAD:
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2);
+            return effects;
+        case ATOMIC_STORE:
+            effects.uses = immediate ? REG_BIT(r2) : REG_BIT(r1) | REG_BIT(r2);
+            return effects;
+        case FETCH_ADD:
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2) | (immediate ? 0 : REG_BIT(inst.extend));
+            return effects;
+        case COMP_SWAP:
+            effects.defs = REG_BIT(r1);
+            effects.uses = REG_BIT(r2) | REG_BIT(inst.extend >> 4) | REG_BIT(inst.extend);
+            return effects;
+        // vector registers aren't followed, so no vector operation is pure
+        case VEC_LOAD:
+        case VEC_SET:
+            effects.uses = REG_BIT(r2);
+            return effects;
+        case VEC_BROADCAST:
+            effects.uses = immediate ? 0 : REG_BIT(r2);
+            return effects;
+        case VEC_STORE:
+            effects.uses = REG_BIT(r1);
+            return effects;
+        case VEC_LANES:
+            return effects;
+        case VEC_REDUCE:
+        case VEC_GET:
+            effects.defs = REG_BIT(r1);
+            return effects;
+    }
+    // calls, returns and extensions can do anything
+    effects.uses = ALL_REGS;
+    effects.defs = ALL_REGS;
+    effects.barrier = true;
+    return effects;
+}
+
+Optimizer::Optimizer(TcodeImage& image) : image(image){
+    this->positions.resize(image.instructions.size() + 1);
+    for (size_t i = 0; i < this->positions.size(); i++)
+        this->positions[i] = i;
+}
+
+// marks an instruction of the original program as one code can be entered at, such as a label
+void Optimizer::add_entry(size_t pos){
+    this->added.push_back(pos);
+}
+
+/* returns where an instruction of the original program was moved to, or where the instruction
+   after it was if it was removed, or NO_POSITION if the code around it was removed */
+size_t Optimizer::new_position(size_t pos) const{
+    if (pos >= this->positions.size())
+        return pos;
+    return this->positions[pos];
+}
+
+// clears what the last pass found out about the program, before the next one
+void Optimizer::reset(){
+    size_t size = this->image.instructions.size();
+    this->entries.assign(size + 1, false);
+    this->removed.assign(size, false);
+    this->reloc_at.assign(size, -1);
+    for (size_t i = 0; i < this->image.relocations.size(); i++){
+        if (this->image.relocations[i].inst < size)
+            this->reloc_at[this->image.relocations[i].inst] = i;
+    }
+}
+
+// returns the instruction a jump, call or spawn goes to, labels point at the instruction before their target
+uint64_t Optimizer::target(size_t pos) const{
+    return this->image.instructions[pos].extend + 1;
+}
+
+// returns true if an object's instruction jumps to a label in another object, which isn't known until it's linked
+bool Optimizer::is_external(size_t pos) const{
+    int64_t reloc = this->reloc_at[pos];
+    if (reloc < 0)
+        return false;
+    const Relocation& relocation = this->image.relocations[reloc];
+    return relocation.kind == LABEL_RELOC && !(this->image.object_symbols[relocation.target].flags & SYMBOL_DEFINED);
+}
+
+// points a jump at a new target, taken from the jump at from, along with its relocation
+void Optimizer::retarget(size_t pos, uint64_t target, size_t from){
+    this->image.instructions[pos].extend = target - 1;
+    if (this->reloc_at[pos] >= 0 && this->reloc_at[from] >= 0)
+        this->image.relocations[this->reloc_at[pos]].target = this->image.relocations[this->reloc_at[from]].target;
+}
+
+// finds every instruction code can be entered at other than from the instruction before it
+void Optimizer::find_entries(){
+    const std::vector<Instruction>& code = this->image.instructions;
+    size_t size = code.size();
+    this->entries[0] = true;
+    for (size_t pos : this->added){
+        if (this->new_position(pos) <= size)
+            this->entries[this->new_position(pos)] = true;
+    }
+    for (size_t i = 0; i < size; i++){
+        if (has_target(code[i]) && !this->is_external(i) && this->target(i) < size)
+            this->entries[this->target(i)] = true;
+        if (ends_block(code[i]) || inst_effects(code[i]).barrier)
+            this->entries[i + 1] = true;
+    }
+    for (const Symbol& symbol : this->image.symbols){
+        if (symbol.kind == PROGRAM_SYMBOL && symbol.value <= size)
+            this->entries[symbol.value] = true;
+    }
+    for (const ObjectSymbol& symbol : this->image.object_symbols){
+        if (symbol.kind == PROGRAM_SYMBOL && (symbol.flags & SYMBOL_DEFINED) && symbol.value <= size)
+            this->entries[symbol.value] = true;
+    }
+}
+
+/* returns true if the program works out code addresses itself. Reading r0 or writing it outside
+   of a jump depends on where instructions are, as does setting the return address other than
+   by restoring it from the stack */
+bool Optimizer::computes_addresses() const{
+    for (const Instruction& inst : this->image.instructions){
+        InstEffects effects = inst_effects(inst);
+        if (effects.barrier)
+            continue;
+        if ((effects.uses | effects.defs) & REG_BIT(PROGRAM_COUNTER))
+            return true;
+        if ((effects.defs & REG_BIT(RET_ADDR)) && (inst.op_code >> 1) != POP)
+            return true;
+    }
+    return false;
+}
+
+// runs the passes of an optimization level, returning what they changed
+OptStats Optimizer::optimize(int level){
+    OptStats stats;
+    stats.original = this->image.instructions.size();
+    this->peephole(stats);
+    stats.instructions = this->image.instructions.size();
+    if (level < 2 || this->fixed_layout || this->image.object)
+        return stats;
+    this->reset();
+    this->find_entries();
+    FlowGraph graph(this->image.instructions, this->entries);
+    graph.optimize(stats);
+    this->move_code(graph.emit(this->image.instructions, stats));
+    // calls that were inlined and blocks that were moved leave more to fold and thread
+    this->peephole(stats);
+    stats.instructions = this->image.instructions.size();
+    return stats;
+}
+
+/* runs the peephole passes: local constant folding and strength reduction, removing redundant
+   moves and writes that are overwritten before they're read, threading jumps to jumps and
+   removing jumps to the next instruction */
+void Optimizer::peephole(OptStats& stats){
+    this->reset();
+    this->find_entries();
+    this->fixed_layout = this->computes_addresses();
+    this->fold_constants(stats);
+    if (!this->fixed_layout)
+        this->remove_dead_writes();
+    this->thread_jumps(stats);
+    if (!this->fixed_layout)
+        this->remove_jumps_to_next();
+    this->compact(stats);
+}
+
+/* follows the constants loaded into registers through each block, folding operations on them
+   and replacing operations with cheaper ones. Moves of a value a register already holds are removed */
+void Optimizer::fold_constants(OptStats& stats){
+    std::vector<Instruction>& code = this->image.instructions;
+    std::array<bool, 16> known;
+    std::array<uint64_t, 16> values;
+    known.fill(false);
+    for (size_t i = 0; i < code.size(); i++){
+        // nothing is known about the registers at an entry, or anywhere if any instruction might be one
+        if (this->entries[i] || this->fixed_layout)
+            known.fill(false);
+        Instruction& inst = code[i];
+        InstEffects effects = inst_effects(inst);
+        if (effects.barrier){
+            known.fill(false);
+            continue;
+        }
+        // r0 is the program counter, so anything using it is left as it is
+        if ((effects.uses | effects.defs) & REG_BIT(PROGRAM_COUNTER)){
+            for (size_t reg = 0; reg < 16; reg++){
+                if (effects.defs & REG_BIT(reg))
+                    known[reg] = false;
+            }
+            continue;
+        }
+        uint8_t op = inst.op_code >> 1;
+        if (op >= ADD && op <= SL){
+            uint8_t src = inst.registers & 0x0f;
+            uint64_t result;
+            if (!(inst.op_code & 0x01) && known[inst.extend & 0x0f]){
+                inst.op_code |= 0x01;
+                inst.extend = values[inst.extend & 0x0f];
+                stats.folded++;
+            }
+            if ((inst.op_code & 0x01) && known[src] && evaluate(op, values[src], inst.extend, result)){
+                inst = load_imm(inst.registers >> 4, result);
+                stats.folded++;
+            }
+            else if ((inst.op_code & 0x01) && reduce(inst))
+                stats.reduced++;
+            op = inst.op_code >> 1;
+        }
+        bool immediate = inst.op_code & 0x01;
+        uint8_t r1 = inst.registers >> 4;
+        uint8_t r2 = inst.registers & 0x0f;
+        if (op == COPY && !immediate){
+            if (r1 == r2 || (known[r1] && known[r2] && values[r1] == values[r2])){
+                this->removed[i] = !this->fixed_layout;
+                continue;
+            }
+            known[r1] = known[r2];
+            values[r1] = values[r2];
+        }
+        else if (op == LOAD_WORD && immediate){
+            uint8_t reg = inst.registers & 0x0f;
+            if (known[reg] && values[reg] == inst.extend){
+                this->removed[i] = !this->fixed_layout;
+                continue;
+            }
+            known[reg] = true;
+            values[reg] = inst.extend;
+        }
+        else{
+            effects = inst_effects(inst);
+            for (size_t reg = 0; reg < 16; reg++){
+                if (effects.defs & REG_BIT(reg))
+                    known[reg] = false;
+            }
+        }
+    }
+}
+
+/* removes pure instructions whose results are overwritten before they're read. Only writes in the
+   same block are followed, as anything may be read once the block is left */
+void Optimizer::remove_dead_writes(){
+    std::vector<Instruction>& code = this->image.instructions;
+    uint16_t live = ALL_REGS;
+    for (size_t i = code.size(); i-- > 0;){
+        if (this->entries[i + 1] || i + 1 == code.size())
+            live = ALL_REGS;
+        if (this->removed[i])
+            continue;
+        InstEffects effects = inst_effects(code[i]);
+        if (effects.barrier){
+            live = ALL_REGS;
+            continue;
+        }
+        if (effects.pure && effects.defs && !(effects.defs & live)){
+            this->removed[i] = true;
+            continue;
+        }
+        live = (live & ~effects.defs) | effects.uses;
+    }
+}
+
+// points jumps, calls and spawns that land on an unconditional jump at that jump's target instead
+void Optimizer::thread_jumps(OptStats& stats){
+    std::vector<Instruction>& code = this->image.instructions;
+    size_t size = code.size();
+    // the first instruction kept at or after each position
+    std::vector<size_t> next(size + 1, size);
+    for (size_t i = size; i-- > 0;)
+        next[i] = this->removed[i] ? next[i + 1] : i;
+    for (size_t i = 0; i < size; i++){
+        if (this->removed[i] || !has_target(code[i]) || this->is_external(i))
+            continue;
+        uint64_t dest = this->target(i);
+        size_t from = i;
+        for (size_t hops = 0; dest < size && hops < MAX_JUMP_CHAIN; hops++){
+            size_t hop = next[dest];
+            if (hop >= size || (code[hop].op_code >> 1) != JUMP || this->is_external(hop) || this->target(hop) == dest)
+                break;
+            dest = this->target(hop);
+            from = hop;
+        }
+        if (from != i){
+            this->retarget(i, dest, from);
+            stats.threaded++;
+        }
+    }
+}
+
+/* removes jumps to the instruction that would run next anyway. Jumps are visited from the end, so
+   removing one can make the jump before it one to the next instruction too */
+void Optimizer::remove_jumps_to_next(){
+    std::vector<Instruction>& code = this->image.instructions;
+    size_t size = code.size();
+    std::vector<size_t> next(size + 1, size);
+    for (size_t i = size; i-- > 0;){
+        uint8_t op = code[i].op_code >> 1;
+        if (!this->removed[i] && op >= JUMP && op <= JLT && !this->is_external(i)){
+            uint64_t dest = this->target(i);
+            if (dest > i && dest <= size && next[dest] == next[i + 1])
+                this->removed[i] = true;
+        }
+        next[i] = this->removed[i] ? next[i + 1] : i;
+    }
+}
+
+// drops the removed instructions, moving every jump, symbol and relocation along with the code
+void Optimizer::compact(OptStats& stats){
+    std::vector<Instruction>& code = this->image.instructions;
+    size_t size = code.size();
+    std::vector<size_t> moved(size + 1, 0);
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++){
+        moved[i] = count;
+        if (!this->removed[i])
+            count++;
+    }
+    moved[size] = count;
+    std::vector<Instruction> kept;
+    kept.reserve(count);
+    for (size_t i = 0; i < size; i++){
+        if (this->removed[i])
+            continue;
+        Instruction inst = code[i];
+        if (has_target(inst) && !this->is_external(i) && this->target(i) <= size)
+            inst.extend = moved[this->target(i)] - 1;
+        kept.push_back(inst);
+    }
+    code.swap(kept);
+    stats.removed += size - count;
+    std::vector<Relocation> relocations;
+    for (Relocation reloc : this->image.relocations){
+        if (this->removed[reloc.inst])
+            continue;
+        reloc.inst = moved[reloc.inst];
+        relocations.push_back(reloc);
+    }
+    this->image.relocations.swap(relocations);
+    this->move_code(moved);
+}
+
+/* moves the program's symbols, and the positions of the original instructions, to where the code
+   they refer to was moved. Symbols of code that was removed are dropped */
+void Optimizer::move_code(const std::vector<size_t>& moved){
+    for (size_t& pos : this->positions){
+        if (pos < moved.size())
+            pos = moved[pos];
+    }
+    std::vector<Symbol> symbols;
+    for (Symbol symbol : this->image.symbols){
+        if (symbol.kind == PROGRAM_SYMBOL && symbol.value < moved.size()){
+            if (moved[symbol.value] == NO_POSITION)
+                continue;
+            symbol.value = moved[symbol.value];
+        }
+        symbols.push_back(symbol);
+    }
+    this->image.symbols.swap(symbols);
+    for (ObjectSymbol& symbol : this->image.object_symbols){
+        if (symbol.kind == PROGRAM_SYMBOL && (symbol.flags & SYMBOL_DEFINED) && symbol.value < moved.size())
+            symbol.value = moved[symbol.value];
+    }
+}
+
+/* optimizes a program that was already built, or linked, and writes it to a new file. Its labels
+   stay entries, so the profiler and snapshots still find them */
+OptStats optimize_file(const std::string& in_path, const std::string& out_path, int level, int format, bool debug_info){
+    TcodeImage image;
+    {
+        MappedFile file(in_path);
+        TcodeView view = parse_tcode(file.data(), file.size());
+        if (view.flags & TCODE_OBJECT_FLAG)
+            throw std::runtime_error(in_path + " is an object file, link it before optimizing it");
+        image.instructions.reserve(view.inst_count);
+        for (size_t i = 0; i < view.inst_count; i++)
+            image.instructions.push_back(view.instruction(i));
+        image.strings = std::move(view.strings);
+        image.data_labels = std::move(view.data_labels);
+        image.symbols = std::move(view.symbols);
+    }
+    Optimizer optimizer(image);
+    OptStats stats = optimizer.optimize(level);
+    if (!debug_info)
+        image.symbols.clear();
+    // moving blocks can change the order of the labels, which are stored sorted
+    std::sort(image.symbols.begin(), image.symbols.end(), [](const Symbol& a, const Symbol& b){
+        return (a.kind != b.kind) ? a.kind < b.kind : a.value < b.value;
+    });
+    std::ofstream out(out_path, std::ios::binary);
+    if (!out.good())
+        throw std::runtime_error("failed to write the output file");
+    write_tcode(out, image, format);
+    return stats;
+}
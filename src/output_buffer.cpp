@@ -0,0 +1,162 @@
+#include <stdexcept>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "../inc/output_buffer.h"
+
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// every two digit number, so integers can be formatted two digits at a time
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+OutputBuffer::OutputBuffer(int fd, int policy) : fd(fd){
+    this->set_policy(policy);
+}
+
+OutputBuffer::OutputBuffer(std::ostream* stream, int policy) : stream(stream){
+    this->set_policy(policy);
+}
+
+// writes anything left in the buffer, errors can't be reported from here
+OutputBuffer::~OutputBuffer(){
+    try{
+        this->flush();
+    }
+    catch (...){
+    }
+}
+
+// sets when the buffer is written out, resolving the automatic policy by where the output goes
+void OutputBuffer::set_policy(int policy){
+    if (policy == FLUSH_AUTO)
+        policy = (this->fd >= 0 && isatty(this->fd)) ? FLUSH_LINE : FLUSH_FULL;
+    this->policy = policy;
+}
+
+// makes room for the given number of bytes, writing out the buffer if it's full
+void OutputBuffer::reserve(size_t size){
+    // the buffer is allocated on the first write, so machines that never print don't pay for it
+    if (!this->buffer){
+        this->capacity = OUTPUT_BUFFER_SIZE;
+        this->buffer.reset(new char[this->capacity]);
+    }
+    if (size <= this->capacity - this->used)
+        return;
+    if (this->policy != FLUSH_EXIT){
+        this->flush();
+        return;
+    }
+    size_t capacity = this->capacity;
+    while (size > capacity - this->used)
+        capacity *= 2;
+    char* grown = new char[capacity];
+    std::memcpy(grown, this->buffer.get(), this->used);
+    this->buffer.reset(grown);
+    this->capacity = capacity;
+}
+
+// appends bytes to the buffer
+void OutputBuffer::write(const char* data, size_t size){
+    if (this->policy != FLUSH_EXIT && size >= OUTPUT_BUFFER_SIZE){
+        // large writes go out directly, after what's already buffered
+        this->emit(data, size);
+        return;
+    }
+    this->reserve(size);
+    std::memcpy(this->buffer.get() + this->used, data, size);
+    this->used += size;
+    if (this->policy == FLUSH_LINE && std::memchr(data, '\n', size))
+        this->flush();
+}
+
+// appends an unsigned integer in decimal
+void OutputBuffer::write_uint(uint64_t val){
+    char digits[20];
+    char* pos = digits + sizeof(digits);
+    while (val >= 100){
+        const char* pair = digit_pairs + (val % 100) * 2;
+        val /= 100;
+        *--pos = pair[1];
+        *--pos = pair[0];
+    }
+    if (val >= 10){
+        *--pos = digit_pairs[val * 2 + 1];
+        *--pos = digit_pairs[val * 2];
+    }
+    else
+        *--pos = '0' + val;
+    size_t size = digits + sizeof(digits) - pos;
+    // digits never hold a newline, so this never needs to flush by line
+    this->reserve(size);
+    std::memcpy(this->buffer.get() + this->used, pos, size);
+    this->used += size;
+}
+
+// writes out everything in the buffer
+void OutputBuffer::flush(){
+    if (this->used)
+        this->emit(nullptr, 0);
+    else if (this->stream)
+        this->stream->flush();
+}
+
+// writes the buffer followed by the extra bytes, then empties the buffer
+void OutputBuffer::emit(const char* extra, size_t extra_size){
+    size_t total = this->used + extra_size;
+    this->stats.bytes += total;
+    this->stats.writes++;
+    if (this->stream){
+        this->stream->write(this->buffer.get(), this->used);
+        this->stream->write(extra, extra_size);
+        this->stream->flush();
+        this->used = 0;
+        return;
+    }
+    // anything written through the standard streams goes first, so output stays in order
+    if (this->fd == STDOUT_FILENO){
+        std::cout.flush();
+        std::fflush(stdout);
+    }
+    iovec parts[2] = {{this->buffer.get(), this->used}, {const_cast<char*>(extra), extra_size}};
+    iovec* part = parts;
+    int part_count = extra_size ? 2 : 1;
+    this->used = 0;
+    while (total){
+        ssize_t written = writev(this->fd, part, part_count);
+        if (written < 0){
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                pollfd entry {this->fd, POLLOUT, 0};
+                poll(&entry, 1, -1);
+                continue;
+            }
+            throw std::runtime_error(std::string("failed to write output: ") + std::strerror(errno));
+        }
+        // skip past what was written, which may end partway through a part
+        total -= written;
+        while (part_count && static_cast<size_t>(written) >= part->iov_len){
+            written -= part->iov_len;
+            part++;
+            part_count--;
+        }
+        if (part_count){
+            part->iov_base = static_cast<char*>(part->iov_base) + written;
+            part->iov_len -= written;
+        }
+    }
+}
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "../inc/profiler.h"
+#include "../inc/program.h"
+
+// the name of each operation family, by the family's index, followed by the vector operations
+static const char* family_names[] = {"memory", "logic", "jump", "stack", "io", "heap", "extension", "thread", "vector"};
+
+// the vector operations take up the last op codes of the thread family, but are reported on their own
+static size_t family_row(const DecodedOp& op){
+    return op.op_code >= VEC_LOAD ? FAMILY_COUNT : op.family;
+}
+
+// the name given to the code that runs before any function is called
+#define ROOT_FRAME "main"
+
+Profiler::Profiler(size_t inst_count) : instruction_counts(inst_count, 0), instruction_samples(inst_count, 0){
+    this->nodes.push_back({0, 0});
+}
+
+Profiler::~Profiler(){
+    this->stop_sampling();
+}
+
+// follows a call into the function at the given index
+void Profiler::call(uint64_t target){
+    if (this->stack.size() >= MAX_PROFILE_DEPTH){
+        this->overflow++;
+        return;
+    }
+    uint64_t key = (static_cast<uint64_t>(this->node) << 32) | (target & 0xffffffff);
+    auto itt = this->children.find(key);
+    if (itt == this->children.end()){
+        itt = this->children.emplace(key, this->nodes.size()).first;
+        this->nodes.push_back({this->node, target});
+    }
+    this->stack.push_back(this->node);
+    this->node = itt->second;
+}
+
+// follows a return to the caller, a ret outside of any call is ignored
+void Profiler::ret(){
+    if (this->overflow){
+        this->overflow--;
+        return;
+    }
+    if (this->stack.empty())
+        return;
+    this->node = this->stack.back();
+    this->stack.pop_back();
+}
+
+// starts a thread that asks for a sample at each interval
+void Profiler::start_sampling(uint32_t interval_us){
+    this->interval_us = interval_us;
+    this->sampling = true;
+    this->sampler = std::thread([this](){
+        while (this->sampling){
+            std::this_thread::sleep_for(std::chrono::microseconds(this->interval_us));
+            this->sample_due.store(true, std::memory_order_relaxed);
+        }
+    });
+}
+
+void Profiler::stop_sampling(){
+    this->sampling = false;
+    if (this->sampler.joinable())
+        this->sampler.join();
+}
+
+// records where the machine is when a sample is due
+void Profiler::sample(uint64_t pc){
+    this->sample_due.store(false, std::memory_order_relaxed);
+    this->instruction_samples[pc]++;
+    this->nodes[this->node].samples++;
+}
+
+// the program labels, sorted by the index of the instruction they label
+static std::vector<const Symbol*> program_labels(const Program& program){
+    std::vector<const Symbol*> labels;
+    for (const Symbol& symbol : program.get_symbols()){
+        if (symbol.kind == PROGRAM_SYMBOL)
+            labels.push_back(&symbol);
+    }
+    std::stable_sort(labels.begin(), labels.end(), [](const Symbol* a, const Symbol* b){
+        return a->value < b->value;
+    });
+    return labels;
+}
+
+// returns the label enclosing an instruction, or null for instructions before the first label
+static const Symbol* enclosing_label(const std::vector<const Symbol*>& labels, uint64_t pc){
+    auto itt = std::upper_bound(labels.begin(), labels.end(), pc, [](uint64_t val, const Symbol* label){
+        return val < label->value;
+    });
+    return (itt == labels.begin()) ? nullptr : *(itt - 1);
+}
+
+// names a function by the label it was called at, or its index if the program has no debug symbols
+static std::string function_name(const std::vector<const Symbol*>& labels, uint64_t target){
+    const Symbol* label = enclosing_label(labels, target);
+    if (label && label->value == target)
+        return label->name;
+    return "@" + std::to_string(target);
+}
+
+static double percent(uint64_t part, uint64_t total){
+    return total ? 100.0 * part / total : 0;
+}
+
+/* prints the instructions executed under each label, the hottest instructions, and the
+   instructions executed by each operation family, along with the samples taken in each */
+void Profiler::report(std::ostream& out, const Program& program, double seconds, size_t top){
+    std::vector<const Symbol*> labels = program_labels(program);
+    const DecodedCode& code = program.get_code();
+    uint64_t total = 0, total_samples = 0;
+    for (size_t i = 0; i < this->instruction_counts.size(); i++){
+        total += this->instruction_counts[i];
+        total_samples += this->instruction_samples[i];
+    }
+    bool sampled = this->interval_us != 0;
+    out << "Profile:\n";
+    out << "\tinstructions: " << total << "\n";
+    out << std::fixed << std::setprecision(3);
+    out << "\trun time: " << seconds * 1000 << " ms\n";
+    if (sampled)
+        out << "\tsamples: " << total_samples << " (every " << this->interval_us << " us)\n";
+    out << std::setprecision(1);
+
+    // total the counts under each label, in the order the labels appear
+    std::vector<std::pair<const Symbol*, std::pair<uint64_t, uint64_t> > > by_label;
+    std::unordered_map<const Symbol*, size_t> label_index;
+    for (size_t i = 0; i < this->instruction_counts.size(); i++){
+        if (!this->instruction_counts[i] && !this->instruction_samples[i])
+            continue;
+        const Symbol* label = enclosing_label(labels, i);
+        auto itt = label_index.find(label);
+        if (itt == label_index.end()){
+            itt = label_index.emplace(label, by_label.size()).first;
+            by_label.push_back({label, {0, 0}});
+        }
+        by_label[itt->second].second.first += this->instruction_counts[i];
+        by_label[itt->second].second.second += this->instruction_samples[i];
+    }
+    std::stable_sort(by_label.begin(), by_label.end(), [](const auto& a, const auto& b){
+        return a.second.first > b.second.first;
+    });
+    out << "Labels:\n";
+    out << "\t" << std::left << std::setw(24) << "label" << std::right << std::setw(16) << "instructions" << std::setw(8) << "%";
+    if (sampled)
+        out << std::setw(12) << "samples" << std::setw(8) << "%";
+    out << "\n";
+    for (size_t i = 0; i < by_label.size() && i < top; i++){
+        const auto& entry = by_label[i];
+        out << "\t" << std::left << std::setw(24) << (entry.first ? entry.first->name : "<start>");
+        out << std::right << std::setw(16) << entry.second.first << std::setw(8) << percent(entry.second.first, total);
+        if (sampled)
+            out << std::setw(12) << entry.second.second << std::setw(8) << percent(entry.second.second, total_samples);
+        out << "\n";
+    }
+
+    // the hottest instructions, by count
+    std::vector<size_t> order;
+    for (size_t i = 0; i < this->instruction_counts.size(); i++){
+        if (this->instruction_counts[i])
+            order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b){
+        return this->instruction_counts[a] > this->instruction_counts[b];
+    });
+    out << "Hot instructions:\n";
+    out << "\t" << std::left << std::setw(8) << "index" << std::setw(24) << "location" << std::setw(10) << "family";
+    out << std::right << std::setw(16) << "count" << std::setw(8) << "%";
+    if (sampled)
+        out << std::setw(12) << "samples" << std::setw(8) << "%";
+    out << "\n";
+    for (size_t i = 0; i < order.size() && i < top; i++){
+        size_t pc = order[i];
+        const Symbol* label = enclosing_label(labels, pc);
+        std::string location = label ? label->name + "+" + std::to_string(pc - label->value) : "<start>+" + std::to_string(pc);
+        out << "\t" << std::left << std::setw(8) << pc << std::setw(24) << location << std::setw(10) << family_names[family_row(code.ops[pc])];
+        out << std::right << std::setw(16) << this->instruction_counts[pc] << std::setw(8) << percent(this->instruction_counts[pc], total);
+        if (sampled)
+            out << std::setw(12) << this->instruction_samples[pc] << std::setw(8) << percent(this->instruction_samples[pc], total_samples);
+        out << "\n";
+    }
+
+    // the instructions executed by each operation family
+    uint64_t families[FAMILY_COUNT + 1] = {};
+    for (size_t i = 0; i < this->instruction_counts.size(); i++)
+        families[family_row(code.ops[i])] += this->instruction_counts[i];
+    out << "Families:\n";
+    for (size_t i = 0; i <= FAMILY_COUNT; i++){
+        if (families[i])
+            out << "\t" << std::left << std::setw(24) << family_names[i] << std::right << std::setw(16) << families[i] << std::setw(8) << percent(families[i], total) << "\n";
+    }
+    out << std::flush;
+}
+
+/* writes the call tree as collapsed stacks, one line per path of calls with the frames separated
+   by semicolons, followed by the samples taken in it, or the instructions executed if the
+   profile wasn't sampled. This is the format flamegraph tools read */
+void Profiler::write_collapsed(std::ostream& out, const Program& program){
+    std::vector<const Symbol*> labels = program_labels(program);
+    std::vector<std::string> paths(this->nodes.size());
+    paths[0] = ROOT_FRAME;
+    // nodes are only ever added after their parent, so each parent's path is already built
+    for (size_t i = 1; i < this->nodes.size(); i++)
+        paths[i] = paths[this->nodes[i].parent] + ";" + function_name(labels, this->nodes[i].function);
+    for (size_t i = 0; i < this->nodes.size(); i++){
+        uint64_t weight = this->interval_us ? this->nodes[i].samples : this->nodes[i].instructions;
+        if (weight)
+            out << paths[i] << " " << weight << "\n";
+    }
+}
@@ -0,0 +1,90 @@
+#include <stdexcept>
+#include <chrono>
+
+#include "../inc/program.h"
+#include "../inc/fusion.h"
+#include "../inc/mapped_file.h"
+
+/* maps a bytecode file of either version into memory and decodes its strings and instructions
+   straight from the mapping. With the cache enabled, a file that's been decoded against the same
+   extensions before is read from its cached image instead, and a file that hasn't is cached once
+   it's decoded. The program is verified after it's read either way, so the images stay the same
+   whether or not programs are verified */
+std::shared_ptr<const Program> Program::load(const std::string& file_path, const ExtensionTable& extensions, bool fusion, bool cache, int verify){
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    std::shared_ptr<Program> program = std::make_shared<Program>();
+    MappedFile file(file_path);
+    program->extensions = extensions;
+    // resolve each operation family's function once, for the decoder to look up
+    for (size_t i = 0; i < FAMILY_COUNT; i++)
+        program->code.families[i] = program->get_extension(i << 4);
+    std::string image_path;
+    ImageKey key;
+    if (cache){
+        std::string cache_dir = image_cache_dir();
+        if (!cache_dir.empty()){
+            key = image_key(file.data(), file.size(), program->code.families, fusion);
+            image_path = image_cache_path(cache_dir, key);
+            program->load_stats.cached = program->read_image(image_path, key);
+        }
+    }
+    if (!program->load_stats.cached){
+        TcodeView view = parse_tcode(file.data(), file.size());
+        if (view.flags & TCODE_OBJECT_FLAG)
+            throw std::runtime_error("the binary is an object file, link it with 'tvm link' before running it");
+        program->strings = std::move(view.strings);
+        program->data_labels = std::move(view.data_labels);
+        program->symbols = std::move(view.symbols);
+        program->code.reserve(view.inst_count);
+        for (size_t i = 0; i < view.inst_count; i++)
+            program->code.append(view.instruction(i));
+        if (fusion)
+            program->fusion_counts = fuse_instructions(program->code);
+        if (!image_path.empty())
+            program->write_image(image_path, key);
+    }
+    if (verify != VERIFY_OFF)
+        program->verify(verify == VERIFY_STRICT);
+    program->load_stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    program->load_stats.bytes = file.size();
+    program->load_stats.instructions = program->code.size();
+    program->load_stats.strings = program->strings.size();
+    return program;
+}
+
+/* verifies the decoded program, preparing it for the unchecked interpreter if it passes. A safe
+   program that fails is still run with every check in place, unless verification is strict */
+void Program::verify(bool strict){
+    VerifyResult result = verify_code(this->code, this->strings.size(), strict);
+    if (!result.verified){
+        if (strict || !result.safe)
+            throw std::runtime_error("the program failed verification: " + result.error);
+        this->load_stats.verify_error = result.error;
+        return;
+    }
+    specialize_code(this->code, result);
+    this->load_stats.verified = true;
+}
+
+// returns the program string at a given index
+const std::string& Program::get_str(size_t index) const{
+    if (index >= this->strings.size())
+        throw std::runtime_error("invalid string index");
+    return this->strings[index];
+}
+
+// returns the index of the instruction a program label points to, from the program's debug symbols
+size_t Program::find_label(const std::string& name) const{
+    for (const Symbol& symbol : this->symbols){
+        if (symbol.kind == PROGRAM_SYMBOL && symbol.name == name)
+            return symbol.value;
+    }
+    throw std::runtime_error("no program label named " + name + " (the program may have been built with --strip)");
+}
+
+// returns the function for an operation family, or null if no extension implements it
+exec_func Program::get_extension(uint8_t op_family) const{
+    auto itt = this->extensions.find(op_family);
+    return (itt == this->extensions.end()) ? nullptr : itt->second;
+}
@@ -1,40 +1,151 @@
 #include <stdexcept>
 #include <cstring>
+#include <mutex>
+#include <signal.h>
+
 #include "../inc/stack.hpp"
 
-Stack::Stack(){
-    this->stack_ptr = new uint8_t[1000000];
-    this->init_ptr = stack_ptr;
+#ifdef STACK_GUARD_PAGES
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Stack::Stack(size_t size){
+    this->allocate(size);
 }
 
 Stack::~Stack(){
-    delete this->init_ptr;
-    this->stack_ptr = nullptr;
-    this->init_ptr = nullptr;
-}
-
-// pushes a new value on to the stack
-void Stack::push(uint8_t* data, uint8_t data_size){
-    // store the new data to the stack
-    if (this->capacity < data_size)
-        throw std::runtime_error("stack overflow");
-    std::memcpy(this->stack_ptr, data, data_size);
-    this->capacity -= data_size + 1;
-    // store the allocated size as metadata
-    stack_ptr += data_size;
-    *stack_ptr = data_size;
-    stack_ptr++;
-}
-
-// pops a value off the stack
-uint8_t* Stack::pop(){
-    if (this->is_empty())
-        throw std::runtime_error("cannot pop a value from an empty stack");
-    // read the size of the last allocated value
-    stack_ptr--;
-    uint8_t data_size = *(this->stack_ptr);
-    // get the value of the last allocated value
-    this->capacity += data_size + 1;
-    stack_ptr -= data_size;
-    return stack_ptr;
-}
\ No newline at end of file
+    this->release();
+}
+
+// replaces the stack with an empty one of the given size in bytes
+void Stack::resize(size_t size){
+    this->release();
+    this->allocate(size);
+}
+
+// maps the slots, rounded up to whole pages, with a guard page on either side
+void Stack::allocate(size_t size){
+    if (size < sizeof(uint64_t))
+        throw std::runtime_error("the stack must hold at least one value");
+#ifdef STACK_GUARD_PAGES
+    this->page_size = sysconf(_SC_PAGESIZE);
+    size_t data_size = (size + this->page_size - 1) / this->page_size * this->page_size;
+    this->region_size = data_size + 2 * this->page_size;
+    void* mem = mmap(nullptr, this->region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::runtime_error("failed to allocate the stack");
+    this->region = static_cast<uint8_t*>(mem);
+    if (mprotect(this->region + this->page_size, data_size, PROT_READ | PROT_WRITE) != 0){
+        munmap(this->region, this->region_size);
+        this->region = nullptr;
+        throw std::runtime_error("failed to allocate the stack");
+    }
+    this->base = reinterpret_cast<uint64_t*>(this->region + this->page_size);
+    this->slots = data_size / sizeof(uint64_t);
+#else
+    this->slots = size / sizeof(uint64_t);
+    this->region_size = this->slots * sizeof(uint64_t);
+    this->region = static_cast<uint8_t*>(std::malloc(this->region_size));
+    if (!this->region)
+        throw std::runtime_error("failed to allocate the stack");
+    this->base = reinterpret_cast<uint64_t*>(this->region);
+#endif
+    this->top = this->base;
+}
+
+void Stack::release(){
+    if (!this->region)
+        return;
+#ifdef STACK_GUARD_PAGES
+    munmap(this->region, this->region_size);
+#else
+    std::free(this->region);
+#endif
+    this->region = nullptr;
+    this->base = nullptr;
+    this->top = nullptr;
+}
+
+// checks if an address lies on one of the stack's guard pages
+bool Stack::in_guard(const void* addr) const{
+#ifdef STACK_GUARD_PAGES
+    const uint8_t* ptr = static_cast<const uint8_t*>(addr);
+    if (!this->region || ptr < this->region || ptr >= this->region + this->region_size)
+        return false;
+    return ptr < this->region + this->page_size || ptr >= this->region + this->region_size - this->page_size;
+#else
+    return false;
+#endif
+}
+
+#ifdef STACK_GUARD_PAGES
+// the stack being run on this thread, and where to return to if it faults
+static thread_local const Stack* guarded_stack {nullptr};
+static thread_local sigjmp_buf* guard_env {nullptr};
+static struct sigaction previous_action;
+
+// jumps out of a fault on the running stack's guard pages, and hands any other fault back to the previous handler
+static void guard_handler(int sig, siginfo_t* info, void* context){
+    if (guarded_stack && guarded_stack->in_guard(info->si_addr))
+        siglongjmp(*guard_env, 1);
+    // returning re-runs the faulting instruction under the restored handler
+    sigaction(SIGSEGV, &previous_action, nullptr);
+}
+
+// a thread's alternate signal stack, which is disabled and freed when the thread exits
+struct AltStack{
+    AltStack(){
+        stack_t alt_stack;
+        alt_stack.ss_size = SIGSTKSZ;
+        alt_stack.ss_sp = std::malloc(alt_stack.ss_size);
+        alt_stack.ss_flags = 0;
+        if (alt_stack.ss_sp && sigaltstack(&alt_stack, nullptr) != 0){
+            std::free(alt_stack.ss_sp);
+            alt_stack.ss_sp = nullptr;
+        }
+        this->memory = alt_stack.ss_sp;
+    }
+    ~AltStack(){
+        if (!this->memory)
+            return;
+        stack_t disabled;
+        std::memset(&disabled, 0, sizeof(disabled));
+        disabled.ss_flags = SS_DISABLE;
+        sigaltstack(&disabled, nullptr);
+        std::free(this->memory);
+    }
+    void* memory {nullptr};
+};
+
+// the handler runs on its own stack, so the fault is reported even if the host stack is exhausted
+static void install_guard_handler(){
+    static thread_local AltStack alt_stack;
+    static std::once_flag installed;
+    std::call_once(installed, [](){
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = guard_handler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_action);
+    });
+}
+#endif
+
+/* makes faults on the given stack's guard pages jump to env on this thread. The caller must have
+   set env with sigsetjmp, and disarm the guard before leaving the frame that set it */
+void Stack::arm_guard(const Stack* stack, sigjmp_buf* env){
+#ifdef STACK_GUARD_PAGES
+    install_guard_handler();
+    guard_env = env;
+    guarded_stack = stack;
+#endif
+}
+
+void Stack::disarm_guard(){
+#ifdef STACK_GUARD_PAGES
+    guarded_stack = nullptr;
+    guard_env = nullptr;
+#endif
+}
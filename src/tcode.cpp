@@ -0,0 +1,356 @@
+#include <stdexcept>
+#include <cstring>
+#include <array>
+
+#include "../inc/tcode.h"
+#include "../inc/util.hpp"
+
+// reads a little-endian value
+template <typename T>
+static T read_le(const uint8_t* data){
+    T retval = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        retval |= static_cast<T>(data[i]) << (8 * i);
+    return retval;
+}
+
+// appends a little-endian value to a buffer
+template <typename T>
+static void write_le(std::vector<uint8_t>& out, T val){
+    for (size_t i = 0; i < sizeof(T); i++)
+        out.push_back((val >> (8 * i)) & 0xff);
+}
+
+// pads a buffer with zeroes to a multiple of the given alignment
+static void pad_to(std::vector<uint8_t>& out, size_t align){
+    while (out.size() % align)
+        out.push_back(0);
+}
+
+// returns the character an escape sequence in a version 1 string stands for
+static char unescape(char chr){
+    switch (chr){
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case 'b':
+            return '\b';
+        case 'v':
+            return '\v';
+        case 'f':
+            return '\f';
+        case 'r':
+            return '\r';
+        default:
+            return chr;
+    }
+}
+
+// reads a string literal wrapped in quotations, starting after the opening quotation, and returns the position after the closing one
+static size_t read_str(const uint8_t* data, size_t size, size_t pos, std::string& out){
+    while (pos < size && data[pos] != '"'){
+        char chr = data[pos++];
+        if (chr == '\\'){
+            if (pos >= size)
+                throw std::runtime_error("malformed binary (invalid string)");
+            chr = unescape(data[pos++]);
+        }
+        out.push_back(chr);
+    }
+    if (pos >= size)
+        throw std::runtime_error("malformed binary (invalid string)");
+    return pos + 1;
+}
+
+// reads a version 1 file: quoted strings terminated by a null byte, then the instructions
+static void parse_v1(const uint8_t* data, size_t size, TcodeView& view){
+    size_t pos = 0;
+    while (pos < size && data[pos] != 0x0){
+        view.strings.emplace_back();
+        pos = read_str(data, size, pos + 1, view.strings.back());
+    }
+    pos++;
+    // the rest of the file is instructions, so they can be counted up front
+    view.code = data + pos;
+    view.inst_count = (pos < size) ? (size - pos) / INSTRUCTION_BYTES : 0;
+}
+
+// bounds checked reads from within a version 2 section
+class SectionReader{
+    public:
+        SectionReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+        uint32_t u32(){
+            this->require(4);
+            uint32_t retval = read_le<uint32_t>(this->data + this->pos);
+            this->pos += 4;
+            return retval;
+        }
+        uint64_t u64(){
+            this->require(8);
+            uint64_t retval = read_le<uint64_t>(this->data + this->pos);
+            this->pos += 8;
+            return retval;
+        }
+        std::string str(size_t length){
+            this->require(length);
+            std::string retval(reinterpret_cast<const char*>(this->data + this->pos), length);
+            this->pos += (length + 3) & ~static_cast<size_t>(3);
+            return retval;
+        }
+    private:
+        void require(size_t length){
+            if (length > this->size || this->pos > this->size - length)
+                throw std::runtime_error("malformed binary (truncated section)");
+        }
+        const uint8_t* data;
+        size_t size;
+        size_t pos {0};
+};
+
+// reads a version 2 file through its section table
+static void parse_v2(const uint8_t* data, size_t size, TcodeView& view){
+    if (size < TCODE_HEADER_BYTES)
+        throw std::runtime_error("malformed binary (truncated header)");
+    view.version = read_le<uint16_t>(data + 4);
+    if (view.version != TCODE_VERSION)
+        throw std::runtime_error("unsupported tcode version: " + std::to_string(view.version));
+    size_t section_count = read_le<uint16_t>(data + 6);
+    view.flags = read_le<uint32_t>(data + 8);
+    if (section_count > (size - TCODE_HEADER_BYTES) / TCODE_SECTION_BYTES)
+        throw std::runtime_error("malformed binary (truncated section table)");
+    for (size_t i = 0; i < section_count; i++){
+        const uint8_t* entry = data + TCODE_HEADER_BYTES + i * TCODE_SECTION_BYTES;
+        uint32_t type = read_le<uint32_t>(entry);
+        uint64_t offset = read_le<uint64_t>(entry + 8);
+        uint64_t length = read_le<uint64_t>(entry + 16);
+        if (offset % TCODE_ALIGN || offset > size || length > size - offset)
+            throw std::runtime_error("malformed binary (invalid section)");
+        SectionReader reader(data + offset, length);
+        uint32_t count;
+        switch (type){
+            case CODE_SECTION:
+                if (length % TCODE_INST_BYTES)
+                    throw std::runtime_error("malformed binary (invalid code section)");
+                view.code = data + offset;
+                view.inst_count = length / TCODE_INST_BYTES;
+                break;
+            case STRING_SECTION:
+                count = reader.u32();
+                view.strings.reserve(count);
+                for (size_t j = 0; j < count; j++)
+                    view.strings.push_back(reader.str(reader.u32()));
+                break;
+            case DATA_SECTION:
+                count = reader.u32();
+                for (size_t j = 0; j < count; j++){
+                    DataLabel label;
+                    label.type = reader.u32();
+                    label.str_index = reader.u32();
+                    label.size = reader.u64();
+                    view.data_labels.push_back(label);
+                }
+                break;
+            case DEBUG_SECTION:
+                count = reader.u32();
+                for (size_t j = 0; j < count; j++){
+                    Symbol symbol;
+                    symbol.kind = reader.u32();
+                    uint32_t name_length = reader.u32();
+                    symbol.value = reader.u64();
+                    symbol.name = reader.str(name_length);
+                    view.symbols.push_back(symbol);
+                }
+                break;
+            case SYMBOL_SECTION:
+                count = reader.u32();
+                for (size_t j = 0; j < count; j++){
+                    ObjectSymbol symbol;
+                    symbol.kind = reader.u32();
+                    symbol.flags = reader.u32();
+                    uint32_t name_length = reader.u32();
+                    reader.u32();
+                    symbol.value = reader.u64();
+                    symbol.name = reader.str(name_length);
+                    view.object_symbols.push_back(symbol);
+                }
+                break;
+            case RELOC_SECTION:
+                count = reader.u32();
+                for (size_t j = 0; j < count; j++){
+                    Relocation reloc;
+                    reloc.inst = reader.u64();
+                    reloc.kind = reader.u32();
+                    reloc.target = reader.u32();
+                    view.relocations.push_back(reloc);
+                }
+                break;
+            default:
+                // sections from newer writers are skipped
+                break;
+        }
+    }
+}
+
+// reads the sections of a tcode file of either version
+TcodeView parse_tcode(const uint8_t* data, size_t size){
+    TcodeView view;
+    if (size >= 4 && std::memcmp(data, TCODE_MAGIC, 4) == 0)
+        parse_v2(data, size, view);
+    else
+        parse_v1(data, size, view);
+    return view;
+}
+
+// decodes the instruction at the given index
+Instruction TcodeView::instruction(size_t index) const{
+    Instruction retval;
+    if (this->version == 1){
+        const uint8_t* inst = this->code + index * INSTRUCTION_BYTES;
+        retval.op_code = inst[0];
+        retval.registers = inst[1];
+        retval.extend = merge_bytes<uint64_t>(inst + 2);
+    }
+    else{
+        const uint8_t* inst = this->code + index * TCODE_INST_BYTES;
+        retval.op_code = inst[0];
+        retval.registers = inst[1];
+        retval.extend = read_le<uint64_t>(inst + 8);
+    }
+    return retval;
+}
+
+// escapes a string so it can be stored between quotations in a version 1 file
+static std::string escape_str(const std::string& str){
+    std::string retval;
+    for (char chr : str){
+        switch (chr){
+            case '\\':
+                retval += "\\\\";
+                break;
+            case '"':
+                retval += "\\\"";
+                break;
+            case '\n':
+                retval += "\\n";
+                break;
+            case '\t':
+                retval += "\\t";
+                break;
+            case '\r':
+                retval += "\\r";
+                break;
+            default:
+                retval.push_back(chr);
+        }
+    }
+    return retval;
+}
+
+// writes a version 1 file, which only holds the strings and instructions
+static void write_v1(std::ostream& out, const TcodeImage& image){
+    for (const std::string& str : image.strings)
+        out << '"' << escape_str(str) << '"';
+    out << '\0';
+    for (Instruction inst : image.instructions){
+        std::array<uint8_t, INSTRUCTION_BYTES> bytes = inst.to_bytes();
+        out.write(reinterpret_cast<const char*>(bytes.data()), INSTRUCTION_BYTES);
+    }
+}
+
+// writes a version 2 file, leaving out empty data and debug sections
+static void write_v2(std::ostream& out, const TcodeImage& image){
+    std::vector<std::pair<uint32_t, std::vector<uint8_t> > > sections;
+    std::vector<uint8_t> buf;
+    for (const Instruction& inst : image.instructions){
+        buf.push_back(inst.op_code);
+        buf.push_back(inst.registers);
+        buf.insert(buf.end(), 6, 0);
+        write_le<uint64_t>(buf, inst.extend);
+    }
+    sections.push_back({CODE_SECTION, buf});
+    buf.clear();
+    write_le<uint32_t>(buf, image.strings.size());
+    for (const std::string& str : image.strings){
+        write_le<uint32_t>(buf, str.size());
+        buf.insert(buf.end(), str.begin(), str.end());
+        pad_to(buf, 4);
+    }
+    sections.push_back({STRING_SECTION, buf});
+    if (image.data_labels.size()){
+        buf.clear();
+        write_le<uint32_t>(buf, image.data_labels.size());
+        for (const DataLabel& label : image.data_labels){
+            write_le<uint32_t>(buf, label.type);
+            write_le<uint32_t>(buf, label.str_index);
+            write_le<uint64_t>(buf, label.size);
+        }
+        sections.push_back({DATA_SECTION, buf});
+    }
+    if (image.symbols.size()){
+        buf.clear();
+        write_le<uint32_t>(buf, image.symbols.size());
+        for (const Symbol& symbol : image.symbols){
+            write_le<uint32_t>(buf, symbol.kind);
+            write_le<uint32_t>(buf, symbol.name.size());
+            write_le<uint64_t>(buf, symbol.value);
+            buf.insert(buf.end(), symbol.name.begin(), symbol.name.end());
+            pad_to(buf, 4);
+        }
+        sections.push_back({DEBUG_SECTION, buf});
+    }
+    if (image.object){
+        buf.clear();
+        write_le<uint32_t>(buf, image.object_symbols.size());
+        for (const ObjectSymbol& symbol : image.object_symbols){
+            write_le<uint32_t>(buf, symbol.kind);
+            write_le<uint32_t>(buf, symbol.flags);
+            write_le<uint32_t>(buf, symbol.name.size());
+            write_le<uint32_t>(buf, 0);
+            write_le<uint64_t>(buf, symbol.value);
+            buf.insert(buf.end(), symbol.name.begin(), symbol.name.end());
+            pad_to(buf, 4);
+        }
+        sections.push_back({SYMBOL_SECTION, buf});
+        buf.clear();
+        write_le<uint32_t>(buf, image.relocations.size());
+        for (const Relocation& reloc : image.relocations){
+            write_le<uint64_t>(buf, reloc.inst);
+            write_le<uint32_t>(buf, reloc.kind);
+            write_le<uint32_t>(buf, reloc.target);
+        }
+        sections.push_back({RELOC_SECTION, buf});
+    }
+    // lay the sections out after the header and section table
+    std::vector<uint8_t> file(TCODE_MAGIC, TCODE_MAGIC + 4);
+    write_le<uint16_t>(file, TCODE_VERSION);
+    write_le<uint16_t>(file, sections.size());
+    write_le<uint32_t>(file, image.object ? TCODE_OBJECT_FLAG : 0);
+    write_le<uint32_t>(file, 0);
+    size_t offset = TCODE_HEADER_BYTES + sections.size() * TCODE_SECTION_BYTES;
+    for (auto& section : sections){
+        offset = (offset + TCODE_ALIGN - 1) / TCODE_ALIGN * TCODE_ALIGN;
+        write_le<uint32_t>(file, section.first);
+        write_le<uint32_t>(file, 0);
+        write_le<uint64_t>(file, offset);
+        write_le<uint64_t>(file, section.second.size());
+        offset += section.second.size();
+    }
+    for (auto& section : sections){
+        pad_to(file, TCODE_ALIGN);
+        file.insert(file.end(), section.second.begin(), section.second.end());
+    }
+    out.write(reinterpret_cast<const char*>(file.data()), file.size());
+}
+
+// writes a program to a tcode file of the given version
+void write_tcode(std::ostream& out, const TcodeImage& image, int version){
+    if (version == 1 && image.object)
+        throw std::runtime_error("object files can only be written in the v2 format");
+    if (version == 1)
+        write_v1(out, image);
+    else if (version == TCODE_VERSION)
+        write_v2(out, image);
+    else
+        throw std::runtime_error("unsupported tcode version: " + std::to_string(version));
+}
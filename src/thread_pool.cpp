@@ -0,0 +1,111 @@
+#include "../inc/thread_pool.h"
+
+// the index of the pool worker running on this thread, tasks it submits go to its own queue
+static thread_local const ThreadPool* current_pool {nullptr};
+static thread_local size_t current_worker {0};
+
+ThreadPool::ThreadPool(size_t threads){
+    if (!threads)
+        threads = 1;
+    for (size_t i = 0; i < threads; i++)
+        this->queues.emplace_back(new WorkQueue());
+    for (size_t i = 0; i < threads; i++)
+        this->workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->task_added.notify_all();
+    for (std::thread& worker : this->workers)
+        worker.join();
+}
+
+// queues a task, spreading tasks from outside the pool across the workers' queues
+void ThreadPool::submit(std::function<void()> task){
+    size_t index;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (current_pool == this)
+            index = current_worker;
+        else
+            index = this->next_queue++ % this->queues.size();
+        this->pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->queues[index]->lock);
+        this->queues[index]->tasks.push_back(std::move(task));
+        this->queued++;
+    }
+    // taking the lock orders the notification after any worker that just found nothing queued starts waiting
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+    }
+    this->task_added.notify_one();
+}
+
+// blocks until every task submitted has finished, rethrowing the first error a task threw
+void ThreadPool::wait(){
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->all_done.wait(guard, [this](){return this->pending == 0;});
+    if (this->error){
+        std::exception_ptr error = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+// takes a task from the back of the worker's own queue, or steals one from the front of another
+bool ThreadPool::take(size_t index, std::function<void()>& task){
+    {
+        WorkQueue& own = *this->queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.tasks.size()){
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            this->queued--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < this->queues.size(); i++){
+        WorkQueue& victim = *this->queues[(index + i) % this->queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.tasks.size()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            this->queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(size_t index){
+    current_pool = this;
+    current_worker = index;
+    std::function<void()> task;
+    while (true){
+        if (this->take(index, task)){
+            try{
+                task();
+            }
+            catch (...){
+                std::lock_guard<std::mutex> guard(this->lock);
+                if (!this->error)
+                    this->error = std::current_exception();
+            }
+            task = nullptr;
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (--this->pending == 0)
+                this->all_done.notify_all();
+            continue;
+        }
+        // sleep until there's work that hasn't been taken yet, or the pool is shutting down
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->task_added.wait(guard, [this](){return this->queued > 0 || this->stopping;});
+        if (this->stopping && this->queued == 0)
+            return;
+    }
+}
@@ -0,0 +1,251 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "../inc/vector.h"
+#include "../inc/machine.h"
+
+// only the AVX2 functions are compiled for AVX2, so the VM still runs on CPUs without it
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAS_AVX2
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+// returns true if the host CPU can run AVX2 instructions
+bool has_avx2(){
+#ifdef HAS_AVX2
+    // this may run before the constructors that detect the CPU's features
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// vector operations are run with AVX2 whenever the host CPU supports it
+static int vector_isa = has_avx2() ? VECTOR_AVX2 : VECTOR_SCALAR;
+
+// sets the instruction set vector operations are run with, throwing an error if the CPU doesn't support it
+void set_vector_isa(int isa){
+    if (isa == VECTOR_AVX2 && !has_avx2())
+        throw std::runtime_error("this CPU doesn't support AVX2");
+    vector_isa = isa;
+}
+
+int get_vector_isa(){
+    return vector_isa;
+}
+
+// sets every lane of a vector to the same value
+static void broadcast_lanes(VectorReg& dst, uint64_t val){
+    for (size_t i = 0; i < VECTOR_LANES; i++)
+        dst.lanes[i] = val;
+}
+
+/* applies a lane-wise operation with portable code. Comparisons set every bit of the lanes they
+   hold for, and shifting by 64 or more clears a lane, as AVX2 does */
+static void lanes_scalar(uint8_t op, const VectorReg& lhs, const VectorReg& rhs, VectorReg& dst){
+    for (size_t i = 0; i < VECTOR_LANES; i++){
+        uint64_t a = lhs.lanes[i];
+        uint64_t b = rhs.lanes[i];
+        uint64_t res = 0;
+        switch (op){
+            case V_ADD:
+                res = a + b;
+                break;
+            case V_SUB:
+                res = a - b;
+                break;
+            case V_MUL:
+                res = a * b;
+                break;
+            case V_AND:
+                res = a & b;
+                break;
+            case V_OR:
+                res = a | b;
+                break;
+            case V_XOR:
+                res = a ^ b;
+                break;
+            case V_SL:
+                res = b < 64 ? a << b : 0;
+                break;
+            case V_SR:
+                res = b < 64 ? a >> b : 0;
+                break;
+            case V_EQ:
+                res = a == b ? UINT64_MAX : 0;
+                break;
+            case V_GT:
+                res = a > b ? UINT64_MAX : 0;
+                break;
+        }
+        dst.lanes[i] = res;
+    }
+}
+
+// reduces the lanes of a vector to a single word with portable code
+static uint64_t reduce_scalar(uint8_t op, const VectorReg& src){
+    uint64_t res = src.lanes[0];
+    for (size_t i = 1; i < VECTOR_LANES; i++){
+        uint64_t lane = src.lanes[i];
+        if (op == V_SUM)
+            res += lane;
+        else if (op == V_MIN)
+            res = lane < res ? lane : res;
+        else
+            res = lane > res ? lane : res;
+    }
+    return res;
+}
+
+#ifdef HAS_AVX2
+// multiplies the low 64 bits of each lane, AVX2 only multiplies 32-bit halves into 64-bit products
+AVX2_FUNC static __m256i mul_avx2(__m256i a, __m256i b){
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+// compares unsigned lanes, AVX2 only compares signed ones, so their sign bits are flipped first
+AVX2_FUNC static __m256i gt_avx2(__m256i a, __m256i b){
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+}
+
+// applies a lane-wise operation with AVX2
+AVX2_FUNC static void lanes_avx2(uint8_t op, const VectorReg& lhs, const VectorReg& rhs, VectorReg& dst){
+    __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(lhs.lanes));
+    __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(rhs.lanes));
+    __m256i res = _mm256_setzero_si256();
+    switch (op){
+        case V_ADD:
+            res = _mm256_add_epi64(a, b);
+            break;
+        case V_SUB:
+            res = _mm256_sub_epi64(a, b);
+            break;
+        case V_MUL:
+            res = mul_avx2(a, b);
+            break;
+        case V_AND:
+            res = _mm256_and_si256(a, b);
+            break;
+        case V_OR:
+            res = _mm256_or_si256(a, b);
+            break;
+        case V_XOR:
+            res = _mm256_xor_si256(a, b);
+            break;
+        case V_SL:
+            res = _mm256_sllv_epi64(a, b);
+            break;
+        case V_SR:
+            res = _mm256_srlv_epi64(a, b);
+            break;
+        case V_EQ:
+            res = _mm256_cmpeq_epi64(a, b);
+            break;
+        case V_GT:
+            res = gt_avx2(a, b);
+            break;
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(dst.lanes), res);
+}
+
+// combines two vectors lane by lane for a reduction
+AVX2_FUNC static __m256i combine_avx2(uint8_t op, __m256i a, __m256i b){
+    if (op == V_SUM)
+        return _mm256_add_epi64(a, b);
+    __m256i gt = gt_avx2(a, b);
+    return op == V_MIN ? _mm256_blendv_epi8(a, b, gt) : _mm256_blendv_epi8(b, a, gt);
+}
+
+// reduces the lanes of a vector to a single word with AVX2, folding its halves together twice
+AVX2_FUNC static uint64_t reduce_avx2(uint8_t op, const VectorReg& src){
+    __m256i val = _mm256_load_si256(reinterpret_cast<const __m256i*>(src.lanes));
+    val = combine_avx2(op, val, _mm256_permute2x128_si256(val, val, 1));
+    val = combine_avx2(op, val, _mm256_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtsi128_si64(_mm256_castsi256_si128(val));
+}
+#endif
+
+// loads a vector from the four words at a guest address
+void load_lanes(GuestMemory& memory, uint64_t addr, VectorReg& dst){
+    std::memcpy(dst.lanes, memory.at(addr, sizeof(VectorReg)), sizeof(VectorReg));
+}
+
+// stores a vector to the four words at a guest address
+void store_lanes(GuestMemory& memory, uint64_t addr, const VectorReg& src){
+    std::memcpy(memory.at(addr, sizeof(VectorReg)), src.lanes, sizeof(VectorReg));
+}
+
+// applies a lane-wise operation with the selected instruction set
+void apply_lanes(uint8_t op, const VectorReg& lhs, const VectorReg& rhs, VectorReg& dst){
+#ifdef HAS_AVX2
+    if (vector_isa == VECTOR_AVX2)
+        return lanes_avx2(op, lhs, rhs, dst);
+#endif
+    lanes_scalar(op, lhs, rhs, dst);
+}
+
+// applies a lane-wise operation with an immediate rhs, which is used for every lane
+void apply_lanes_imm(uint8_t op, const VectorReg& lhs, uint64_t imm, VectorReg& dst){
+    VectorReg rhs;
+    broadcast_lanes(rhs, imm);
+    apply_lanes(op, lhs, rhs, dst);
+}
+
+// reduces the lanes of a vector with the selected instruction set
+uint64_t reduce_lanes(uint8_t op, const VectorReg& src){
+#ifdef HAS_AVX2
+    if (vector_isa == VECTOR_AVX2)
+        return reduce_avx2(op, src);
+#endif
+    return reduce_scalar(op, src);
+}
+
+/* executes a vector operation. They take up the op codes of the thread family after its atomic
+   operations, so the thread family passes them on to here */
+void exec_vector(Machine* machine, uint8_t op_code, bool immediate, uint8_t registers, uint64_t extend){
+    uint8_t r1, r2;
+    machine->split_registers(registers, r1, r2);
+    switch (op_code){
+        case VEC_LOAD:
+            load_lanes(machine->get_memory(), machine->get_register(r2), machine->get_vector(r1));
+            break;
+        case VEC_STORE:
+            store_lanes(machine->get_memory(), machine->get_register(r1), machine->get_vector(r2));
+            break;
+        case VEC_BROADCAST:
+            broadcast_lanes(machine->get_vector(r1), immediate ? extend : machine->get_register(r2));
+            break;
+        case VEC_LANES:
+            if ((extend & 0xff) > V_GT)
+                throw std::runtime_error("malformed binary (invalid operation)");
+            // the immediate is sign extended from the bits above the operation
+            if (immediate)
+                apply_lanes_imm(extend & 0xff, machine->get_vector(r2), static_cast<int64_t>(extend) >> 8, machine->get_vector(r1));
+            else
+                apply_lanes(extend & 0xff, machine->get_vector(r2), machine->get_vector(extend >> 8), machine->get_vector(r1));
+            break;
+        case VEC_REDUCE:
+            if (extend > V_MAX)
+                throw std::runtime_error("malformed binary (invalid operation)");
+            machine->set_register(r1, reduce_lanes(extend, machine->get_vector(r2)));
+            break;
+        case VEC_GET:
+            if (extend >= VECTOR_LANES)
+                throw std::runtime_error("invalid vector lane");
+            machine->set_register(r1, machine->get_vector(r2).lanes[extend]);
+            break;
+        case VEC_SET:
+            if (extend >= VECTOR_LANES)
+                throw std::runtime_error("invalid vector lane");
+            machine->get_vector(r1).lanes[extend] = machine->get_register(r2);
+            break;
+        default:
+            throw std::runtime_error("malformed binary (invalid operation)");
+    }
+}
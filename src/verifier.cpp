@@ -0,0 +1,137 @@
+#include <string>
+
+#include "../inc/verifier.h"
+#include "../inc/machine.h"
+
+// the bounds the operands of a program's instructions are checked against
+struct ProgramBounds{
+    size_t count;
+    size_t strings;
+    size_t labels;
+    size_t ready_labels;
+    bool strict;
+};
+
+/* returns the last op code of a built-in family, the rest of the family's range has no operation.
+   Extensions decide for themselves what their op codes do, so any of them is accepted */
+static int last_op(exec_func func){
+    if (func == exec_mem)
+        return LOAD_ADDR;
+    if (func == exec_logic)
+        return SL;
+    if (func == exec_jump)
+        return RET;
+    if (func == exec_stack)
+        return POP_B;
+    if (func == exec_io)
+        return GET_I;
+    if (func == exec_heap)
+        return HEAP_FREE;
+    if (func == exec_thread)
+        return VEC_SET;
+    return -1;
+}
+
+// returns true if an instruction allocates a data label
+static bool is_alloc(const Instruction& inst, exec_func func){
+    uint8_t op = inst.op_code >> 1;
+    return func == exec_mem && (op == ALLOC_MEM || op == ALLOC_STR);
+}
+
+/* checks an instruction can run without reading or writing past the machine's registers, the
+   program's strings or its data labels, and that it doesn't leave the program. Returns what's
+   wrong with it, or an empty string, setting unsafe if it can't be run at all */
+static std::string check_inst(const Instruction& inst, exec_func func, const ProgramBounds& bounds, bool& unsafe){
+    unsafe = true;
+    uint8_t op = inst.op_code >> 1;
+    bool immediate = inst.op_code & 0x01;
+    if (func == nullptr)
+        return "no extension implements its operation family";
+    int last = last_op(func);
+    if (last >= 0 && op > last)
+        return "invalid operation";
+    if (func == exec_mem){
+        // the immediate forms and loada take the whole register byte as a register
+        if ((immediate || op == LOAD_ADDR) && inst.registers > 15)
+            return "invalid register";
+        if (immediate && op == COPY)
+            return "copy can't take an immediate value";
+        if (op == ALLOC_STR && inst.extend >= bounds.strings)
+            return "invalid string index";
+        if (op == LOAD_ADDR){
+            if (inst.extend == 0 || inst.extend > bounds.labels)
+                return "invalid data label";
+        }
+    }
+    else if ((func == exec_logic || (func == exec_thread && op == FETCH_ADD)) && !immediate && inst.extend > 15)
+        return "invalid register";
+    else if (func == exec_thread && op == VEC_LANES){
+        // lane-wise operations keep the operation in the extend's low byte, and the rhs above it
+        if ((inst.extend & 0xff) > V_GT)
+            return "invalid operation";
+        if (!immediate && (inst.extend >> 8) > 15)
+            return "invalid register";
+    }
+    else if (func == exec_thread && op == VEC_REDUCE && inst.extend > V_MAX)
+        return "invalid operation";
+    else if (func == exec_thread && (op == VEC_GET || op == VEC_SET) && inst.extend >= VECTOR_LANES)
+        return "invalid vector lane";
+    // the rest can be run by the checked interpreters, which stop the program or report an error
+    unsafe = false;
+    if (func == exec_mem && op == LOAD_ADDR && bounds.strict && inst.extend > bounds.ready_labels)
+        return "data label may be used before it's allocated";
+    /* jumps go to the instruction after their target, which wraps around to the first instruction
+       for a label on it, and going to the end of the program exits it */
+    if (func == exec_jump && op != RET && inst.extend + 1 > bounds.count)
+        return "jump target outside of the program";
+    if (func == exec_thread && op == SPAWN && inst.extend + 1 >= bounds.count)
+        return "thread entry point outside of the program";
+    return "";
+}
+
+/* checks every instruction of a decoded program before it's run, proving that each operation has
+   a function to run it, that every register the instruction names exists, that jumps, calls and
+   spawns land inside the program, and that string and data label indices are valid. A data label
+   is only allocated once its instruction runs, so in strict mode every data label used must be
+   allocated by the instructions the program starts with. The first problem that makes the program
+   unsafe is reported over any other */
+VerifyResult verify_code(const DecodedCode& code, size_t string_count, bool strict){
+    VerifyResult result;
+    ProgramBounds bounds{code.size(), string_count, 0, 0, strict};
+    for (size_t i = 0; i < bounds.count; i++){
+        const DecodedOp& op = code.ops[i];
+        if (!is_alloc(code.encode(i), code.families[op.family]))
+            continue;
+        bounds.labels++;
+        if (bounds.ready_labels == i)
+            bounds.ready_labels++;
+    }
+    for (size_t i = 0; i < bounds.count; i++){
+        bool unsafe;
+        std::string error = check_inst(code.encode(i), code.families[code.ops[i].family], bounds, unsafe);
+        if (error.empty() || (!unsafe && !result.error.empty()))
+            continue;
+        result.error = error + " at instruction " + std::to_string(i);
+        if (unsafe)
+            return result;
+    }
+    result.safe = true;
+    result.verified = result.error.empty();
+    result.ready_labels = bounds.ready_labels;
+    return result;
+}
+
+/* prepares a verified program for the unchecked interpreter. Data labels that are known to exist
+   are read without going through the memory family, unless they're loaded into the program
+   counter, and an exit is placed after the last instruction, so running off the end of the
+   program, or jumping to its end, stops it without checking the program counter */
+void specialize_code(DecodedCode& code, const VerifyResult& result){
+    for (size_t i = 0; i < code.size(); i++){
+        DecodedOp& op = code.ops[i];
+        if (op.handler == H_GENERIC && code.families[op.family] == exec_mem && op.op_code == LOAD_ADDR && op.r2 != 0 && code.operands[i] <= result.ready_labels)
+            op.handler = H_LOADA;
+    }
+    DecodedOp exit {};
+    exit.handler = H_EXIT;
+    code.ops.push_back(exit);
+}